@@ -0,0 +1,1659 @@
+/*
+ * Copyright (C) 2015 SensorsData
+ * All rights reserved.
+ */
+
+// SDK 性能基准测试.
+//
+// 用法: benchmark [mode] [-n events] [-o log_prefix] [-i log_file] [-t threads] [-p sample_interval]
+//                  [-d seconds] [-r rate] [-s stall_ms]
+//
+//   mixed   混合事件类型的代表性负载（默认），同时作为 PGO 构建的训练负载.
+//   batch   使用 sa_track_batch 批量跟踪事件，对比单线程与 -t 个线程（默认 4）并行序列化.
+//   replay  预先解析 -i 指定的日志文件，再用 -t 个线程回放共 -n 个事件，输出吞吐与内存分配次数.
+//   memory  对每种 Consumer 运行 -n 个事件或 -d 秒混合负载，定期输出分配次数、堆峰值与 RSS.
+//   latency 使用会阻塞（-s 毫秒，默认 50）、限速或返回 ENOSPC 的 Consumer，按同步、异步阻塞与
+//           异步丢弃三种方式各发送 -n 个事件（-r 指定每秒速率，默认不限），输出调用方延迟的分位数.
+//   startup 在新进程中对比未预热与调用 sa_reserve 之后前几个事件的耗时.
+//   read    使用 sa_log_reader 将 -i 指定的日志文件按字节范围分给 -t 个线程读取，与 getline 对比，
+//           并测量 sa_parse_event 的解析速度.
+//   large   跟踪包含上千个元素的列表属性的事件，对比完整缓冲与 sa_set_streaming 分段序列化的
+//           吞吐和序列化缓冲区的堆峰值.
+//   compress 分别以默认顺序和 sa_set_canonical_order 的固定顺序序列化 -n 个事件（指定 -i 时回放该日志），
+//           输出序列化吞吐以及 zlib 的压缩率和压缩速度. 需要定义 SA_BENCH_ZLIB 并链接 zlib
+//           （make bench-compress）.
+//   signup  每次登录都调用 sa_track_signup，对比不开启与开启 sa_set_signup_dedup 时的吞吐、发送的事件数、
+//           实际误判率和过滤器的内存占用.
+//   setonce 每次会话都调用 sa_profile_set_once，由 -t 个线程对比不开启与开启 sa_set_profile_set_once_cache
+//           时的吞吐、发送的事件数和命中率.
+//   relay   启动 ./sa_relay，由 -t 个进程通过 RelayConsumer 共发送 -n 个事件，输出端到端的吞吐.
+//
+// 未指定 -o 时使用丢弃数据的 Consumer，只统计 SDK 自身的开销.
+// 指定 -p 时开启采样性能分析，结束后输出各阶段的耗时报告.
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(SA_BENCH_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "sensors_analytics.h"
+
+// 丢弃所有数据的 Consumer --------------------------------------------------
+
+static int _null_consumer_send(void* this_, const char* event, unsigned long length) {
+  (void)this_;
+  (void)event;
+  (void)length;
+  return SA_OK;
+}
+
+static int _null_consumer_flush(void* this_) {
+  (void)this_;
+  return SA_OK;
+}
+
+static int _null_consumer_close(void* this_) {
+  (void)this_;
+  return SA_OK;
+}
+
+static struct SAConsumer* _init_null_consumer() {
+  struct SAConsumer* consumer = (struct SAConsumer*)malloc(sizeof(struct SAConsumer));
+  consumer->this_ = malloc(1);
+  consumer->op.send = &_null_consumer_send;
+  consumer->op.flush = &_null_consumer_flush;
+  consumer->op.close = &_null_consumer_close;
+  return consumer;
+}
+
+static int _null_consumer_begin(void* this_) {
+  (void)this_;
+  return SA_OK;
+}
+
+static int _null_consumer_append(void* this_, const char* data, unsigned long length) {
+  (void)this_;
+  (void)data;
+  (void)length;
+  return SA_OK;
+}
+
+static int _null_consumer_end(void* this_) {
+  (void)this_;
+  return SA_OK;
+}
+
+static const struct SAConsumerStreamOp kNullStreamOp = {
+  &_null_consumer_begin,
+  &_null_consumer_append,
+  &_null_consumer_end
+};
+
+static double _now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 统计内存分配的分配器 -----------------------------------------------------
+
+// 通过 sa_set_allocator 统计 SDK 内部的分配次数、字节数、当前占用与峰值.
+static volatile long long g_alloc_count = 0;
+static volatile long long g_alloc_bytes = 0;
+static volatile long long g_alloc_live = 0;
+static volatile long long g_alloc_peak = 0;
+
+static void _counting_update(long long count, long long bytes, long long live) {
+  __atomic_fetch_add(&g_alloc_count, count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&g_alloc_bytes, bytes, __ATOMIC_RELAXED);
+  long long current = __atomic_add_fetch(&g_alloc_live, live, __ATOMIC_RELAXED);
+  long long peak = __atomic_load_n(&g_alloc_peak, __ATOMIC_RELAXED);
+  while (current > peak
+         && !__atomic_compare_exchange_n(&g_alloc_peak, &peak, current, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void* _counting_allocate(unsigned long size, void* ctx) {
+  (void)ctx;
+  _counting_update(1, (long long)size, (long long)size);
+  return malloc(size);
+}
+
+static void* _counting_reallocate(void* ptr, unsigned long old_size, unsigned long new_size, void* ctx) {
+  (void)ctx;
+  _counting_update(1, (long long)new_size, (long long)new_size - (long long)old_size);
+  return realloc(ptr, new_size);
+}
+
+static void _counting_deallocate(void* ptr, unsigned long size, void* ctx) {
+  (void)ctx;
+  _counting_update(0, 0, -(long long)size);
+  free(ptr);
+}
+
+static const SAAllocator kCountingAllocator = {
+  &_counting_allocate, &_counting_reallocate, &_counting_deallocate, NULL
+};
+
+// 当前进程的常驻内存字节数.
+static long long _rss_bytes() {
+  long long pages = 0;
+  long long resident = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (NULL == statm) {
+    return 0;
+  }
+  if (2 != fscanf(statm, "%lld %lld", &pages, &resident)) {
+    resident = 0;
+  }
+  fclose(statm);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 混合负载 -------------------------------------------------------------------
+
+static const char* kEvents[] = {
+  "ViewHomePage", "SearchProduct", "ViewProduct", "AddToCart", "SubmitOrder", "PayOrder"
+};
+
+static const char* kStrings[] = {
+  "iOS",
+  "XX手机",
+  "双卡双待",
+  "Mozilla/5.0 (iPhone; CPU iPhone OS 10_0 like Mac OS X) AppleWebKit/602.1.38",
+  "含有\"引号\"和\\反斜杠\t以及换行\n的字符串",
+  "emoji 😀🎉 与 ümlaut",
+  "https://www.sensorsdata.cn/product?id=1234567&from=search"
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static void _register_super_properties(SensorsAnalytics* sa) {
+  SAProperties* super = sa_init_properties();
+  SA_ASSERT(SA_OK == sa_add_string("$app_version", "3.2.1", strlen("3.2.1"), super));
+  SA_ASSERT(SA_OK == sa_add_string("platform", "服务端", strlen("服务端"), super));
+  SA_ASSERT(SA_OK == sa_add_int("tenant_id", 10086, super));
+  SA_ASSERT(SA_OK == sa_add_bool("is_canary", SA_FALSE, super));
+  SA_ASSERT(SA_OK == sa_register_super_properties(super, sa));
+  sa_free_properties(super);
+}
+
+// 执行一次混合负载中的第 i 个操作.
+static void _run_mixed_once(unsigned long i, SensorsAnalytics* sa) {
+  char distinct_id[32];
+  snprintf(distinct_id, sizeof(distinct_id), "user_%lu", i % 10007);
+
+  SAProperties* properties = sa_init_properties();
+  const char* s0 = kStrings[i % COUNT_OF(kStrings)];
+  const char* s1 = kStrings[(i / 7) % COUNT_OF(kStrings)];
+
+  switch (i % 16) {
+  case 0:
+    // 关联匿名用户与注册用户.
+    SA_ASSERT(SA_OK == sa_add_string("register", "Baidu", strlen("Baidu"), properties));
+    SA_ASSERT(SA_OK == sa_track_signup(distinct_id, "ABCDEF123456789", properties, sa));
+    break;
+  case 1:
+    SA_ASSERT(SA_OK == sa_add_string("nickname", s0, strlen(s0), properties));
+    SA_ASSERT(SA_OK == sa_add_bool("is_vip", (SABool)(i & 1), properties));
+    SA_ASSERT(SA_OK == sa_add_date("$signup_time", (time_t)1500000000 + i, 0, properties));
+    SA_ASSERT(SA_OK == sa_profile_set(distinct_id, properties, sa));
+    break;
+  case 2:
+    SA_ASSERT(SA_OK == sa_add_date("first_time", (time_t)1500000000, 0, properties));
+    SA_ASSERT(SA_OK == sa_profile_set_once(distinct_id, properties, sa));
+    break;
+  case 3:
+    SA_ASSERT(SA_OK == sa_add_number("pay", 5888.5, properties));
+    SA_ASSERT(SA_OK == sa_profile_increment(distinct_id, properties, sa));
+    break;
+  case 4:
+    SA_ASSERT(SA_OK == sa_append_list("title", s0, strlen(s0), properties));
+    SA_ASSERT(SA_OK == sa_profile_append(distinct_id, properties, sa));
+    break;
+  default: {
+    // 大部分流量是普通的 track 事件.
+    SA_ASSERT(SA_OK == sa_add_string("$os", "iOS", strlen("iOS"), properties));
+    SA_ASSERT(SA_OK == sa_add_string("$os_version", "10.0.0", strlen("10.0.0"), properties));
+    SA_ASSERT(SA_OK == sa_add_string("$ip", "123.123.123.123", strlen("123.123.123.123"), properties));
+    SA_ASSERT(SA_OK == sa_add_string("product_name", s0, strlen(s0), properties));
+    SA_ASSERT(SA_OK == sa_add_string("$user_agent", s1, strlen(s1), properties));
+    SA_ASSERT(SA_OK == sa_append_list("product_tag", "大屏", strlen("大屏"), properties));
+    SA_ASSERT(SA_OK == sa_append_list("product_tag", s1, strlen(s1), properties));
+    SA_ASSERT(SA_OK == sa_add_int("product_price", 5888 + (long long)i, properties));
+    SA_ASSERT(SA_OK == sa_add_number("product_discount", 0.8, properties));
+    SA_ASSERT(SA_OK == sa_add_bool("is_first_time", (SABool)(i % 3 == 0), properties));
+    if (i % 5 == 0) {
+      SA_ASSERT(SA_OK == sa_add_date("$time", (time_t)1500000000 + i, 123, properties));
+    }
+    SA_ASSERT(SA_OK == sa_track(distinct_id, kEvents[i % COUNT_OF(kEvents)], properties, sa));
+    break;
+  }
+  }
+
+  sa_free_properties(properties);
+}
+
+static int _bench_mixed(unsigned long events, SensorsAnalytics* sa) {
+  _register_super_properties(sa);
+
+  double start = _now_seconds();
+  unsigned long i;
+  for (i = 0; i < events; ++i) {
+    _run_mixed_once(i, sa);
+  }
+  sa_flush(sa);
+  double elapsed = _now_seconds() - start;
+
+  printf("mixed: %lu events in %.3f s, %.0f events/s, %.1f ns/event\n",
+         events, elapsed, events / elapsed, elapsed * 1e9 / events);
+  return 0;
+}
+
+// 批量负载 -------------------------------------------------------------------
+
+#define BATCH_SIZE 4096
+
+static double _run_batches(
+  SATrackRecord* records, unsigned long events, SensorsAnalytics* sa) {
+  double start = _now_seconds();
+  unsigned long i;
+  for (i = 0; i < events; i += BATCH_SIZE) {
+    unsigned long count = events - i < BATCH_SIZE ? events - i : BATCH_SIZE;
+    SA_ASSERT(SA_OK == sa_track_batch(records, count, sa));
+  }
+  sa_flush(sa);
+  return _now_seconds() - start;
+}
+
+static int _bench_batch(unsigned long events, unsigned int threads, SensorsAnalytics* sa) {
+  _register_super_properties(sa);
+
+  SATrackRecord records[BATCH_SIZE];
+  char distinct_ids[BATCH_SIZE][32];
+  unsigned long i;
+  for (i = 0; i < BATCH_SIZE; ++i) {
+    const char* s0 = kStrings[i % COUNT_OF(kStrings)];
+    SAProperties* properties = sa_init_properties();
+    SA_ASSERT(SA_OK == sa_add_string("$os", "iOS", strlen("iOS"), properties));
+    SA_ASSERT(SA_OK == sa_add_string("$ip", "123.123.123.123", strlen("123.123.123.123"), properties));
+    SA_ASSERT(SA_OK == sa_add_string("product_name", s0, strlen(s0), properties));
+    SA_ASSERT(SA_OK == sa_append_list("product_tag", "大屏", strlen("大屏"), properties));
+    SA_ASSERT(SA_OK == sa_add_int("product_price", 5888 + (long long)i, properties));
+    SA_ASSERT(SA_OK == sa_add_number("product_discount", 0.8, properties));
+    snprintf(distinct_ids[i], sizeof(distinct_ids[i]), "user_%lu", i);
+    records[i].distinct_id = distinct_ids[i];
+    records[i].event = kEvents[i % COUNT_OF(kEvents)];
+    records[i].properties = properties;
+  }
+
+  double serial = _run_batches(records, events, sa);
+  SA_ASSERT(SA_OK == sa_set_serialize_threads(threads, sa));
+  double parallel = _run_batches(records, events, sa);
+  SA_ASSERT(SA_OK == sa_set_serialize_threads(0, sa));
+
+  printf("batch (1 thread):   %lu events in %.3f s, %.0f events/s\n",
+         events, serial, events / serial);
+  printf("batch (%u + 1 threads): %lu events in %.3f s, %.0f events/s, %.2fx\n",
+         threads, events, parallel, events / parallel, serial / parallel);
+
+  for (i = 0; i < BATCH_SIZE; ++i) {
+    sa_free_properties((SAProperties*)records[i].properties);
+  }
+  return 0;
+}
+
+// 回放负载 -------------------------------------------------------------------
+//
+// 预先把 <prefix>.log.<date> 日志文件中的每一行解析为 SAProperties，再用 -t 个线程以最高速率
+// 重新调用 sa_track 等接口，用于基于真实（脱敏后的）数据分布评估 SDK 改动.
+
+typedef enum {
+  REPLAY_TRACK,
+  REPLAY_TRACK_SIGNUP,
+  REPLAY_PROFILE_SET,
+  REPLAY_PROFILE_SET_ONCE,
+  REPLAY_PROFILE_INCREMENT,
+  REPLAY_PROFILE_APPEND,
+  REPLAY_PROFILE_DELETE,
+  REPLAY_UNKNOWN
+} ReplayType;
+
+static const char* kReplayTypes[] = {
+  "track", "track_signup", "profile_set", "profile_set_once",
+  "profile_increment", "profile_append", "profile_delete"
+};
+
+typedef struct {
+  ReplayType type;
+  // 事件的副本，sa_parse_event 原地解析，parsed 中的字符串与属性均引用它.
+  char* line;
+  SAParsedEvent parsed;
+} ReplayRecord;
+
+// 解析一行事件，line 由 record 持有.
+static int _replay_parse_line(char* line, unsigned long length, ReplayRecord* record) {
+  memset(record, 0, sizeof(*record));
+  record->type = REPLAY_UNKNOWN;
+  record->line = line;
+  if (SA_OK != sa_parse_event(line, length, &record->parsed)) {
+    return 0;
+  }
+  unsigned int i;
+  for (i = 0; i < COUNT_OF(kReplayTypes); ++i) {
+    if (0 == strcmp(record->parsed.type, kReplayTypes[i])) {
+      record->type = (ReplayType)i;
+    }
+  }
+  switch (record->type) {
+  case REPLAY_TRACK:
+    return NULL != record->parsed.event;
+  case REPLAY_TRACK_SIGNUP:
+    return NULL != record->parsed.original_id;
+  case REPLAY_UNKNOWN:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+static void _replay_free_record(ReplayRecord* record) {
+  sa_free_parsed_event(&record->parsed);
+  free(record->line);
+}
+
+// 读取日志文件中的所有事件，返回解析成功的事件个数.
+static unsigned long _replay_load(
+  const char* path, ReplayRecord** records, unsigned long* skipped) {
+  SALogReader* reader = NULL;
+  if (SA_OK != sa_log_reader_open(path, 0, 0, &reader)) {
+    return 0;
+  }
+
+  unsigned long count = 0;
+  unsigned long capacity = 1024;
+  *records = (ReplayRecord*)malloc(capacity * sizeof(ReplayRecord));
+  *skipped = 0;
+
+  const char* line = NULL;
+  unsigned long length = 0;
+  while (SA_OK == sa_log_reader_next(reader, &line, &length) && NULL != line) {
+    if (count == capacity) {
+      capacity *= 2;
+      *records = (ReplayRecord*)realloc(*records, capacity * sizeof(ReplayRecord));
+    }
+    // 日志文件以只读方式映射，复制后原地解析.
+    char* copy = (char*)malloc(length);
+    memcpy(copy, line, length);
+    if (_replay_parse_line(copy, length, *records + count)) {
+      ++count;
+    } else {
+      _replay_free_record(*records + count);
+      ++*skipped;
+    }
+  }
+
+  sa_log_reader_close(reader);
+  return count;
+}
+
+static void _replay_once(const ReplayRecord* record, SensorsAnalytics* sa) {
+  switch (record->type) {
+  case REPLAY_TRACK:
+    sa_track(record->parsed.distinct_id, record->parsed.event, record->parsed.properties, sa);
+    break;
+  case REPLAY_TRACK_SIGNUP:
+    sa_track_signup(record->parsed.distinct_id, record->parsed.original_id, record->parsed.properties, sa);
+    break;
+  case REPLAY_PROFILE_SET:
+    sa_profile_set(record->parsed.distinct_id, record->parsed.properties, sa);
+    break;
+  case REPLAY_PROFILE_SET_ONCE:
+    sa_profile_set_once(record->parsed.distinct_id, record->parsed.properties, sa);
+    break;
+  case REPLAY_PROFILE_INCREMENT:
+    sa_profile_increment(record->parsed.distinct_id, record->parsed.properties, sa);
+    break;
+  case REPLAY_PROFILE_APPEND:
+    sa_profile_append(record->parsed.distinct_id, record->parsed.properties, sa);
+    break;
+  case REPLAY_PROFILE_DELETE:
+    sa_profile_delete(record->parsed.distinct_id, sa);
+    break;
+  default:
+    break;
+  }
+}
+
+typedef struct {
+  const ReplayRecord* records;
+  unsigned long count;
+  unsigned long events;
+  unsigned int index;
+  unsigned int threads;
+  SensorsAnalytics* sa;
+} ReplayWorker;
+
+// 第 index 个线程只回放下标模 threads 余 index 的事件，各线程之间不共享 SAProperties.
+static void* _replay_worker(void* arg) {
+  ReplayWorker* worker = (ReplayWorker*)arg;
+  unsigned long slice = (worker->count - worker->index + worker->threads - 1) / worker->threads;
+  unsigned long i;
+  for (i = 0; i < worker->events; ++i) {
+    unsigned long j = worker->index + (i % slice) * worker->threads;
+    _replay_once(worker->records + j, worker->sa);
+  }
+  return NULL;
+}
+
+static int _bench_replay(
+  const char* path, unsigned long events, unsigned int threads, SensorsAnalytics* sa) {
+  if (NULL == path) {
+    fprintf(stderr, "replay mode requires -i log_file.\n");
+    return 1;
+  }
+
+  ReplayRecord* records = NULL;
+  unsigned long skipped = 0;
+  unsigned long count = _replay_load(path, &records, &skipped);
+  if (0 == count) {
+    fprintf(stderr, "No events loaded from [%s].\n", path);
+    free(records);
+    return 1;
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+  if (threads > count) {
+    threads = (unsigned int)count;
+  }
+  printf("replay: loaded %lu events from %s (%lu lines skipped)\n", count, path, skipped);
+
+  ReplayWorker* workers = (ReplayWorker*)malloc(threads * sizeof(ReplayWorker));
+  pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  unsigned int t;
+  for (t = 0; t < threads; ++t) {
+    workers[t].records = records;
+    workers[t].count = count;
+    workers[t].events = events / threads + (t < events % threads ? 1 : 0);
+    workers[t].index = t;
+    workers[t].threads = threads;
+    workers[t].sa = sa;
+  }
+
+  long long alloc_count = __atomic_load_n(&g_alloc_count, __ATOMIC_RELAXED);
+  long long alloc_bytes = __atomic_load_n(&g_alloc_bytes, __ATOMIC_RELAXED);
+  double start = _now_seconds();
+  for (t = 0; t < threads; ++t) {
+    pthread_create(&tids[t], NULL, &_replay_worker, &workers[t]);
+  }
+  for (t = 0; t < threads; ++t) {
+    pthread_join(tids[t], NULL);
+  }
+  sa_flush(sa);
+  double elapsed = _now_seconds() - start;
+  alloc_count = __atomic_load_n(&g_alloc_count, __ATOMIC_RELAXED) - alloc_count;
+  alloc_bytes = __atomic_load_n(&g_alloc_bytes, __ATOMIC_RELAXED) - alloc_bytes;
+
+  printf("replay (%u threads): %lu events in %.3f s, %.0f events/s, %.1f ns/event\n",
+         threads, events, elapsed, events / elapsed, elapsed * 1e9 / events);
+  printf("allocations: %lld (%.2f/event), %lld bytes (%.1f bytes/event)\n",
+         alloc_count, (double)alloc_count / events, alloc_bytes, (double)alloc_bytes / events);
+
+  unsigned long i;
+  for (i = 0; i < count; ++i) {
+    _replay_free_record(records + i);
+  }
+  free(records);
+  free(workers);
+  free(tids);
+  return 0;
+}
+
+// 内存占用 -------------------------------------------------------------------
+//
+// 对每种 Consumer 长时间运行混合负载，定期输出 SDK 的分配次数与字节数、堆占用与峰值以及进程 RSS，
+// 用于评估内存受限容器中的占用与碎片. -d 指定运行秒数，否则运行 -n 个事件.
+
+#define MEMORY_CHECKPOINTS 10
+
+typedef enum {
+  MEMORY_NULL,
+  MEMORY_LOGGING,
+  MEMORY_ASYNC
+} MemoryConsumer;
+
+static const char* kMemoryConsumers[] = { "null", "logging", "async" };
+
+static int _memory_init(MemoryConsumer type, const char* log_prefix, SensorsAnalytics** sa) {
+  struct SAConsumer* consumer = NULL;
+  if (MEMORY_NULL == type) {
+    consumer = _init_null_consumer();
+  } else if (SA_OK != sa_init_logging_consumer(log_prefix, &consumer)) {
+    return 0;
+  }
+  if (MEMORY_ASYNC == type) {
+    struct SAConsumer* async_consumer = NULL;
+    if (SA_OK != sa_init_async_consumer(consumer, 4096, SA_BACKPRESSURE_BLOCK, &async_consumer)) {
+      return 0;
+    }
+    consumer = async_consumer;
+  }
+  return SA_OK == sa_init(consumer, sa);
+}
+
+static void _memory_report(
+  const char* name, unsigned long events, double elapsed, long long rss_base) {
+  long long count = __atomic_load_n(&g_alloc_count, __ATOMIC_RELAXED);
+  long long bytes = __atomic_load_n(&g_alloc_bytes, __ATOMIC_RELAXED);
+  long long rss = _rss_bytes();
+  printf("%-8s %10lu %9.1f %11.2f %11.1f %12lld %12lld %12lld %+12lld\n",
+         name, events, elapsed,
+         events > 0 ? (double)count / events : 0.0,
+         events > 0 ? (double)bytes / events : 0.0,
+         __atomic_load_n(&g_alloc_live, __ATOMIC_RELAXED),
+         __atomic_load_n(&g_alloc_peak, __ATOMIC_RELAXED),
+         rss, rss - rss_base);
+}
+
+static int _bench_memory(unsigned long events, unsigned long duration, const char* log_prefix) {
+  if (NULL == log_prefix) {
+    log_prefix = "benchmark_memory.out";
+  }
+  printf("%-8s %10s %9s %11s %11s %12s %12s %12s %12s\n",
+         "consumer", "events", "seconds", "allocs/evt", "bytes/evt",
+         "heap_live", "heap_peak", "rss", "rss_growth");
+
+  unsigned int type;
+  for (type = MEMORY_NULL; type <= MEMORY_ASYNC; ++type) {
+    SensorsAnalytics* sa = NULL;
+    if (!_memory_init((MemoryConsumer)type, log_prefix, &sa)) {
+      fprintf(stderr, "Failed to initialize the %s consumer.\n", kMemoryConsumers[type]);
+      return 1;
+    }
+    _register_super_properties(sa);
+
+    // 以初始化之后的状态为基准，只统计跟踪事件产生的分配.
+    __atomic_store_n(&g_alloc_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_alloc_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_alloc_peak, __atomic_load_n(&g_alloc_live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    long long rss_base = _rss_bytes();
+
+    double start = _now_seconds();
+    double next_report = start + (double)duration / MEMORY_CHECKPOINTS;
+    unsigned long report_every = events / MEMORY_CHECKPOINTS > 0 ? events / MEMORY_CHECKPOINTS : 1;
+    unsigned long i;
+    for (i = 0; ; ++i) {
+      if (duration > 0) {
+        // 每 1024 个事件检查一次时间.
+        if ((i & 1023) == 0) {
+          double now = _now_seconds();
+          if (now >= next_report) {
+            _memory_report(kMemoryConsumers[type], i, now - start, rss_base);
+            next_report += (double)duration / MEMORY_CHECKPOINTS;
+          }
+          if (now - start >= duration) {
+            break;
+          }
+        }
+      } else {
+        if (i > 0 && i % report_every == 0) {
+          _memory_report(kMemoryConsumers[type], i, _now_seconds() - start, rss_base);
+        }
+        if (i == events) {
+          break;
+        }
+      }
+      _run_mixed_once(i, sa);
+    }
+
+    sa_flush(sa);
+    sa_free(sa);
+    printf("%-8s heap after sa_free: %lld bytes\n", kMemoryConsumers[type],
+           __atomic_load_n(&g_alloc_live, __ATOMIC_RELAXED));
+  }
+  return 0;
+}
+
+// 尾延迟 ---------------------------------------------------------------------
+//
+// 使用会周期性阻塞、限制吞吐或连续返回 ENOSPC 的 Consumer，测量调用方 sa_track 的延迟分布.
+// 指定 -r 时按固定速率发送，延迟从计划发送时间开始计算，避免协调遗漏（coordinated omission）.
+
+#define LATENCY_RECORDS 64
+#define LATENCY_QUEUE_SIZE 1024
+
+typedef struct {
+  const char* name;
+  // 每隔 stall_period_ms 毫秒阻塞 stall_ms 毫秒.
+  unsigned long stall_period_ms;
+  unsigned long stall_ms;
+  // 写入速率上限（字节/秒），0 表示不限.
+  unsigned long bytes_per_second;
+  // 每 enospc_period 个事件中，前 enospc_burst 个事件写入失败.
+  unsigned long enospc_period;
+  unsigned long enospc_burst;
+} StallScenario;
+
+static StallScenario kStallScenarios[] = {
+  { "none", 0, 0, 0, 0, 0 },
+  { "stall", 1000, 50, 0, 0, 0 },
+  { "slow", 0, 0, 4 * 1024 * 1024, 0, 0 },
+  { "enospc", 0, 0, 0, 20000, 2000 },
+};
+
+typedef struct {
+  const StallScenario* scenario;
+  double start;
+  double next_stall;
+  unsigned long long bytes;
+  unsigned long long sent;
+} StallingConsumer;
+
+static void _sleep_seconds(double seconds) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+}
+
+static int _stalling_consumer_send(void* this_, const char* event, unsigned long length) {
+  (void)event;
+  StallingConsumer* consumer = (StallingConsumer*)this_;
+  const StallScenario* scenario = consumer->scenario;
+  unsigned long long sent = consumer->sent++;
+
+  if (scenario->enospc_period > 0 && sent % scenario->enospc_period < scenario->enospc_burst) {
+    return SA_IO_ERROR;
+  }
+
+  double now = _now_seconds();
+  if (scenario->stall_period_ms > 0 && now >= consumer->next_stall) {
+    _sleep_seconds(scenario->stall_ms / 1e3);
+    consumer->next_stall = now + scenario->stall_period_ms / 1e3;
+  }
+
+  consumer->bytes += length;
+  if (scenario->bytes_per_second > 0) {
+    // 超出速率上限 1 ms 以上时等待.
+    double due = consumer->start + (double)consumer->bytes / scenario->bytes_per_second;
+    if (due - now > 1e-3) {
+      _sleep_seconds(due - now);
+    }
+  }
+  return SA_OK;
+}
+
+static struct SAConsumer* _init_stalling_consumer(const StallScenario* scenario) {
+  struct SAConsumer* consumer = (struct SAConsumer*)malloc(sizeof(struct SAConsumer));
+  StallingConsumer* stalling = (StallingConsumer*)malloc(sizeof(StallingConsumer));
+  stalling->scenario = scenario;
+  stalling->start = _now_seconds();
+  stalling->next_stall = stalling->start + scenario->stall_period_ms / 1e3;
+  stalling->bytes = 0;
+  stalling->sent = 0;
+  consumer->this_ = stalling;
+  consumer->op.send = &_stalling_consumer_send;
+  consumer->op.flush = &_null_consumer_flush;
+  consumer->op.close = &_null_consumer_close;
+  return consumer;
+}
+
+typedef enum {
+  LATENCY_SYNC,
+  LATENCY_ASYNC_BLOCK,
+  LATENCY_ASYNC_DROP
+} LatencyMode;
+
+static const char* kLatencyModes[] = { "sync", "async-block", "async-drop" };
+
+static int _compare_latency(const void* a, const void* b) {
+  long long x = *(const long long*)a;
+  long long y = *(const long long*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double _percentile_us(const long long* sorted, unsigned long count, double p) {
+  unsigned long index = (unsigned long)(p * (count - 1) + 0.5);
+  return sorted[index] / 1e3;
+}
+
+static void _ignore_error(SAErrorKind kind, const char* message, void* user_data) {
+  (void)kind;
+  (void)message;
+  (void)user_data;
+}
+
+static int _bench_latency(unsigned long events, unsigned long rate, unsigned long stall_ms) {
+  if (0 == events) {
+    return 1;
+  }
+  SAProperties* records[LATENCY_RECORDS];
+  unsigned long i;
+  for (i = 0; i < LATENCY_RECORDS; ++i) {
+    const char* s0 = kStrings[i % COUNT_OF(kStrings)];
+    records[i] = sa_init_properties();
+    SA_ASSERT(SA_OK == sa_add_string("$os", "iOS", strlen("iOS"), records[i]));
+    SA_ASSERT(SA_OK == sa_add_string("$ip", "123.123.123.123", strlen("123.123.123.123"), records[i]));
+    SA_ASSERT(SA_OK == sa_add_string("product_name", s0, strlen(s0), records[i]));
+    SA_ASSERT(SA_OK == sa_append_list("product_tag", "大屏", strlen("大屏"), records[i]));
+    SA_ASSERT(SA_OK == sa_add_int("product_price", 5888 + (long long)i, records[i]));
+    SA_ASSERT(SA_OK == sa_add_number("product_discount", 0.8, records[i]));
+  }
+  long long* latencies = (long long*)malloc(events * sizeof(long long));
+
+  printf("%-8s %-12s %10s %9s %9s %9s %9s %9s %9s %8s\n",
+         "consumer", "mode", "events/s", "p50_us", "p90_us", "p99_us", "p99.9_us", "p99.99_us", "max_us",
+         "errors");
+
+  unsigned int s;
+  for (s = 0; s < COUNT_OF(kStallScenarios); ++s) {
+    if (kStallScenarios[s].stall_ms > 0 && stall_ms > 0) {
+      kStallScenarios[s].stall_ms = stall_ms;
+    }
+    unsigned int mode;
+    for (mode = LATENCY_SYNC; mode <= LATENCY_ASYNC_DROP; ++mode) {
+      struct SAConsumer* consumer = _init_stalling_consumer(&kStallScenarios[s]);
+      if (LATENCY_SYNC != mode) {
+        struct SAConsumer* async_consumer = NULL;
+        SABackpressure backpressure =
+          LATENCY_ASYNC_BLOCK == mode ? SA_BACKPRESSURE_BLOCK : SA_BACKPRESSURE_DROP;
+        SA_ASSERT(SA_OK == sa_init_async_consumer(consumer, LATENCY_QUEUE_SIZE, backpressure, &async_consumer));
+        consumer = async_consumer;
+      }
+      SensorsAnalytics* sa = NULL;
+      SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+      _register_super_properties(sa);
+
+      unsigned long errors = 0;
+      double start = _now_seconds();
+      for (i = 0; i < events; ++i) {
+        double scheduled = _now_seconds();
+        if (rate > 0) {
+          // 粗略休眠后自旋到计划时间，避免把唤醒延迟计入测量.
+          scheduled = start + (double)i / rate;
+          double now;
+          while ((now = _now_seconds()) < scheduled) {
+            if (scheduled - now > 2e-4) {
+              _sleep_seconds(scheduled - now - 1e-4);
+            }
+          }
+        }
+        char distinct_id[32];
+        snprintf(distinct_id, sizeof(distinct_id), "user_%lu", i % 10007);
+        if (SA_OK != sa_track(distinct_id, kEvents[i % COUNT_OF(kEvents)], records[i % LATENCY_RECORDS], sa)) {
+          ++errors;
+        }
+        latencies[i] = (long long)((_now_seconds() - scheduled) * 1e9);
+      }
+      double elapsed = _now_seconds() - start;
+      sa_free(sa);
+
+      qsort(latencies, events, sizeof(long long), &_compare_latency);
+      printf("%-8s %-12s %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8lu\n",
+             kStallScenarios[s].name, kLatencyModes[mode], events / elapsed,
+             _percentile_us(latencies, events, 0.5),
+             _percentile_us(latencies, events, 0.9),
+             _percentile_us(latencies, events, 0.99),
+             _percentile_us(latencies, events, 0.999),
+             _percentile_us(latencies, events, 0.9999),
+             latencies[events - 1] / 1e3,
+             errors);
+      fflush(stdout);
+    }
+  }
+
+  free(latencies);
+  for (i = 0; i < LATENCY_RECORDS; ++i) {
+    sa_free_properties(records[i]);
+  }
+  return 0;
+}
+
+// 启动预热 -------------------------------------------------------------------
+//
+// 分别在新的子进程中测量未预热和调用 sa_reserve 之后前几个事件的耗时，与稳定运行时的中位数对比.
+
+#define STARTUP_EVENTS 1000
+
+static void _startup_run(const char* log_prefix, int reserve) {
+  struct SAConsumer* consumer = NULL;
+  if (NULL != log_prefix) {
+    SA_ASSERT(SA_OK == sa_init_logging_consumer(log_prefix, &consumer));
+  } else {
+    consumer = _init_null_consumer();
+  }
+  SensorsAnalytics* sa = NULL;
+  SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+  _register_super_properties(sa);
+  if (reserve) {
+    SA_ASSERT(SA_OK == sa_reserve(1, 1024, sa));
+  }
+
+  static long long latencies[STARTUP_EVENTS];
+  unsigned long i;
+  for (i = 0; i < STARTUP_EVENTS; ++i) {
+    // 与混合负载的普通 track 事件相同.
+    double start = _now_seconds();
+    _run_mixed_once(i * 16 + 5, sa);
+    latencies[i] = (long long)((_now_seconds() - start) * 1e9);
+  }
+  sa_free(sa);
+
+  printf("%-10s %10.1f %10.1f %10.1f", reserve ? "reserved" : "cold",
+         latencies[0] / 1e3, latencies[1] / 1e3, latencies[9] / 1e3);
+  qsort(latencies + 100, STARTUP_EVENTS - 100, sizeof(long long), &_compare_latency);
+  printf(" %10.1f\n", latencies[100 + (STARTUP_EVENTS - 100) / 2] / 1e3);
+}
+
+static int _bench_startup(const char* log_prefix) {
+  printf("%-10s %10s %10s %10s %10s\n", "mode", "1st_us", "2nd_us", "10th_us", "steady_us");
+  fflush(stdout);
+  int reserve;
+  for (reserve = 0; reserve <= 1; ++reserve) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "Failed to fork.\n");
+      return 1;
+    }
+    if (0 == pid) {
+      _startup_run(log_prefix, reserve);
+      fflush(stdout);
+      _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return 0;
+}
+
+// 读取日志 -------------------------------------------------------------------
+//
+// 对比 getline 逐行读取与 sa_log_reader 单线程、按字节范围多线程读取日志文件的速度.
+
+typedef struct {
+  const char* path;
+  unsigned long long offset;
+  unsigned long long length;
+  unsigned long records;
+  unsigned long long bytes;
+} ReadRange;
+
+static void* _read_worker(void* arg) {
+  ReadRange* range = (ReadRange*)arg;
+  SALogReader* reader = NULL;
+  if (SA_OK != sa_log_reader_open(range->path, range->offset, range->length, &reader)) {
+    return NULL;
+  }
+  const char* record = NULL;
+  unsigned long length = 0;
+  while (SA_OK == sa_log_reader_next(reader, &record, &length) && NULL != record) {
+    ++range->records;
+    range->bytes += length;
+  }
+  sa_log_reader_close(reader);
+  return NULL;
+}
+
+static void _read_report(const char* name, unsigned long records, unsigned long long bytes, double elapsed) {
+  printf("%-10s %10lu %10.3f %10.2f %12.0f\n", name, records, elapsed, bytes / elapsed / 1e9, records / elapsed);
+}
+
+static int _bench_read(const char* path, unsigned int threads) {
+  FILE* file = NULL;
+  if (NULL == path || NULL == (file = fopen(path, "r"))) {
+    fprintf(stderr, "Failed to open [%s].\n", NULL != path ? path : "");
+    return 1;
+  }
+  fseek(file, 0, SEEK_END);
+  unsigned long long size = (unsigned long long)ftell(file);
+  rewind(file);
+  if (0 == threads) {
+    threads = 1;
+  }
+  printf("%-10s %10s %10s %10s %12s\n", "reader", "records", "seconds", "GB/s", "records/s");
+
+  char* line = NULL;
+  size_t line_size = 0;
+  ssize_t length;
+  unsigned long records = 0;
+  unsigned long long bytes = 0;
+  double start = _now_seconds();
+  while ((length = getline(&line, &line_size, file)) > 0) {
+    ++records;
+    bytes += (unsigned long long)length;
+  }
+  _read_report("getline", records, bytes, _now_seconds() - start);
+  free(line);
+  fclose(file);
+
+  unsigned int counts[2] = { 1, threads };
+  unsigned int run;
+  for (run = 0; run < 2; ++run) {
+    ReadRange* ranges = (ReadRange*)calloc(counts[run], sizeof(ReadRange));
+    pthread_t* workers = (pthread_t*)calloc(counts[run], sizeof(pthread_t));
+    unsigned long long step = size / counts[run] + 1;
+    unsigned int i;
+    start = _now_seconds();
+    for (i = 0; i < counts[run]; ++i) {
+      ranges[i].path = path;
+      ranges[i].offset = step * i;
+      ranges[i].length = step;
+      pthread_create(&workers[i], NULL, &_read_worker, &ranges[i]);
+    }
+    records = 0;
+    bytes = 0;
+    for (i = 0; i < counts[run]; ++i) {
+      pthread_join(workers[i], NULL);
+      records += ranges[i].records;
+      bytes += ranges[i].bytes;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "mmap x%u", counts[run]);
+    _read_report(name, records, bytes, _now_seconds() - start);
+    free(workers);
+    free(ranges);
+  }
+
+  // 单线程读取并用 sa_parse_event 解析每条记录，记录先复制到可写的缓冲区.
+  SALogReader* reader = NULL;
+  if (SA_OK != sa_log_reader_open(path, 0, 0, &reader)) {
+    return 1;
+  }
+  const char* record = NULL;
+  unsigned long record_length = 0;
+  size_t buffer_size = 4096;
+  char* buffer = (char*)malloc(buffer_size);
+  unsigned long failed = 0;
+  records = 0;
+  bytes = 0;
+  start = _now_seconds();
+  while (SA_OK == sa_log_reader_next(reader, &record, &record_length) && NULL != record) {
+    if (record_length > buffer_size) {
+      buffer_size = record_length;
+      buffer = (char*)realloc(buffer, buffer_size);
+    }
+    memcpy(buffer, record, record_length);
+    SAParsedEvent event;
+    if (SA_OK == sa_parse_event(buffer, record_length, &event)) {
+      sa_free_parsed_event(&event);
+    } else {
+      ++failed;
+    }
+    ++records;
+    bytes += record_length;
+  }
+  _read_report("parse x1", records, bytes, _now_seconds() - start);
+  if (failed > 0) {
+    printf("%lu records failed to parse.\n", failed);
+  }
+  free(buffer);
+  sa_log_reader_close(reader);
+  return 0;
+}
+
+// 大事件 ---------------------------------------------------------------------
+//
+// 事件包含 100 至 10000 个元素的列表属性，对比完整缓冲后一次发送与 4096 字节分段序列化的吞吐，
+// 以及跟踪期间 SDK 堆占用的峰值（不含预先构造的属性）.
+
+#define LARGE_EVENTS 200
+#define LARGE_CHUNK_SIZE 4096
+
+static int _bench_large(const char* log_prefix) {
+  static const unsigned long kListSizes[] = { 100, 1000, 10000 };
+  printf("%-10s %8s %10s %12s %10s %12s\n",
+         "mode", "items", "event_kb", "events/s", "MB/s", "heap_peak_kb");
+
+  unsigned int size;
+  for (size = 0; size < sizeof(kListSizes) / sizeof(kListSizes[0]); ++size) {
+    SAProperties* properties = sa_init_properties();
+    char buf[64];
+    unsigned long i;
+    for (i = 0; i < kListSizes[size]; ++i) {
+      snprintf(buf, sizeof(buf), "segment_%lu_用户分群", i);
+      sa_append_list("segments", buf, strlen(buf), properties);
+    }
+    sa_add_int("segment_count", (long long)kListSizes[size], properties);
+
+    int streaming;
+    for (streaming = 0; streaming <= 1; ++streaming) {
+      struct SAConsumer* consumer = NULL;
+      if (NULL != log_prefix) {
+        SA_ASSERT(SA_OK == sa_init_logging_consumer(log_prefix, &consumer));
+      } else {
+        consumer = _init_null_consumer();
+      }
+      SensorsAnalytics* sa = NULL;
+      SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+      _register_super_properties(sa);
+      if (streaming) {
+        SA_ASSERT(SA_OK == sa_set_streaming(
+            NULL != log_prefix ? NULL : &kNullStreamOp, LARGE_CHUNK_SIZE, sa));
+      }
+
+      long long live = __atomic_load_n(&g_alloc_live, __ATOMIC_RELAXED);
+      __atomic_store_n(&g_alloc_peak, live, __ATOMIC_RELAXED);
+      __atomic_store_n(&g_alloc_bytes, 0, __ATOMIC_RELAXED);
+
+      double start = _now_seconds();
+      for (i = 0; i < LARGE_EVENTS; ++i) {
+        SA_ASSERT(SA_OK == sa_track("large_user", "SegmentSnapshot", properties, sa));
+      }
+      double elapsed = _now_seconds() - start;
+      long long peak = __atomic_load_n(&g_alloc_peak, __ATOMIC_RELAXED) - live;
+
+      // 分段序列化时事件不会完整地出现在缓冲区中，事件大小从 sa_write_stats 的字节数得到.
+      char stats[4096];
+      FILE* out = fmemopen(stats, sizeof(stats), "w");
+      sa_write_stats(out, sa);
+      fclose(out);
+      const char* line = strstr(stats, "\nsa_event_bytes_total ");
+      double bytes = NULL != line ? strtod(line + strlen("\nsa_event_bytes_total "), NULL) : 0.0;
+
+      printf("%-10s %8lu %10.1f %12.0f %10.1f %12.1f\n",
+             streaming ? "streaming" : "buffered", kListSizes[size],
+             bytes / LARGE_EVENTS / 1024, LARGE_EVENTS / elapsed, bytes / elapsed / 1e6, peak / 1024.0);
+      sa_free(sa);
+    }
+    sa_free_properties(properties);
+  }
+  return 0;
+}
+
+#if defined(SA_BENCH_ZLIB)
+// 压缩率 ---------------------------------------------------------------------
+//
+// 分别以默认顺序和 sa_set_canonical_order 的固定顺序序列化 -n 个混合负载事件（指定 -i 时回放该日志文件），
+// 输出序列化吞吐，以及 zlib 各压缩级别下的压缩率和压缩速度.
+
+typedef struct {
+  char* data;
+  unsigned long length;
+  unsigned long capacity;
+} CaptureBuffer;
+
+static int _buffer_consumer_send(void* this_, const char* event, unsigned long length) {
+  CaptureBuffer* buffer = (CaptureBuffer*)this_;
+  if (buffer->length + length + 1 > buffer->capacity) {
+    buffer->capacity = (buffer->length + length + 1) * 2;
+    buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->length, event, length);
+  buffer->data[buffer->length + length] = '\n';
+  buffer->length += length + 1;
+  return SA_OK;
+}
+
+static int _buffer_consumer_close(void* this_) {
+  free(((CaptureBuffer*)this_)->data);
+  return SA_OK;
+}
+
+static int _bench_compress(unsigned long events, const char* input) {
+  ReplayRecord* records = NULL;
+  unsigned long count = 0;
+  if (NULL != input) {
+    unsigned long skipped = 0;
+    count = _replay_load(input, &records, &skipped);
+    if (0 == count) {
+      fprintf(stderr, "No events loaded from [%s].\n", input);
+      free(records);
+      return 1;
+    }
+  }
+  static const int kLevels[] = { 1, 6, 9 };
+  printf("%-10s %10s %10s %12s %6s %8s %12s\n",
+         "layout", "events", "raw_mb", "events/s", "level", "ratio", "deflate_MB/s");
+
+  int canonical;
+  for (canonical = 0; canonical <= 1; ++canonical) {
+    struct SAConsumer* consumer = _init_null_consumer();
+    free(consumer->this_);
+    consumer->this_ = calloc(1, sizeof(CaptureBuffer));
+    consumer->op.send = &_buffer_consumer_send;
+    consumer->op.close = &_buffer_consumer_close;
+    SensorsAnalytics* sa = NULL;
+    SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+    _register_super_properties(sa);
+    SA_ASSERT(SA_OK == sa_set_canonical_order((SABool)canonical, NULL, 0, sa));
+
+    double start = _now_seconds();
+    unsigned long i;
+    for (i = 0; i < events; ++i) {
+      if (NULL != records) {
+        _replay_once(records + i % count, sa);
+      } else {
+        _run_mixed_once(i, sa);
+      }
+    }
+    double elapsed = _now_seconds() - start;
+    const CaptureBuffer* buffer = (const CaptureBuffer*)consumer->this_;
+
+    uLongf bound = compressBound(buffer->length);
+    Bytef* compressed = (Bytef*)malloc(bound);
+    unsigned int level;
+    for (level = 0; level < COUNT_OF(kLevels); ++level) {
+      uLongf size = bound;
+      double deflate_start = _now_seconds();
+      SA_ASSERT(Z_OK == compress2(compressed, &size, (const Bytef*)buffer->data, buffer->length, kLevels[level]));
+      double deflate_elapsed = _now_seconds() - deflate_start;
+      printf("%-10s %10lu %10.1f %12.0f %6d %8.2f %12.1f\n",
+             canonical ? "canonical" : "default", events, buffer->length / 1e6, events / elapsed,
+             kLevels[level], (double)buffer->length / size, buffer->length / deflate_elapsed / 1e6);
+    }
+    free(compressed);
+    sa_free(sa);
+  }
+
+  unsigned long i;
+  for (i = 0; i < count; ++i) {
+    _replay_free_record(records + i);
+  }
+  free(records);
+  return 0;
+}
+#endif
+
+// 注册事件去重 ---------------------------------------------------------------
+//
+// 模拟每次登录都调用 sa_track_signup 的业务: -n 次登录平均分布在 n / 10 个用户上，分别在不开启去重、
+// 容量充足以及容量只有用户数 1/8（需要扩展）时运行，输出吞吐、实际发送的事件数、被抑制的事件数、
+// 实际误判率（首次注册被误丢弃的比例）以及过滤器占用的内存.
+
+// 统计发送的事件数，可以由多个线程同时调用.
+static volatile long long g_events_sent = 0;
+
+static int _counting_consumer_send(void* this_, const char* event, unsigned long length) {
+  (void)this_;
+  (void)event;
+  (void)length;
+  __sync_add_and_fetch(&g_events_sent, 1);
+  return SA_OK;
+}
+
+typedef struct {
+  const char* name;
+  // 与用户数的比例，0 表示不开启去重.
+  double expected_ratio;
+  double fp_rate;
+} SignupScenario;
+
+static const SignupScenario kSignupScenarios[] = {
+  { "off", 0, 0 },
+  { "fp=1%", 1, 0.01 },
+  { "fp=0.1%", 1, 0.001 },
+  { "fp=0.1%,scaled", 0.125, 0.001 },
+};
+
+static int _bench_signup(unsigned long events) {
+  unsigned long users = events / 10 > 0 ? events / 10 : 1;
+  char* seen = (char*)malloc(users);
+  printf("%-16s %10s %10s %12s %10s %10s %10s %10s\n",
+         "dedup", "logins", "users", "calls/s", "sent", "suppressed", "false_pos", "filter_kb");
+
+  unsigned long s;
+  for (s = 0; s < COUNT_OF(kSignupScenarios); ++s) {
+    const SignupScenario* scenario = &kSignupScenarios[s];
+    struct SAConsumer* consumer = _init_null_consumer();
+    consumer->op.send = &_counting_consumer_send;
+    SensorsAnalytics* sa = NULL;
+    SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+    long long live_before = g_alloc_live;
+    if (scenario->expected_ratio > 0) {
+      SA_ASSERT(SA_OK == sa_set_signup_dedup(
+          (unsigned long)(users * scenario->expected_ratio), scenario->fp_rate, 0, sa));
+    }
+
+    memset(seen, 0, users);
+    unsigned long unique = 0;
+    g_events_sent = 0;
+    unsigned long long state = 88172645463325252ULL;
+    char distinct_id[32];
+    char origin_id[32];
+    double begin = _now_seconds();
+    unsigned long i;
+    for (i = 0; i < events; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      unsigned long user = (unsigned long)(state % users);
+      if (!seen[user]) {
+        seen[user] = 1;
+        ++unique;
+      }
+      snprintf(distinct_id, sizeof(distinct_id), "user_%lu", user);
+      snprintf(origin_id, sizeof(origin_id), "anon_%lu", user);
+      sa_track_signup(distinct_id, origin_id, NULL, sa);
+    }
+    double elapsed = _now_seconds() - begin;
+    long long filter_bytes = g_alloc_live - live_before;
+
+    unsigned long long sent = (unsigned long long)g_events_sent;
+    // 开启去重后每个用户应发送一次，少于用户数的部分是误判.
+    double false_positive = scenario->expected_ratio > 0 && unique > 0
+        ? (double)(unique - sent) / unique : 0;
+    printf("%-16s %10lu %10lu %12.0f %10llu %10llu %9.4f%% %10.1f\n",
+           scenario->name, events, unique, events / elapsed, sent,
+           (unsigned long long)(events - sent), false_positive * 100,
+           scenario->expected_ratio > 0 ? filter_bytes / 1024.0 : 0.0);
+    sa_free(sa);
+  }
+  free(seen);
+  return 0;
+}
+
+// 用户属性 set_once 去重 -----------------------------------------------------
+//
+// 模拟每次会话开始都调用 sa_profile_set_once 的业务: -n 次会话平均分布在 n / 20 个用户上，每次设置 4 个属性，
+// 由 -t 个线程并发调用. 分别在不开启去重、容量为所需的 1.25 倍、只有 1/4 以及只有 1 个分片时运行，
+// 输出吞吐、实际发送的事件数和命中率.
+
+typedef struct {
+  const char* name;
+  // 与用户数 * 4 的比例，0 表示不开启去重.
+  double capacity_ratio;
+  unsigned int shards;
+} SetOnceScenario;
+
+static const SetOnceScenario kSetOnceScenarios[] = {
+  { "off", 0, 0 },
+  { "1.25x,16 shards", 1.25, 16 },
+  { "0.25x,16 shards", 0.25, 16 },
+  { "1.25x,1 shard", 1.25, 1 },
+};
+
+typedef struct {
+  SensorsAnalytics* sa;
+  unsigned long sessions;
+  unsigned long users;
+  unsigned int index;
+  unsigned int threads;
+} SetOnceWorker;
+
+static void* _set_once_worker(void* arg) {
+  SetOnceWorker* worker = (SetOnceWorker*)arg;
+  char distinct_id[32];
+  char value[32];
+  unsigned long i;
+  for (i = worker->index; i < worker->sessions; i += worker->threads) {
+    unsigned long long state = (i + 1) * 0x9e3779b97f4a7c15ULL;
+    state ^= state >> 31;
+    unsigned long user = (unsigned long)(state % worker->users);
+    snprintf(distinct_id, sizeof(distinct_id), "user_%lu", user);
+    SAProperties* properties = sa_init_properties();
+    snprintf(value, sizeof(value), "2016-%02lu-%02lu", user % 12 + 1, user % 28 + 1);
+    sa_add_string("first_visit_day", value, strlen(value), properties);
+    sa_add_string("first_channel", kStrings[user % COUNT_OF(kStrings)], strlen(kStrings[user % COUNT_OF(kStrings)]), properties);
+    sa_add_string("first_os", user % 2 ? "iOS" : "Android", user % 2 ? 3 : 7, properties);
+    sa_add_int("first_app_build", (long long)(user % 100), properties);
+    sa_profile_set_once(distinct_id, properties, worker->sa);
+    sa_free_properties(properties);
+  }
+  return NULL;
+}
+
+// 从 sa_write_stats 的输出中读取一个指标.
+static long long _read_metric(SensorsAnalytics* sa, const char* name) {
+  char* text = NULL;
+  size_t size = 0;
+  FILE* out = open_memstream(&text, &size);
+  sa_write_stats(out, sa);
+  fclose(out);
+  long long value = 0;
+  unsigned long length = strlen(name);
+  char* line;
+  for (line = text; NULL != line && '\0' != *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+    if (0 == strncmp(line, name, length) && ' ' == line[length]) {
+      value = strtoll(line + length + 1, NULL, 10);
+      break;
+    }
+  }
+  free(text);
+  return value;
+}
+
+static int _bench_set_once(unsigned long sessions, unsigned int threads) {
+  unsigned long users = sessions / 20 > 0 ? sessions / 20 : 1;
+  if (0 == threads) {
+    threads = 1;
+  }
+  printf("%-16s %8s %10s %10s %12s %10s %10s\n",
+         "cache", "threads", "sessions", "users", "calls/s", "sent", "hit_rate");
+
+  unsigned long s;
+  for (s = 0; s < COUNT_OF(kSetOnceScenarios); ++s) {
+    const SetOnceScenario* scenario = &kSetOnceScenarios[s];
+    struct SAConsumer* consumer = _init_null_consumer();
+    consumer->op.send = &_counting_consumer_send;
+    SensorsAnalytics* sa = NULL;
+    SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+    if (scenario->capacity_ratio > 0) {
+      SA_ASSERT(SA_OK == sa_set_profile_set_once_cache(
+          (unsigned long)(users * 4 * scenario->capacity_ratio), scenario->shards, sa));
+    }
+
+    g_events_sent = 0;
+    pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    SetOnceWorker* workers = (SetOnceWorker*)malloc(threads * sizeof(SetOnceWorker));
+    double begin = _now_seconds();
+    unsigned int t;
+    for (t = 0; t < threads; ++t) {
+      workers[t].sa = sa;
+      workers[t].sessions = sessions;
+      workers[t].users = users;
+      workers[t].index = t;
+      workers[t].threads = threads;
+      pthread_create(&tids[t], NULL, &_set_once_worker, &workers[t]);
+    }
+    for (t = 0; t < threads; ++t) {
+      pthread_join(tids[t], NULL);
+    }
+    double elapsed = _now_seconds() - begin;
+
+    long long hits = _read_metric(sa, "sa_set_once_cache_hits_total");
+    long long misses = _read_metric(sa, "sa_set_once_cache_misses_total");
+    printf("%-16s %8u %10lu %10lu %12.0f %10lld %9.1f%%\n",
+           scenario->name, threads, sessions, users, sessions / elapsed, (long long)g_events_sent,
+           hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+    free(workers);
+    free(tids);
+    sa_free(sa);
+  }
+  return 0;
+}
+
+// 本机中继 -------------------------------------------------------------------
+//
+// 启动 ./sa_relay，由 -t 个子进程（默认 4）通过 RelayConsumer 共发送 -n 个事件，计时到 sa_relay
+// 读完 socket 并退出为止，之后检查日志文件中的事件数. raw 模式发送预先序列化的混合负载事件，
+// 只测量中继本身，track 模式在子进程中调用 sa_track 等接口.
+
+#define RELAY_SAMPLES 16
+#define RELAY_SOCKET "benchmark_relay.sock"
+
+// 保存混合负载前 RELAY_SAMPLES 个操作序列化后的事件.
+typedef struct {
+  char* events[RELAY_SAMPLES];
+  unsigned long lengths[RELAY_SAMPLES];
+  unsigned int count;
+} RelaySamples;
+
+static int _capture_consumer_send(void* this_, const char* event, unsigned long length) {
+  RelaySamples* samples = (RelaySamples*)this_;
+  if (samples->count < RELAY_SAMPLES) {
+    samples->events[samples->count] = strndup(event, length);
+    samples->lengths[samples->count] = length;
+    ++samples->count;
+  }
+  return SA_OK;
+}
+
+static void _relay_capture(RelaySamples* samples) {
+  struct SAConsumer* consumer = _init_null_consumer();
+  free(consumer->this_);
+  consumer->this_ = calloc(1, sizeof(RelaySamples));
+  consumer->op.send = &_capture_consumer_send;
+  SensorsAnalytics* sa = NULL;
+  SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+  _register_super_properties(sa);
+  unsigned long i;
+  for (i = 0; i < RELAY_SAMPLES; ++i) {
+    _run_mixed_once(i, sa);
+  }
+  memcpy(samples, consumer->this_, sizeof(RelaySamples));
+  sa_free(sa);
+}
+
+static void _relay_produce(
+    const RelaySamples* samples, int raw, unsigned long batch_bytes, unsigned long first,
+    unsigned long events) {
+  struct SAConsumer* consumer = NULL;
+  SA_ASSERT(SA_OK == sa_init_relay_consumer(RELAY_SOCKET, batch_bytes, &consumer));
+  unsigned long i;
+  if (raw) {
+    for (i = first; i < first + events; ++i) {
+      const unsigned int k = (unsigned int)(i % samples->count);
+      SA_ASSERT(SA_OK == consumer->op.send(consumer->this_, samples->events[k], samples->lengths[k]));
+    }
+    consumer->op.close(consumer->this_);
+    free(consumer->this_);
+    free(consumer);
+  } else {
+    SensorsAnalytics* sa = NULL;
+    SA_ASSERT(SA_OK == sa_init(consumer, &sa));
+    _register_super_properties(sa);
+    for (i = first; i < first + events; ++i) {
+      _run_mixed_once(i, sa);
+    }
+    sa_free(sa);
+  }
+}
+
+// 启动 sa_relay 并等待 socket 就绪.
+static pid_t _relay_start(const char* log_prefix, const char* validate) {
+  unlink(RELAY_SOCKET);
+  pid_t pid = fork();
+  if (0 == pid) {
+    // sa_relay 退出时输出的统计数据不混入结果表格.
+    SA_ASSERT(NULL != freopen("/dev/null", "w", stderr));
+    execl("./sa_relay", "sa_relay", "-s", RELAY_SOCKET, "-o", log_prefix, "-v", validate, (char*)NULL);
+    _exit(127);
+  }
+  int i;
+  for (i = 0; i < 500 && 0 != access(RELAY_SOCKET, F_OK); ++i) {
+    _sleep_seconds(0.01);
+  }
+  return pid;
+}
+
+static int _bench_relay(unsigned long events, unsigned int producers, const char* log_prefix) {
+  static const struct {
+    const char* name;
+    int raw;
+    unsigned long batch_bytes;
+    const char* validate;
+  } kRuns[] = {
+    { "raw", 1, 0, "frame" },
+    { "raw", 1, 32768, "frame" },
+    { "raw", 1, 32768, "full" },
+    { "track", 0, 32768, "frame" },
+  };
+  if (NULL == log_prefix) {
+    log_prefix = "benchmark_relay.out";
+  }
+  if (0 == producers) {
+    producers = 1;
+  }
+  if (0 != access("./sa_relay", X_OK)) {
+    fprintf(stderr, "Relay mode requires ./sa_relay, run 'make sa_relay' first.\n");
+    return 1;
+  }
+  RelaySamples samples;
+  _relay_capture(&samples);
+
+  // 与 LoggingConsumer 相同的日期后缀.
+  time_t now = time(NULL);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  char path[512];
+  snprintf(path, sizeof(path), "%s.log.%d", log_prefix,
+           tm.tm_year * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday);
+
+  printf("%-6s %8s %8s %10s %10s %12s %8s %10s\n",
+         "mode", "batch", "verify", "producers", "seconds", "events/s", "MB/s", "written");
+  unsigned int run;
+  for (run = 0; run < COUNT_OF(kRuns); ++run) {
+    unlink(path);
+    pid_t relay = _relay_start(log_prefix, kRuns[run].validate);
+
+    double start = _now_seconds();
+    unsigned int p;
+    for (p = 0; p < producers; ++p) {
+      unsigned long first = events / producers * p;
+      unsigned long count = p + 1 == producers ? events - first : events / producers;
+      if (0 == fork()) {
+        _relay_produce(&samples, kRuns[run].raw, kRuns[run].batch_bytes, first, count);
+        _exit(0);
+      }
+    }
+    int status = 0;
+    for (p = 0; p < producers; ++p) {
+      wait(&status);
+    }
+    kill(relay, SIGTERM);
+    waitpid(relay, &status, 0);
+    double elapsed = _now_seconds() - start;
+
+    // 检查是否有事件丢失.
+    unsigned long written = 0;
+    unsigned long long bytes = 0;
+    SALogReader* reader = NULL;
+    if (SA_OK == sa_log_reader_open(path, 0, 0, &reader)) {
+      const char* record = NULL;
+      unsigned long length = 0;
+      while (SA_OK == sa_log_reader_next(reader, &record, &length) && NULL != record) {
+        ++written;
+        bytes += length + 1;
+      }
+      sa_log_reader_close(reader);
+    }
+    printf("%-6s %8lu %8s %10u %10.3f %12.0f %8.1f %10lu\n",
+           kRuns[run].name, kRuns[run].batch_bytes, kRuns[run].validate, producers, elapsed,
+           events / elapsed, bytes / elapsed / 1e6, written);
+    fflush(stdout);
+  }
+  unlink(path);
+
+  unsigned int i;
+  for (i = 0; i < samples.count; ++i) {
+    free(samples.events[i]);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const char* mode = "mixed";
+  const char* log_prefix = NULL;
+  const char* input = NULL;
+  unsigned long events = 200000;
+  unsigned int threads = 4;
+  unsigned long sample_interval = 0;
+  unsigned long duration = 0;
+  unsigned long rate = 0;
+  unsigned long stall_ms = 0;
+
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "-n") && i + 1 < argc) {
+      events = strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-o") && i + 1 < argc) {
+      log_prefix = argv[++i];
+    } else if (0 == strcmp(argv[i], "-i") && i + 1 < argc) {
+      input = argv[++i];
+    } else if (0 == strcmp(argv[i], "-t") && i + 1 < argc) {
+      threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-p") && i + 1 < argc) {
+      sample_interval = strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-d") && i + 1 < argc) {
+      duration = strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-r") && i + 1 < argc) {
+      rate = strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+      stall_ms = strtoul(argv[++i], NULL, 10);
+    } else if (argv[i][0] != '-') {
+      mode = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [mixed|batch|replay|memory|latency|startup|read|large|relay|compress|signup|setonce] [-n events] [-o log_prefix] [-i log_file] [-t threads] [-p sample_interval] [-d seconds] [-r rate] [-s stall_ms]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // 回放与内存模式统计 SDK 内部的内存分配，分配器需要在创建任何 SDK 对象之前设置.
+  if (0 == strcmp(mode, "replay") || 0 == strcmp(mode, "memory") || 0 == strcmp(mode, "large")
+      || 0 == strcmp(mode, "signup")) {
+    SA_ASSERT(SA_OK == sa_set_allocator(&kCountingAllocator));
+  }
+  if (0 == strcmp(mode, "read")) {
+    return _bench_read(input, threads);
+  }
+  // 大事件模式分别创建缓冲与分段序列化的 SDK 实例.
+  if (0 == strcmp(mode, "large")) {
+    return _bench_large(log_prefix);
+  }
+  // 内存模式依次创建各种 Consumer.
+  if (0 == strcmp(mode, "memory")) {
+    return _bench_memory(events, duration, log_prefix);
+  }
+  // 启动模式在子进程中创建 SDK 对象.
+  if (0 == strcmp(mode, "startup")) {
+    return _bench_startup(log_prefix);
+  }
+  // 压缩模式分别创建默认顺序与固定顺序的 SDK 实例.
+  if (0 == strcmp(mode, "compress")) {
+#if defined(SA_BENCH_ZLIB)
+    return _bench_compress(events, input);
+#else
+    fprintf(stderr, "The compress mode requires SA_BENCH_ZLIB and zlib, use make bench-compress.\n");
+    return 1;
+#endif
+  }
+  // 去重模式对每种设置分别创建 SDK 实例.
+  if (0 == strcmp(mode, "signup")) {
+    return _bench_signup(events);
+  }
+  if (0 == strcmp(mode, "setonce")) {
+    return _bench_set_once(events, threads);
+  }
+  // 中继模式在子进程中创建 SDK 对象.
+  if (0 == strcmp(mode, "relay")) {
+    return _bench_relay(events, threads, log_prefix);
+  }
+  // 延迟模式中 Consumer 写入失败是预期的，不输出诊断信息.
+  if (0 == strcmp(mode, "latency")) {
+    sa_set_error_callback(&_ignore_error, NULL);
+    return _bench_latency(events, rate, stall_ms);
+  }
+
+  struct SAConsumer* consumer = NULL;
+  if (NULL != log_prefix) {
+    if (SA_OK != sa_init_logging_consumer(log_prefix, &consumer)) {
+      fprintf(stderr, "Failed to initialize the consumer.\n");
+      return 1;
+    }
+  } else {
+    consumer = _init_null_consumer();
+  }
+
+  SensorsAnalytics* sa = NULL;
+  if (SA_OK != sa_init(consumer, &sa)) {
+    fprintf(stderr, "Failed to initialize the SDK.\n");
+    return 1;
+  }
+
+  if (sample_interval > 0) {
+    SA_ASSERT(SA_OK == sa_set_profiling(sample_interval, sa));
+  }
+
+  int res = 1;
+  if (0 == strcmp(mode, "mixed")) {
+    res = _bench_mixed(events, sa);
+  } else if (0 == strcmp(mode, "batch")) {
+    res = _bench_batch(events, threads, sa);
+  } else if (0 == strcmp(mode, "replay")) {
+    res = _bench_replay(input, events, threads, sa);
+  } else {
+    fprintf(stderr, "Unknown mode [%s].\n", mode);
+  }
+
+  if (sample_interval > 0) {
+    sa_dump_profile(stdout, sa);
+  }
+
+  sa_free(sa);
+  return res;
+}
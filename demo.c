@@ -172,6 +172,16 @@ int main(int args, char** argv) {
 
   // 3. 用户提交订单.
 
+  // 同一个请求中的事件都带有相同的请求 ID，压入作用域后无需逐个添加到事件属性中.
+  properties = sa_init_properties();
+  if (NULL == properties) {
+    fprintf(stderr, "Failed to initialize the properties.");
+    return 1;
+  }
+  SA_ASSERT(SA_OK == sa_add_string("request_id", "req-20170101-0001", strlen("req-20170101-0001"), properties));
+  SA_ASSERT(SA_OK == sa_scope_push(properties, sa));
+  sa_free_properties(properties);
+
   // 3.1 记录用户提交订单事件.
   {
     properties = sa_init_properties();
@@ -238,6 +248,8 @@ int main(int args, char** argv) {
     sa_free_properties(properties);
   }
 
+  SA_ASSERT(SA_OK == sa_scope_pop(sa));
+
   // 4. 其他.
 
   // 4.1 删除用户某个属性.
@@ -256,6 +268,9 @@ int main(int args, char** argv) {
     SA_ASSERT(SA_INVALID_PARAMETER_ERROR == sa_track(login_id, "100vip", NULL, sa));
   }
 
+  // 5. 以 Prometheus 文本格式输出 SDK 的统计数据.
+  SA_ASSERT(SA_OK == sa_write_stats(stdout, sa));
+
   sa_flush(sa);
   sa_free(sa);
 
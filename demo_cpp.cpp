@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2015 SensorsData
+ * All rights reserved.
+ */
+
+#include <future>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "sensors_analytics.hpp"
+
+// 核心事件使用 SA_EVENT 声明，序列化函数在编译期生成.
+SA_EVENT(OrderPaid, (double, amount), (std::string_view, sku), (int, quantity), (bool, is_vip));
+
+#if defined(__cpp_impl_coroutine)
+// 演示用的协程类型，创建后立即执行，不等待结果.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { abort(); }
+  };
+};
+
+// 在协程中跟踪事件并等待写入完成，队列已满时挂起协程而不阻塞线程.
+DetachedTask track_in_coroutine(sa::Analytics analytics, const char* distinct_id, std::promise<int>* done) {
+  int res = co_await analytics.track_async(
+      distinct_id, analytics.event("CheckIn").set("channel", "coroutine"));
+  if (SA_OK == res) {
+    res = co_await analytics.flush_async();
+  }
+  done->set_value(res);
+}
+#endif
+
+// 只保留最近一条事件的 Consumer，用于比较两种接口输出的事件.
+struct LastEvent {
+  char event[4096];
+  unsigned long length;
+};
+
+static int _last_event_send(void* this_, const char* event, unsigned long length) {
+  LastEvent* last = static_cast<LastEvent*>(this_);
+  if (length >= sizeof(last->event)) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  memcpy(last->event, event, length);
+  last->length = length;
+  return SA_OK;
+}
+
+static int _last_event_flush(void*) { return SA_OK; }
+
+static int _last_event_close(void*) { return SA_OK; }
+
+// 去掉事件中的 "time" 字段，两次跟踪的时间可能不同.
+static std::string _without_time(const LastEvent* last) {
+  std::string event(last->event, last->length);
+  std::string::size_type begin = event.find(",\"time\":");
+  if (std::string::npos != begin) {
+    event.erase(begin, event.find(',', begin + 1) - begin);
+  }
+  return event;
+}
+
+int main(int args, char** argv) {
+  (void)(args);
+  (void)(argv);
+
+  SALoggingConsumer* consumer = NULL;
+  if (SA_OK != sa_init_logging_consumer("demo_cpp.out", &consumer)) {
+    fprintf(stderr, "Failed to initialize the consumer.");
+    return 1;
+  }
+
+  // 使用 AsyncConsumer，由后台线程写入日志文件.
+  SAAsyncConsumer* async_consumer = NULL;
+  if (SA_OK != sa_init_async_consumer(consumer, 1024, SA_BACKPRESSURE_BLOCK, &async_consumer)) {
+    fprintf(stderr, "Failed to initialize the async consumer.");
+    return 1;
+  }
+
+  SensorsAnalytics *sa = NULL;
+  if (SA_OK != sa_init(async_consumer, &sa)) {
+    fprintf(stderr, "Failed to initialize the SDK.");
+    return 1;
+  }
+
+  // 公共属性对 C++ 接口同样生效.
+  SAProperties* super_properties = sa_init_properties();
+  SA_ASSERT(SA_OK == sa_add_string("$app_version", "1.0.0", strlen("1.0.0"), super_properties));
+  SA_ASSERT(SA_OK == sa_add_string("$os", "Linux", strlen("Linux"), super_properties));
+  SA_ASSERT(SA_OK == sa_register_super_properties(super_properties, sa));
+  sa_free_properties(super_properties);
+
+  const char* cookie_id = "ABCDEF123456789";
+  std::string sku = "XX手机-\"旗舰版\"";
+
+  // 1. 浏览商品，事件属性直接写入栈上的缓冲区.
+  SA_ASSERT(SA_OK == sa::Event(sa, "ViewProduct")
+                         .set("$os", "iOS")
+                         .set("product_name", std::string_view(sku))
+                         .set("product_tag", {"大屏", "双卡双待"})
+                         .set("product_price", 5888)
+                         .set("product_discount", 0.8)
+                         .set("is_first_time", false)
+                         .set_date("view_time", time(NULL), 0)
+                         .track(cookie_id));
+
+  // 2. Event 可以移动，同名属性以最后一次设置为准.
+  {
+    sa::Event event(sa, "SubmitOrder");
+    event.set("product_price", 1).set("product_name", sku).set("product_price", 5888);
+    sa::Event moved = std::move(event);
+    SA_ASSERT(SA_OK == moved.track(cookie_id));
+  }
+
+#if defined(__cpp_consteval)
+  // 3. C++20 中可以使用编译期检查的事件名和属性名，不合法的名称无法通过编译，
+  //    例如 sa::Key{"100vip"} 或 sa::Key{"time"}.
+  {
+    constexpr sa::EventName kPayOrder{"PayOrder"};
+    constexpr sa::Key kOrderId{"order_id"};
+    constexpr sa::Key kAmount{"amount"};
+    SA_ASSERT(SA_OK == sa::Event(sa, kPayOrder)
+                           .set(kOrderId, "202410180001")
+                           .set(kAmount, 5888.0)
+                           .set("coupon", true)
+                           .track(cookie_id));
+  }
+#endif
+
+  // 4. 跟踪 SA_EVENT 声明的事件.
+  {
+    sa::Analytics analytics(sa);
+    SA_ASSERT(SA_OK == analytics.track(cookie_id, OrderPaid{5888.0, sku, 1, false}));
+  }
+
+#if defined(__cpp_impl_coroutine)
+  // 5. 在协程中异步跟踪事件和 flush.
+  {
+    std::promise<int> done;
+    track_in_coroutine(sa::Analytics(sa), cookie_id, &done);
+    SA_ASSERT(SA_OK == done.get_future().get());
+  }
+#endif
+
+  // 6. 每个请求使用一个内存池，事件所需的内存在请求结束时一次性释放.
+  {
+    char arena[4096];
+    std::pmr::monotonic_buffer_resource request_arena(arena, sizeof(arena));
+    sa::Analytics analytics(sa, &request_arena);
+    std::string long_text(2048, 'x');
+    SA_ASSERT(SA_OK == analytics.event("ViewArticle")
+                           .set("article_id", 10086)
+                           .set("content", std::string_view(long_text))
+                           .track(cookie_id));
+    SA_ASSERT(SA_OK == analytics.track(cookie_id, OrderPaid{9.9, "XX-001", 2, true}));
+  }
+
+  // 7. 不合法的事件名称与属性名称.
+  SA_ASSERT(SA_INVALID_PARAMETER_ERROR == sa::Event(sa, "100vip").track(cookie_id));
+  SA_ASSERT(SA_INVALID_PARAMETER_ERROR == sa::Event(sa, "Buy").set("time", 1).track(cookie_id));
+
+  // 8. SDK 与编译期的名称检查规则一致. 每个名称检查两次，第二次命中当前线程的名称缓存.
+  {
+    struct NameCase {
+      const char* name;
+      bool valid;
+    };
+    const NameCase kNames[] = {
+      {"ok_name", true}, {"$os", true}, {"User_ID", false}, {"TIME", false}, {"first_id", false},
+      {"datetimes", true}, {"_1", true}, {"a\"b", false}, {"9x", false}, {"a-b", false}, {"", false},
+      {"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuv", true},
+      {"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvw", false},
+    };
+    for (const NameCase& c : kNames) {
+      SA_ASSERT(c.valid == sa::detail::is_valid_name(c.name, strlen(c.name)));
+      SA_ASSERT(c.valid == (SA_OK == sa_check_key_name(c.name, sa)));
+      SA_ASSERT(c.valid == (SA_OK == sa_check_key_name(c.name, sa)));
+    }
+  }
+
+  // 9. 固定顺序输出时，sa::Event 与 sa_track 输出的事件相同.
+  {
+    SAConsumer* capture = static_cast<SAConsumer*>(malloc(sizeof(SAConsumer)));
+    LastEvent* last = static_cast<LastEvent*>(malloc(sizeof(LastEvent)));
+    last->length = 0;
+    capture->this_ = last;
+    capture->op.send = &_last_event_send;
+    capture->op.flush = &_last_event_flush;
+    capture->op.close = &_last_event_close;
+    SensorsAnalytics* canonical = NULL;
+    SA_ASSERT(SA_OK == sa_init(capture, &canonical));
+    SA_ASSERT(SA_OK == sa_set_canonical_order(SA_TRUE, NULL, 0, canonical));
+    SAProperties* supers = sa_init_properties();
+    SA_ASSERT(SA_OK == sa_add_string("$app_version", "1.0.0", strlen("1.0.0"), supers));
+    SA_ASSERT(SA_OK == sa_add_string("$os", "Linux", strlen("Linux"), supers));
+    SA_ASSERT(SA_OK == sa_register_super_properties(supers, canonical));
+    sa_free_properties(supers);
+
+    std::string name = "XX手机-\"旗舰版\",双卡";
+    SAProperties* properties = sa_init_properties();
+    SA_ASSERT(SA_OK == sa_add_string("$os", "iOS", strlen("iOS"), properties));
+    SA_ASSERT(SA_OK == sa_add_string("product_name", name.data(), name.size(), properties));
+    // sa_append_list 将元素加在列表的开头.
+    SA_ASSERT(SA_OK == sa_append_list("product_tag", "双卡,双待", strlen("双卡,双待"), properties));
+    SA_ASSERT(SA_OK == sa_append_list("product_tag", "大屏", strlen("大屏"), properties));
+    SA_ASSERT(SA_OK == sa_add_int("product_price", 5888, properties));
+    SA_ASSERT(SA_OK == sa_add_bool("is_first_time", SA_FALSE, properties));
+    SA_ASSERT(SA_OK == _sa_track(cookie_id, "ViewProduct", properties, "demo_cpp.cpp", "main", 1, canonical));
+    sa_free_properties(properties);
+    std::string expected = _without_time(last);
+
+    SA_ASSERT(SA_OK == sa::Event(canonical, "ViewProduct")
+                           .set("$os", "iOS")
+                           .set("product_name", name)
+                           .set("product_tag", {"大屏", "双卡,双待"})
+                           .set("product_price", 5888)
+                           .set("is_first_time", false)
+                           .track(cookie_id, "demo_cpp.cpp", "main", 1));
+    SA_ASSERT(expected == _without_time(last));
+    sa_free(canonical);
+  }
+
+  sa_flush(sa);
+  sa_free(sa);
+
+  return 0;
+}
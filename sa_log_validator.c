@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2015 SensorsData
+ * All rights reserved.
+ */
+
+// 日志文件校验与统计.
+//
+// 用法: sa_log_validator [-t threads] [-s samples] [-c chunk_mb] file...
+//
+// 将日志文件按 chunk_mb（默认 64）MB 的字节范围分给 -t 个线程（默认 4），每条记录用 sa_parse_event
+// 解析，再用 sa_check_parsed_event 按 sa_track 等接口的规则检查 distinct_id、事件名、属性名与 UTF-8.
+// 输出每种类型和事件的条数、不合法条数与大小，各类错误的条数以及前 -s 条（默认 10）错误的位置与内容.
+//
+// 所有记录都合法时返回 0，存在不合法的记录时返回 2，无法读取文件时返回 1.
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "sensors_analytics.h"
+
+// 事件类型不是 SDK 输出的类型、记录不是合法的 JSON，排在 SAErrorKind 之后.
+#define KIND_INVALID_TYPE SA_ERROR_KIND_COUNT
+#define KIND_INVALID_JSON (SA_ERROR_KIND_COUNT + 1)
+#define KIND_COUNT (SA_ERROR_KIND_COUNT + 2)
+
+static const char* kKindNames[KIND_COUNT] = {
+  "summary",
+  "invalid_parameter",
+  "invalid_utf8",
+  "invalid_distinct_id",
+  "invalid_original_id",
+  "invalid_event_name",
+  "invalid_property_name",
+  "io_error",
+  "system_error",
+  "invalid_type",
+  "invalid_json"
+};
+
+static const char* kTypes[] = {
+  "track", "track_signup", "profile_set", "profile_set_once", "profile_increment",
+  "profile_append", "profile_unset", "profile_delete"
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+// 错误样本中保留的记录字节数.
+#define SAMPLE_BYTES 160
+
+// 一个文件中待校验的字节范围.
+typedef struct {
+  unsigned int file;
+  unsigned long long offset;
+  unsigned long long length;
+} Chunk;
+
+// 一种类型和事件名的统计.
+typedef struct {
+  unsigned long hash;
+  char* type;
+  // 只有 track 和 track_signup 有事件名，其他类型为空字符串.
+  char* event;
+  unsigned long long count;
+  unsigned long long invalid;
+  unsigned long long bytes;
+  unsigned long max_bytes;
+} EventStats;
+
+// 开放寻址的哈希表，容量为 2 的幂.
+typedef struct {
+  EventStats* slots;
+  unsigned long capacity;
+  unsigned long size;
+} EventTable;
+
+typedef struct {
+  char file[256];
+  unsigned long long offset;
+  int kind;
+  char message[256];
+  char record[SAMPLE_BYTES + 1];
+} ErrorSample;
+
+typedef struct {
+  char** files;
+  Chunk* chunks;
+  unsigned long chunk_count;
+  volatile unsigned long next_chunk;
+  unsigned int max_samples;
+  // 错误样本由所有线程共享，加锁写入.
+  pthread_mutex_t sample_mutex;
+  ErrorSample* samples;
+  volatile unsigned int sample_count;
+} Validator;
+
+typedef struct {
+  Validator* validator;
+  EventTable table;
+  unsigned long long records;
+  unsigned long long bytes;
+  unsigned long long errors[KIND_COUNT];
+  int failed;
+} Worker;
+
+// 错误由 sa_check_parsed_event 的返回值报告，不输出 SDK 的错误信息.
+static void _on_error(SAErrorKind kind, const char* message, void* user_data) {
+  (void)kind;
+  (void)message;
+  (void)user_data;
+}
+
+static int _null_consumer_send(void* this_, const char* event, unsigned long length) {
+  (void)this_;
+  (void)event;
+  (void)length;
+  return SA_OK;
+}
+
+static int _null_consumer_flush(void* this_) {
+  (void)this_;
+  return SA_OK;
+}
+
+static int _null_consumer_close(void* this_) {
+  (void)this_;
+  return SA_OK;
+}
+
+static double _now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long _hash(const char* type, const char* event) {
+  // FNV-1a.
+  unsigned long hash = 2166136261u;
+  const char* p;
+  for (p = type; *p; ++p) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+  }
+  hash = (hash ^ 0xff) * 16777619u;
+  for (p = event; *p; ++p) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+  }
+  return hash;
+}
+
+static EventStats* _table_find(EventTable* table, unsigned long hash, const char* type, const char* event) {
+  unsigned long i = hash & (table->capacity - 1);
+  for (;;) {
+    EventStats* slot = &table->slots[i];
+    if (NULL == slot->type) {
+      return slot;
+    }
+    if (slot->hash == hash && 0 == strcmp(slot->type, type) && 0 == strcmp(slot->event, event)) {
+      return slot;
+    }
+    i = (i + 1) & (table->capacity - 1);
+  }
+}
+
+static void _table_init(EventTable* table) {
+  table->capacity = 64;
+  table->size = 0;
+  table->slots = (EventStats*)calloc(table->capacity, sizeof(EventStats));
+}
+
+// 返回 type 和 event 对应的统计，不存在时插入.
+static EventStats* _table_get(EventTable* table, const char* type, const char* event) {
+  unsigned long hash = _hash(type, event);
+  EventStats* slot = _table_find(table, hash, type, event);
+  if (NULL != slot->type) {
+    return slot;
+  }
+  if ((table->size + 1) * 10 > table->capacity * 7) {
+    EventTable grown;
+    grown.capacity = table->capacity * 2;
+    grown.size = table->size;
+    grown.slots = (EventStats*)calloc(grown.capacity, sizeof(EventStats));
+    unsigned long i;
+    for (i = 0; i < table->capacity; ++i) {
+      if (NULL != table->slots[i].type) {
+        *_table_find(&grown, table->slots[i].hash, table->slots[i].type, table->slots[i].event) =
+            table->slots[i];
+      }
+    }
+    free(table->slots);
+    *table = grown;
+    slot = _table_find(table, hash, type, event);
+  }
+  slot->hash = hash;
+  slot->type = strdup(type);
+  slot->event = strdup(event);
+  ++table->size;
+  return slot;
+}
+
+static void _table_free(EventTable* table) {
+  unsigned long i;
+  for (i = 0; i < table->capacity; ++i) {
+    free(table->slots[i].type);
+    free(table->slots[i].event);
+  }
+  free(table->slots);
+}
+
+static void _add_sample(
+    Validator* validator, const char* file, unsigned long long offset, int kind,
+    const char* message, const char* record, unsigned long length) {
+  if (__atomic_load_n(&validator->sample_count, __ATOMIC_RELAXED) >= validator->max_samples) {
+    return;
+  }
+  pthread_mutex_lock(&validator->sample_mutex);
+  if (validator->sample_count < validator->max_samples) {
+    ErrorSample* sample = &validator->samples[validator->sample_count];
+    snprintf(sample->file, sizeof(sample->file), "%s", file);
+    sample->offset = offset;
+    sample->kind = kind;
+    snprintf(sample->message, sizeof(sample->message), "%s", message);
+    if (length > SAMPLE_BYTES) {
+      length = SAMPLE_BYTES;
+    }
+    memcpy(sample->record, record, length);
+    sample->record[length] = '\0';
+    __atomic_store_n(&validator->sample_count, validator->sample_count + 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&validator->sample_mutex);
+}
+
+static int _is_known_type(const char* type) {
+  unsigned int i;
+  for (i = 0; i < COUNT_OF(kTypes); ++i) {
+    if (0 == strcmp(type, kTypes[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// 校验一条记录，返回错误类别并将错误信息写入 error，合法时返回 0. record 先复制到 buffer 中再解析.
+static int _validate(
+    Worker* worker, const char* record, unsigned long length, char* buffer, SACheckError* error,
+    SensorsAnalytics* sa) {
+  memcpy(buffer, record, length);
+  SAParsedEvent event;
+  if (SA_OK != sa_parse_event(buffer, length, &event)) {
+    snprintf(error->message, sizeof(error->message), "Invalid JSON record.");
+    return KIND_INVALID_JSON;
+  }
+
+  int kind = 0;
+  if (!_is_known_type(event.type)) {
+    kind = KIND_INVALID_TYPE;
+    snprintf(error->message, sizeof(error->message), "Unknown event type [%.64s].", event.type);
+  } else if (SA_OK != sa_check_parsed_event(&event, error, sa)) {
+    kind = error->kind;
+  }
+
+  EventStats* stats = _table_get(
+      &worker->table, event.type, NULL != event.event ? event.event : "");
+  ++stats->count;
+  stats->bytes += length;
+  if (length > stats->max_bytes) {
+    stats->max_bytes = length;
+  }
+  if (0 != kind) {
+    ++stats->invalid;
+  }
+  sa_free_parsed_event(&event);
+  return kind;
+}
+
+static void* _validate_worker(void* arg) {
+  Worker* worker = (Worker*)arg;
+  Validator* validator = worker->validator;
+
+  // 每个线程使用自己的 SensorsAnalytics 对象检查属性名，避免共享正则表达式.
+  struct SAConsumer* consumer = (struct SAConsumer*)malloc(sizeof(struct SAConsumer));
+  consumer->this_ = malloc(1);
+  consumer->op.send = &_null_consumer_send;
+  consumer->op.flush = &_null_consumer_flush;
+  consumer->op.close = &_null_consumer_close;
+  SensorsAnalytics* sa = NULL;
+  if (SA_OK != sa_init(consumer, &sa)) {
+    worker->failed = 1;
+    return NULL;
+  }
+
+  unsigned long buffer_size = 64 * 1024;
+  char* buffer = (char*)malloc(buffer_size);
+  for (;;) {
+    unsigned long index = __atomic_fetch_add(&validator->next_chunk, 1, __ATOMIC_RELAXED);
+    if (index >= validator->chunk_count) {
+      break;
+    }
+    const Chunk* chunk = &validator->chunks[index];
+    const char* file = validator->files[chunk->file];
+    SALogReader* reader = NULL;
+    if (SA_OK != sa_log_reader_open(file, chunk->offset, chunk->length, &reader)) {
+      fprintf(stderr, "Failed to read [%s].\n", file);
+      worker->failed = 1;
+      continue;
+    }
+    const char* record = NULL;
+    unsigned long length = 0;
+    while (SA_OK == sa_log_reader_next(reader, &record, &length) && NULL != record) {
+      if (length > buffer_size) {
+        buffer_size = length;
+        buffer = (char*)realloc(buffer, buffer_size);
+      }
+      ++worker->records;
+      worker->bytes += length;
+      SACheckError error;
+      int kind = _validate(worker, record, length, buffer, &error, sa);
+      if (0 != kind) {
+        ++worker->errors[kind];
+        _add_sample(validator, file, sa_log_reader_offset(reader, record), kind, error.message,
+                    record, length);
+      }
+    }
+    sa_log_reader_close(reader);
+  }
+  free(buffer);
+  sa_free(sa);
+  return NULL;
+}
+
+static int _compare_stats(const void* a, const void* b) {
+  const EventStats* x = (const EventStats*)a;
+  const EventStats* y = (const EventStats*)b;
+  if (x->count != y->count) {
+    return x->count < y->count ? 1 : -1;
+  }
+  int c = strcmp(x->type, y->type);
+  return 0 != c ? c : strcmp(x->event, y->event);
+}
+
+int main(int argc, char** argv) {
+  unsigned int threads = 4;
+  unsigned int max_samples = 10;
+  unsigned long long chunk_bytes = 64ULL << 20;
+  int first_file = argc;
+
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "-t") && i + 1 < argc) {
+      threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+      max_samples = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else if (0 == strcmp(argv[i], "-c") && i + 1 < argc) {
+      chunk_bytes = strtoull(argv[++i], NULL, 10) << 20;
+    } else if (argv[i][0] != '-') {
+      first_file = i;
+      break;
+    } else {
+      first_file = argc;
+      break;
+    }
+  }
+  if (first_file >= argc || 0 == threads || 0 == chunk_bytes) {
+    fprintf(stderr, "usage: %s [-t threads] [-s samples] [-c chunk_mb] file...\n", argv[0]);
+    return 1;
+  }
+
+  sa_set_error_callback(&_on_error, NULL);
+
+  Validator validator;
+  memset(&validator, 0, sizeof(validator));
+  validator.files = argv + first_file;
+  validator.max_samples = max_samples;
+  validator.samples = (ErrorSample*)calloc(max_samples + 1, sizeof(ErrorSample));
+  pthread_mutex_init(&validator.sample_mutex, NULL);
+
+  // 按文件大小切分为字节范围，由各线程依次领取.
+  unsigned long capacity = 0;
+  unsigned long long total_size = 0;
+  unsigned int file;
+  for (file = 0; file < (unsigned int)(argc - first_file); ++file) {
+    struct stat st;
+    if (0 != stat(validator.files[file], &st)) {
+      fprintf(stderr, "Failed to open [%s].\n", validator.files[file]);
+      return 1;
+    }
+    total_size += (unsigned long long)st.st_size;
+    unsigned long long offset = 0;
+    do {
+      if (validator.chunk_count == capacity) {
+        capacity = 0 == capacity ? 64 : capacity * 2;
+        validator.chunks = (Chunk*)realloc(validator.chunks, capacity * sizeof(Chunk));
+      }
+      Chunk* chunk = &validator.chunks[validator.chunk_count++];
+      chunk->file = file;
+      chunk->offset = offset;
+      chunk->length = chunk_bytes;
+      offset += chunk_bytes;
+    } while (offset < (unsigned long long)st.st_size);
+  }
+
+  Worker* workers = (Worker*)calloc(threads, sizeof(Worker));
+  pthread_t* handles = (pthread_t*)calloc(threads, sizeof(pthread_t));
+  double start = _now_seconds();
+  unsigned int t;
+  for (t = 0; t < threads; ++t) {
+    workers[t].validator = &validator;
+    _table_init(&workers[t].table);
+    pthread_create(&handles[t], NULL, &_validate_worker, &workers[t]);
+  }
+  for (t = 0; t < threads; ++t) {
+    pthread_join(handles[t], NULL);
+  }
+  double elapsed = _now_seconds() - start;
+
+  // 合并各线程的统计.
+  EventTable table;
+  _table_init(&table);
+  unsigned long long records = 0;
+  unsigned long long bytes = 0;
+  unsigned long long errors[KIND_COUNT];
+  unsigned long long invalid = 0;
+  int failed = 0;
+  memset(errors, 0, sizeof(errors));
+  for (t = 0; t < threads; ++t) {
+    records += workers[t].records;
+    bytes += workers[t].bytes;
+    failed |= workers[t].failed;
+    int kind;
+    for (kind = 0; kind < KIND_COUNT; ++kind) {
+      errors[kind] += workers[t].errors[kind];
+      invalid += workers[t].errors[kind];
+    }
+    unsigned long k;
+    for (k = 0; k < workers[t].table.capacity; ++k) {
+      const EventStats* from = &workers[t].table.slots[k];
+      if (NULL == from->type) {
+        continue;
+      }
+      EventStats* to = _table_get(&table, from->type, from->event);
+      to->count += from->count;
+      to->invalid += from->invalid;
+      to->bytes += from->bytes;
+      if (from->max_bytes > to->max_bytes) {
+        to->max_bytes = from->max_bytes;
+      }
+    }
+    _table_free(&workers[t].table);
+  }
+
+  printf("files=%d records=%llu bytes=%llu invalid=%llu seconds=%.3f MB/s=%.1f records/s=%.0f\n",
+         argc - first_file, records, bytes, invalid, elapsed, total_size / elapsed / 1e6, records / elapsed);
+
+  int kind;
+  for (kind = 1; kind < KIND_COUNT; ++kind) {
+    if (errors[kind] > 0) {
+      printf("%-24s %12llu\n", kKindNames[kind], errors[kind]);
+    }
+  }
+
+  // 按条数从多到少输出.
+  EventStats* sorted = (EventStats*)malloc((table.size + 1) * sizeof(EventStats));
+  unsigned long count = 0;
+  unsigned long k;
+  for (k = 0; k < table.capacity; ++k) {
+    if (NULL != table.slots[k].type) {
+      sorted[count++] = table.slots[k];
+    }
+  }
+  qsort(sorted, count, sizeof(EventStats), &_compare_stats);
+  printf("\n%-18s %-32s %12s %10s %14s %10s %10s\n",
+         "type", "event", "count", "invalid", "bytes", "avg", "max");
+  for (k = 0; k < count; ++k) {
+    printf("%-18s %-32s %12llu %10llu %14llu %10.1f %10lu\n",
+           sorted[k].type, sorted[k].event, sorted[k].count, sorted[k].invalid, sorted[k].bytes,
+           (double)sorted[k].bytes / sorted[k].count, sorted[k].max_bytes);
+  }
+  free(sorted);
+  _table_free(&table);
+
+  if (validator.sample_count > 0) {
+    printf("\n");
+  }
+  for (k = 0; k < validator.sample_count; ++k) {
+    const ErrorSample* sample = &validator.samples[k];
+    printf("%s:%llu %s %s\n  %s\n", sample->file, sample->offset, kKindNames[sample->kind],
+           sample->message, sample->record);
+  }
+
+  pthread_mutex_destroy(&validator.sample_mutex);
+  free(validator.samples);
+  free(validator.chunks);
+  free(handles);
+  free(workers);
+  if (failed) {
+    return 1;
+  }
+  return invalid > 0 ? 2 : 0;
+}
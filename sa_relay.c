@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2015 SensorsData
+ * All rights reserved.
+ */
+
+// 本机事件中继.
+//
+// 用法: sa_relay -s socket_path -o log_prefix [-v none|frame|full]
+//
+// 在 socket_path 上监听 Unix 域数据报 socket，接收多个进程通过 RelayConsumer 发送的事件，
+// 校验后以 LoggingConsumer 写入 <log_prefix>.log.<日期>，按日期切分文件. 每个数据报包含一条或多条
+// 以换行符结尾的事件，校验通过的事件合并为一次写入.
+//
+//   -v none   不校验.
+//   -v frame  只检查每条事件以 '{' 开始、以 '}' 结束（默认）.
+//   -v full   使用 sa_parse_event 完整解析每条事件.
+//
+// 收到 SIGINT 或 SIGTERM 时读完 socket 中剩余的事件后退出，收到 SIGUSR1 时输出统计数据.
+// 空闲 100 毫秒后 flush 日志文件.
+
+// recvmmsg.
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sensors_analytics.h"
+
+// 每次最多接收的数据报个数.
+#define RELAY_BATCH 32
+// 有未 flush 的数据时的 poll 超时.
+#define RELAY_FLUSH_MS 100
+
+typedef enum {
+  RELAY_VALIDATE_NONE,
+  RELAY_VALIDATE_FRAME,
+  RELAY_VALIDATE_FULL
+} RelayValidate;
+
+typedef struct {
+  unsigned long long datagrams;
+  unsigned long long events;
+  unsigned long long bytes;
+  // 校验失败而丢弃的事件数.
+  unsigned long long invalid;
+  // 超过 SA_RELAY_MAX_DATAGRAM 被截断而丢弃的数据报个数.
+  unsigned long long truncated;
+  unsigned long long write_errors;
+} RelayStats;
+
+static volatile sig_atomic_t g_stop = 0;
+static volatile sig_atomic_t g_report = 0;
+
+static void _relay_on_signal(int signum) {
+  if (SIGUSR1 == signum) {
+    g_report = 1;
+  } else {
+    g_stop = 1;
+  }
+}
+
+static void _relay_report(const RelayStats* stats) {
+  fprintf(stderr, "datagrams=%llu events=%llu bytes=%llu invalid=%llu truncated=%llu write_errors=%llu\n",
+          stats->datagrams, stats->events, stats->bytes, stats->invalid, stats->truncated,
+          stats->write_errors);
+}
+
+// 校验一条不含换行符的事件. full 模式下解析会修改 scratch 中的副本，不修改 line.
+static int _relay_validate(
+    const char* line, unsigned long length, RelayValidate validate, char* scratch) {
+  if (RELAY_VALIDATE_NONE == validate) {
+    return 1;
+  }
+  if (length < 2 || '{' != line[0] || '}' != line[length - 1]) {
+    return 0;
+  }
+  if (RELAY_VALIDATE_FULL == validate) {
+    memcpy(scratch, line, length);
+    SAParsedEvent event;
+    if (SA_OK != sa_parse_event(scratch, length, &event)) {
+      return 0;
+    }
+    sa_free_parsed_event(&event);
+  }
+  return 1;
+}
+
+// 校验一个数据报中的事件，原地去掉不合法的事件后一次写入日志文件.
+static void _relay_process(
+    char* data, unsigned long length, RelayValidate validate, char* scratch,
+    struct SAConsumer* consumer, RelayStats* stats) {
+  ++stats->datagrams;
+  char* out = data;
+  char* p = data;
+  char* end = data + length;
+  while (p < end) {
+    char* newline = (char*)memchr(p, '\n', (size_t)(end - p));
+    if (NULL == newline) {
+      // RelayConsumer 发送的每条事件都以换行符结尾，没有换行符的部分不完整.
+      ++stats->invalid;
+      break;
+    }
+    unsigned long line_length = (unsigned long)(newline - p);
+    if (_relay_validate(p, line_length, validate, scratch)) {
+      if (out != p) {
+        memmove(out, p, line_length + 1);
+      }
+      out += line_length + 1;
+      ++stats->events;
+    } else {
+      ++stats->invalid;
+    }
+    p = newline + 1;
+  }
+  if (out == data) {
+    return;
+  }
+  stats->bytes += (unsigned long long)(out - data);
+  // LoggingConsumer 在结尾写入换行符.
+  if (SA_OK != consumer->op.send(consumer->this_, data, (unsigned long)(out - data - 1))) {
+    ++stats->write_errors;
+  }
+}
+
+// 接收并处理 socket 中已有的数据报，返回处理的个数，没有数据时返回 0.
+static int _relay_receive(
+    int fd, char* buffers, RelayValidate validate, char* scratch,
+    struct SAConsumer* consumer, RelayStats* stats) {
+  int count = 0;
+#if defined(__linux__)
+  struct mmsghdr messages[RELAY_BATCH];
+  struct iovec iovs[RELAY_BATCH];
+  int i;
+  for (i = 0; i < RELAY_BATCH; ++i) {
+    iovs[i].iov_base = buffers + (unsigned long)i * SA_RELAY_MAX_DATAGRAM;
+    iovs[i].iov_len = SA_RELAY_MAX_DATAGRAM;
+    memset(&messages[i], 0, sizeof(messages[i]));
+    messages[i].msg_hdr.msg_iov = &iovs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  count = recvmmsg(fd, messages, RELAY_BATCH, MSG_DONTWAIT, NULL);
+  for (i = 0; i < count; ++i) {
+    if (0 != (messages[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+      ++stats->truncated;
+      continue;
+    }
+    _relay_process((char*)iovs[i].iov_base, messages[i].msg_len, validate, scratch, consumer, stats);
+  }
+#else
+  while (count < RELAY_BATCH) {
+    struct iovec iov;
+    struct msghdr message;
+    iov.iov_base = buffers;
+    iov.iov_len = SA_RELAY_MAX_DATAGRAM;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    ssize_t length = recvmsg(fd, &message, MSG_DONTWAIT);
+    if (length < 0) {
+      break;
+    }
+    ++count;
+    if (0 != (message.msg_flags & MSG_TRUNC)) {
+      ++stats->truncated;
+      continue;
+    }
+    _relay_process(buffers, (unsigned long)length, validate, scratch, consumer, stats);
+  }
+#endif
+  return count > 0 ? count : 0;
+}
+
+static int _relay_listen(const char* path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "The socket path [%s] is too long.\n", path);
+    return -1;
+  }
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path, strlen(path));
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create socket: %s.\n", strerror(errno));
+    return -1;
+  }
+  // 上次退出时残留的 socket 文件.
+  unlink(path);
+  if (0 != bind(fd, (struct sockaddr*)&address, sizeof(address))) {
+    fprintf(stderr, "Failed to bind [%s]: %s.\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  // 尽量加大接收缓冲区，写日志文件偶尔变慢时发送方不必立即阻塞.
+  int rcvbuf = 8 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  return fd;
+}
+
+int main(int argc, char** argv) {
+  const char* socket_path = NULL;
+  const char* log_prefix = NULL;
+  RelayValidate validate = RELAY_VALIDATE_FRAME;
+
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (0 == strcmp(argv[i], "-o") && i + 1 < argc) {
+      log_prefix = argv[++i];
+    } else if (0 == strcmp(argv[i], "-v") && i + 1 < argc) {
+      ++i;
+      if (0 == strcmp(argv[i], "none")) {
+        validate = RELAY_VALIDATE_NONE;
+      } else if (0 == strcmp(argv[i], "frame")) {
+        validate = RELAY_VALIDATE_FRAME;
+      } else if (0 == strcmp(argv[i], "full")) {
+        validate = RELAY_VALIDATE_FULL;
+      } else {
+        socket_path = NULL;
+        break;
+      }
+    } else {
+      socket_path = NULL;
+      break;
+    }
+  }
+  if (NULL == socket_path || NULL == log_prefix) {
+    fprintf(stderr, "usage: %s -s socket_path -o log_prefix [-v none|frame|full]\n", argv[0]);
+    return 1;
+  }
+
+  SALoggingConsumer* consumer = NULL;
+  if (SA_OK != sa_init_logging_consumer(log_prefix, &consumer)) {
+    fprintf(stderr, "Failed to initialize the consumer.\n");
+    return 1;
+  }
+  int fd = _relay_listen(socket_path);
+  if (fd < 0) {
+    return 1;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &_relay_on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGUSR1, &action, NULL);
+
+  char* buffers = (char*)malloc((unsigned long)RELAY_BATCH * SA_RELAY_MAX_DATAGRAM);
+  char* scratch = (char*)malloc(SA_RELAY_MAX_DATAGRAM);
+  if (NULL == buffers || NULL == scratch) {
+    fprintf(stderr, "Failed to allocate buffers.\n");
+    return 1;
+  }
+
+  RelayStats stats;
+  memset(&stats, 0, sizeof(stats));
+  int dirty = 0;
+  while (!g_stop) {
+    if (g_report) {
+      g_report = 0;
+      _relay_report(&stats);
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ready = poll(&pfd, 1, dirty ? RELAY_FLUSH_MS : -1);
+    if (ready < 0 && EINTR != errno) {
+      fprintf(stderr, "Failed to poll: %s.\n", strerror(errno));
+      break;
+    }
+    if (ready > 0) {
+      // 连续读取直到 socket 为空，期间不 flush.
+      while (!g_stop && !g_report && _relay_receive(fd, buffers, validate, scratch, consumer, &stats) > 0) {
+        dirty = 1;
+      }
+    } else if (0 == ready && dirty) {
+      consumer->op.flush(consumer->this_);
+      dirty = 0;
+    }
+  }
+
+  // 退出前读完发送方已经写入 socket 的事件.
+  while (_relay_receive(fd, buffers, validate, scratch, consumer, &stats) > 0) {
+  }
+  close(fd);
+  unlink(socket_path);
+
+  consumer->op.close(consumer->this_);
+  free(consumer->this_);
+  free(consumer);
+  free(scratch);
+  free(buffers);
+  _relay_report(&stats);
+  return 0;
+}
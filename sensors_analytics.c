@@ -3,64 +3,398 @@
  * All rights reserved.
  */
 
+#include <limits.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
 
 #if defined(USE_POSIX)
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
-#include <regex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
 #elif defined(_WIN32)
 #include <windows.h>
 #include <sys/timeb.h>
 #include <share.h>
-#include "pcre/pcre.h"
 #elif defined(__linux__)
 #include <sys/time.h>
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
 #include "sensors_analytics.h"
 
 #define SA_LIB_VERSION "0.2.1"
 #define SA_LIB "C"
 #define SA_LIB_METHOD "code"
 
-#define KEY_WORD_PATTERN "(^distinct_id$|^original_id$|^time$|^properties$|^id$|^first_id$|^second_id$|^users$|^events$|^event$|^user_id$|^date$|^datetime$)"
-#define NAME_PATTERN "^[a-zA-Z_$][a-zA-Z0-9_$]{0,99}$"
-
 #if defined(__linux__)
 #define LOCALTIME(seconds, now) localtime_r((seconds), (now))
 #define FOPEN(file, filename, option) do { \
   *(file) = fopen((filename), (option)); \
 } while (0)
+#define FLOCKFILE(file) flockfile(file)
+#define FUNLOCKFILE(file) funlockfile(file)
 
 #elif defined(__APPLE__)
 #define LOCALTIME(seconds, now) localtime_r((seconds), (now))
 #define FOPEN(file, filename, option) do { \
   *(file) = fopen((filename), (option)); \
 } while (0)
+#define FLOCKFILE(file) flockfile(file)
+#define FUNLOCKFILE(file) funlockfile(file)
 
 #elif defined(_WIN32)
 #define LOCALTIME(seconds, now) localtime_s((now), (seconds))
 #define FOPEN(file, filename, option) do { \
   *(file) = _fsopen((filename), (option), _SH_DENYNO); \
 } while (0)
+#define FLOCKFILE(file) _lock_file(file)
+#define FUNLOCKFILE(file) _unlock_file(file)
+
+#endif
+
+// 线程、互斥锁与条件变量.
+#if defined(USE_POSIX)
+#define SA_HAS_THREADS 1
+#define SA_THREAD_LOCAL __thread
+typedef pthread_t SAThread;
+typedef pthread_mutex_t SAMutex;
+typedef pthread_cond_t SACond;
+#define SA_THREAD_PROC(name, arg) void* name(void* arg)
+#define SA_THREAD_RETURN return NULL
+#define SA_THREAD_CREATE(thread, proc, arg) (0 == pthread_create((thread), NULL, (proc), (arg)))
+#define SA_THREAD_JOIN(thread) pthread_join((thread), NULL)
+#define SA_MUTEX_INIT(mutex) pthread_mutex_init((mutex), NULL)
+#define SA_MUTEX_DESTROY(mutex) pthread_mutex_destroy(mutex)
+#define SA_MUTEX_LOCK(mutex) pthread_mutex_lock(mutex)
+#define SA_MUTEX_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define SA_COND_INIT(cond) pthread_cond_init((cond), NULL)
+#define SA_COND_DESTROY(cond) pthread_cond_destroy(cond)
+#define SA_COND_WAIT(cond, mutex) pthread_cond_wait((cond), (mutex))
+#define SA_COND_SIGNAL(cond) pthread_cond_signal(cond)
+#define SA_COND_BROADCAST(cond) pthread_cond_broadcast(cond)
+#define SA_ATOMIC_INCREMENT(value) __sync_add_and_fetch((value), 1)
+#define SA_ATOMIC_DECREMENT(value) __sync_sub_and_fetch((value), 1)
+#define SA_ATOMIC_LOAD(value) __atomic_load_n((value), __ATOMIC_ACQUIRE)
+#define SA_ATOMIC_STORE(value, v) __atomic_store_n((value), (v), __ATOMIC_RELEASE)
+#define SA_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define SA_ATOMIC_ADD64(value, v) __sync_add_and_fetch((value), (v))
+#define SA_ATOMIC_LOAD64(value) __atomic_load_n((value), __ATOMIC_RELAXED)
+#define SA_ATOMIC_STORE64(value, v) __atomic_store_n((value), (v), __ATOMIC_RELAXED)
+#define SA_ATOMIC_EXCHANGE64(value, v) __atomic_exchange_n((value), (v), __ATOMIC_ACQ_REL)
+#define SA_ATOMIC_CAS64(value, expected, desired) \
+  __sync_bool_compare_and_swap((value), (expected), (desired))
+
+#elif defined(_WIN32)
+#define SA_HAS_THREADS 1
+#define SA_THREAD_LOCAL __declspec(thread)
+typedef HANDLE SAThread;
+typedef CRITICAL_SECTION SAMutex;
+typedef CONDITION_VARIABLE SACond;
+#define SA_THREAD_PROC(name, arg) DWORD WINAPI name(LPVOID arg)
+#define SA_THREAD_RETURN return 0
+#define SA_THREAD_CREATE(thread, proc, arg) \
+  (NULL != (*(thread) = CreateThread(NULL, 0, (proc), (arg), 0, NULL)))
+#define SA_THREAD_JOIN(thread) do { \
+  WaitForSingleObject((thread), INFINITE); \
+  CloseHandle(thread); \
+} while (0)
+#define SA_MUTEX_INIT(mutex) InitializeCriticalSection(mutex)
+#define SA_MUTEX_DESTROY(mutex) DeleteCriticalSection(mutex)
+#define SA_MUTEX_LOCK(mutex) EnterCriticalSection(mutex)
+#define SA_MUTEX_UNLOCK(mutex) LeaveCriticalSection(mutex)
+#define SA_COND_INIT(cond) InitializeConditionVariable(cond)
+#define SA_COND_DESTROY(cond) do { } while (0)
+#define SA_COND_WAIT(cond, mutex) SleepConditionVariableCS((cond), (mutex), INFINITE)
+#define SA_COND_SIGNAL(cond) WakeConditionVariable(cond)
+#define SA_COND_BROADCAST(cond) WakeAllConditionVariable(cond)
+#define SA_ATOMIC_INCREMENT(value) InterlockedIncrement(value)
+#define SA_ATOMIC_DECREMENT(value) InterlockedDecrement(value)
+#define SA_ATOMIC_LOAD(value) InterlockedCompareExchange((value), 0, 0)
+#define SA_ATOMIC_STORE(value, v) InterlockedExchange((value), (v))
+#define SA_ATOMIC_FENCE() MemoryBarrier()
+#define SA_ATOMIC_ADD64(value, v) InterlockedExchangeAdd64((value), (v))
+#define SA_ATOMIC_LOAD64(value) InterlockedCompareExchange64((volatile LONG64*)(value), 0, 0)
+#define SA_ATOMIC_STORE64(value, v) InterlockedExchange64((value), (v))
+#define SA_ATOMIC_EXCHANGE64(value, v) InterlockedExchange64((value), (v))
+#define SA_ATOMIC_CAS64(value, expected, desired) \
+  ((expected) == InterlockedCompareExchange64((value), (desired), (expected)))
+
+#else
+#define SA_THREAD_LOCAL
+#define SA_ATOMIC_INCREMENT(value) (++*(value))
+#define SA_ATOMIC_DECREMENT(value) (--*(value))
+#define SA_ATOMIC_LOAD(value) (*(value))
+#define SA_ATOMIC_STORE(value, v) (*(value) = (v))
+#define SA_ATOMIC_FENCE() do { } while (0)
+#define SA_ATOMIC_ADD64(value, v) (*(value) += (v))
+#define SA_ATOMIC_LOAD64(value) (*(value))
+#define SA_ATOMIC_STORE64(value, v) (*(value) = (v))
+#define SA_ATOMIC_EXCHANGE64(value, v) _sa_exchange64((value), (v))
+#define SA_ATOMIC_CAS64(value, expected, desired) \
+  (*(value) == (expected) ? (*(value) = (desired), 1) : 0)
+static long long _sa_exchange64(volatile long long* value, long long v) {
+  long long old = *value;
+  *value = v;
+  return old;
+}
+#endif
+
+// 静态探针（USDT），使用 -DSA_ENABLE_SDT 编译时启用，可通过 bpftrace、perf 等工具挂载:
+//
+//   bpftrace -e 'usdt:./demo:sensors_analytics:track__entry { @start[tid] = nsecs; }
+//                usdt:./demo:sensors_analytics:track__return /@start[tid]/ {
+//                  @ns = hist(nsecs - @start[tid]); delete(@start[tid]); }'
+//
+// 未挂载时探针只是一条 nop 指令; 未启用时不产生任何代码.
+#if defined(SA_ENABLE_SDT)
+#include <sys/sdt.h>
+#define SA_PROBE0(name) DTRACE_PROBE(sensors_analytics, name)
+#define SA_PROBE1(name, a) DTRACE_PROBE1(sensors_analytics, name, a)
+#define SA_PROBE2(name, a, b) DTRACE_PROBE2(sensors_analytics, name, a, b)
+#define SA_PROBE3(name, a, b, c) DTRACE_PROBE3(sensors_analytics, name, a, b, c)
+#else
+#define SA_PROBE0(name) do { } while (0)
+#define SA_PROBE1(name, a) do { } while (0)
+#define SA_PROBE2(name, a, b) do { } while (0)
+#define SA_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+// 错误报告 ---------------------------------------------------------------------
 
+// 单调时钟的纳秒数.
+static unsigned long long _sa_monotonic_ns() {
+#if defined(_WIN32)
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (unsigned long long)((double)counter.QuadPart * 1e9 / frequency.QuadPart);
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
 #endif
+}
+
+// 各类错误的名称，与 SAErrorKind 一一对应，用于汇总信息和统计数据.
+static const char* _sa_error_kind_names[SA_ERROR_KIND_COUNT] = {
+  "summary",
+  "invalid_parameter",
+  "invalid_utf8",
+  "invalid_distinct_id",
+  "invalid_original_id",
+  "invalid_event_name",
+  "invalid_property_name",
+  "io_error",
+  "system_error"
+};
+
+typedef struct {
+  // 令牌桶（以 GCRA 的形式实现）: 下一个令牌的理论到达时间，单位为纳秒.
+  volatile long long tat_ns;
+  // 累计次数、累计被抑制的次数，以及上次汇总之后被抑制的次数.
+  volatile long long total;
+  volatile long long suppressed;
+  volatile long long suppressed_since_summary;
+} SAErrorCounter;
+
+static void _sa_default_error_callback(SAErrorKind kind, const char* message, void* user_data) {
+  (void)kind;
+  (void)user_data;
+  fprintf(stderr, "%s\n", message);
+}
+
+static sa_error_callback _sa_error_callback = &_sa_default_error_callback;
+static void* _sa_error_user_data = NULL;
+static SAErrorCounter _sa_error_counters[SA_ERROR_KIND_COUNT];
+// 每类错误每秒输出的条数、允许的突发条数，以及汇总信息的间隔.
+static volatile long long _sa_error_interval_ns = 100000000LL;
+static volatile long long _sa_error_burst_ns = 2000000000LL;
+static volatile long long _sa_error_summary_ns = 60000000000LL;
+static volatile long long _sa_error_next_summary_ns = 0;
+
+void sa_set_error_callback(sa_error_callback callback, void* user_data) {
+  _sa_error_user_data = user_data;
+  _sa_error_callback = (NULL == callback ? &_sa_default_error_callback : callback);
+}
+
+int sa_set_error_rate_limit(
+    unsigned int messages_per_second, unsigned int burst, unsigned int summary_interval_seconds) {
+  if (0 == messages_per_second || 0 == burst || 0 == summary_interval_seconds) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  long long interval_ns = 1000000000LL / messages_per_second;
+  SA_ATOMIC_STORE64(&_sa_error_interval_ns, interval_ns);
+  SA_ATOMIC_STORE64(&_sa_error_burst_ns, interval_ns * burst);
+  SA_ATOMIC_STORE64(&_sa_error_summary_ns, summary_interval_seconds * 1000000000LL);
+  return SA_OK;
+}
+
+// 是否允许输出一条 kind 类的信息，不加锁.
+static SABool _sa_error_acquire(SAErrorCounter* counter, long long now) {
+  long long interval = SA_ATOMIC_LOAD64(&_sa_error_interval_ns);
+  long long burst = SA_ATOMIC_LOAD64(&_sa_error_burst_ns);
+  for (;;) {
+    long long tat = SA_ATOMIC_LOAD64(&counter->tat_ns);
+    long long start = tat > now ? tat : now;
+    if (start + interval - now > burst) {
+      return SA_FALSE;
+    }
+    if (SA_ATOMIC_CAS64(&counter->tat_ns, tat, start + interval)) {
+      return SA_TRUE;
+    }
+  }
+}
+
+// 每个汇总间隔内最多输出一条汇总信息，列出各类被抑制的信息条数.
+static void _sa_error_summary(long long now) {
+  long long next = SA_ATOMIC_LOAD64(&_sa_error_next_summary_ns);
+  if (now < next) {
+    return;
+  }
+  if (!SA_ATOMIC_CAS64(&_sa_error_next_summary_ns, next, now + SA_ATOMIC_LOAD64(&_sa_error_summary_ns))) {
+    return;
+  }
+
+  char message[512];
+  int length = snprintf(message, sizeof(message), "Sensors Analytics suppressed messages:");
+  long long total = 0;
+  int kind;
+  for (kind = 1; kind < SA_ERROR_KIND_COUNT; ++kind) {
+    long long count = SA_ATOMIC_EXCHANGE64(&_sa_error_counters[kind].suppressed_since_summary, 0);
+    if (count > 0 && length > 0 && length < (int)sizeof(message)) {
+      length += snprintf(message + length, sizeof(message) - length,
+                         " %s=%lld", _sa_error_kind_names[kind], count);
+    }
+    total += count;
+  }
+  if (total > 0) {
+    _sa_error_callback(SA_ERROR_SUMMARY, message, _sa_error_user_data);
+  }
+}
+
+// 不为 NULL 时，当前线程报告的第一条错误信息在限速之前写入其中，之后置为 NULL.
+static SA_THREAD_LOCAL SACheckError* _sa_error_capture = NULL;
+
+// 报告一条错误信息. 计数后按类别限速，被抑制且无需记录的信息不做格式化.
+static void _sa_log_error(SAErrorKind kind, const char* format, ...) {
+  SAErrorCounter* counter = _sa_error_counters + kind;
+  long long now = (long long)_sa_monotonic_ns();
+  SACheckError* capture = _sa_error_capture;
+
+  SA_ATOMIC_ADD64(&counter->total, 1);
+  _sa_error_summary(now);
+  SABool deliver = _sa_error_acquire(counter, now);
+  if (!deliver) {
+    SA_ATOMIC_ADD64(&counter->suppressed, 1);
+    SA_ATOMIC_ADD64(&counter->suppressed_since_summary, 1);
+    if (NULL == capture) {
+      return;
+    }
+  }
+
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (NULL != capture) {
+    capture->kind = kind;
+    snprintf(capture->message, sizeof(capture->message), "%.255s", message);
+    _sa_error_capture = NULL;
+  }
+  if (deliver) {
+    _sa_error_callback(kind, message, _sa_error_user_data);
+  }
+}
 
 static void* _sa_safe_malloc(unsigned long n, unsigned long line) {
   void* p = malloc(n);
   if (!p) {
-    fprintf(stderr, "[%s:%lu]Out of memory(%lu bytes)\n", __FILE__, line, (unsigned long)n);
+    _sa_log_error(SA_ERROR_SYSTEM, "[%s:%lu]Out of memory(%lu bytes)", __FILE__, line, (unsigned long)n);
     exit(SA_MALLOC_ERROR);
   }
   return p;
 }
 #define SA_SAFE_MALLOC(n) _sa_safe_malloc((n), __LINE__)
 
+// 内存分配器 ------------------------------------------------------------------
+
+static void* _sa_default_allocate(unsigned long size, void* ctx) {
+  (void)ctx;
+  return malloc(size);
+}
+
+static void* _sa_default_reallocate(void* ptr, unsigned long old_size, unsigned long new_size, void* ctx) {
+  (void)old_size;
+  (void)ctx;
+  return realloc(ptr, new_size);
+}
+
+static void _sa_default_deallocate(void* ptr, unsigned long size, void* ctx) {
+  (void)size;
+  (void)ctx;
+  free(ptr);
+}
+
+// SDK 内部对象使用的分配器. Consumer 对象由 sa_free 以 free 释放，因此仍使用 SA_SAFE_MALLOC.
+static SAAllocator _sa_allocator = {
+  &_sa_default_allocate,
+  &_sa_default_reallocate,
+  &_sa_default_deallocate,
+  NULL
+};
+
+// 当前线程序列化事件时临时内存使用的分配器，NULL 表示使用 _sa_allocator.
+static SA_THREAD_LOCAL const SAAllocator* _sa_thread_allocator = NULL;
+
+int sa_set_allocator(const SAAllocator* allocator) {
+  if (NULL == allocator) {
+    _sa_allocator.allocate = &_sa_default_allocate;
+    _sa_allocator.reallocate = &_sa_default_reallocate;
+    _sa_allocator.deallocate = &_sa_default_deallocate;
+    _sa_allocator.ctx = NULL;
+    return SA_OK;
+  }
+  if (NULL == allocator->allocate || NULL == allocator->reallocate || NULL == allocator->deallocate) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  _sa_allocator = *allocator;
+  return SA_OK;
+}
+
+const SAAllocator* sa_set_thread_allocator(const SAAllocator* allocator) {
+  const SAAllocator* previous = _sa_thread_allocator;
+  _sa_thread_allocator = allocator;
+  return previous;
+}
+
+static void* _sa_alloc(const SAAllocator* allocator, unsigned long n, unsigned long line) {
+  void* p = allocator->allocate(n, allocator->ctx);
+  if (!p) {
+    _sa_log_error(SA_ERROR_SYSTEM, "[%s:%lu]Out of memory(%lu bytes)", __FILE__, line, (unsigned long)n);
+    exit(SA_MALLOC_ERROR);
+  }
+  return p;
+}
+#define SA_ALLOC(n) _sa_alloc(&_sa_allocator, (n), __LINE__)
+#define SA_RELEASE(p, n) _sa_allocator.deallocate((p), (n), _sa_allocator.ctx)
+
 static char* _sa_strdup(const char *str) {
   int len = strlen(str);
-  char *ret = (char*)SA_SAFE_MALLOC(len + 1);
+  char *ret = (char*)SA_ALLOC(len + 1);
   memcpy(ret, str, len);
   ret[len] = '\0';
   return ret;
@@ -72,15 +406,38 @@ typedef struct {
   char *cur;
   char *end;
   char *start;
+  // 分配 start 使用的分配器.
+  const SAAllocator* allocator;
+  // 分段写入的 Consumer，为 NULL 时缓冲区按需扩容; 否则写满后将已有内容交给 append 并清空.
+  const struct SAConsumerStreamOp* stream;
+  void* stream_this;
+  // 已交给 Consumer 的字节数，是否已调用 begin，以及第一次出错的结果.
+  unsigned long streamed;
+  SABool stream_begun;
+  int stream_res;
 } SAStringBuffer;
 
-static int _sa_sb_init(SAStringBuffer *sb) {
-  sb->start = (char*)SA_SAFE_MALLOC(17);
+// 初始容量为 capacity 字节，为 0 时使用默认的 16 字节.
+static int _sa_sb_init_size(SAStringBuffer *sb, unsigned long capacity) {
+  if (0 == capacity) {
+    capacity = 16;
+  }
+  sb->allocator = (NULL != _sa_thread_allocator ? _sa_thread_allocator : &_sa_allocator);
+  sb->start = (char*)_sa_alloc(sb->allocator, capacity + 1, __LINE__);
   sb->cur = sb->start;
-  sb->end = sb->start + 16;
+  sb->end = sb->start + capacity;
+  sb->stream = NULL;
+  sb->stream_this = NULL;
+  sb->streamed = 0;
+  sb->stream_begun = SA_FALSE;
+  sb->stream_res = SA_OK;
   return SA_OK;
 }
 
+static int _sa_sb_init(SAStringBuffer *sb) {
+  return _sa_sb_init_size(sb, 16);
+}
+
 /* sb and need may be evaluated multiple times. */
 #define _sa_sb_need(sb, need) do { \
   int res = SA_OK; \
@@ -89,7 +446,29 @@ static int _sa_sb_init(SAStringBuffer *sb) {
   return res; \
 } while (0)
 
+// 将缓冲区中的内容交给分段写入的 Consumer 并清空缓冲区，第一次写入前调用 begin.
+// 出错后不再写入，只记录第一次的错误.
+static void _sa_sb_drain(SAStringBuffer *sb) {
+  unsigned long length = sb->cur - sb->start;
+  if (0 == sb->streamed && !sb->stream_begun && SA_OK == sb->stream_res) {
+    sb->stream_res = sb->stream->begin(sb->stream_this);
+    sb->stream_begun = (SA_OK == sb->stream_res) ? SA_TRUE : SA_FALSE;
+  }
+  if (length > 0 && SA_OK == sb->stream_res) {
+    sb->stream_res = sb->stream->append(sb->stream_this, sb->start, length);
+  }
+  sb->streamed += length;
+  sb->cur = sb->start;
+}
+
 static int _sa_sb_grow(SAStringBuffer *sb, unsigned long need) {
+  if (NULL != sb->stream && sb->cur > sb->start) {
+    _sa_sb_drain(sb);
+    if (sb->cur + need <= sb->end) {
+      return SA_OK;
+    }
+  }
+
   size_t length = sb->cur - sb->start;
   size_t alloc = sb->end - sb->start;
 
@@ -97,9 +476,10 @@ static int _sa_sb_grow(SAStringBuffer *sb, unsigned long need) {
     alloc *= 2;
   } while (alloc < length + need);
 
-  sb->start = (char*) realloc(sb->start, alloc + 1);
+  sb->start = (char*)sb->allocator->reallocate(
+      sb->start, (sb->end - sb->start) + 1, alloc + 1, sb->allocator->ctx);
   if (sb->start == NULL) {
-    fprintf(stderr, "Out of memory.");
+    _sa_log_error(SA_ERROR_SYSTEM, "Out of memory.");
     exit(SA_MALLOC_ERROR);
   }
   sb->cur = sb->start + length;
@@ -108,6 +488,15 @@ static int _sa_sb_grow(SAStringBuffer *sb, unsigned long need) {
 }
 
 static int _sa_sb_put(SAStringBuffer *sb, const char *string_, unsigned long length) {
+  // 分段写入时按剩余空间分多次复制，不扩容.
+  while (NULL != sb->stream && (unsigned long)(sb->end - sb->cur) < length) {
+    unsigned long n = sb->end - sb->cur;
+    memcpy(sb->cur, string_, n);
+    sb->cur += n;
+    string_ += n;
+    length -= n;
+    _sa_sb_drain(sb);
+  }
   _sa_sb_need(sb, length);
   memcpy(sb->cur, string_, length);
   sb->cur += length;
@@ -129,7 +518,11 @@ static char *_sa_sb_finish(SAStringBuffer *sb, unsigned long* length) {
 }
 
 static void _sa_sb_free(SAStringBuffer *sb) {
-  free(sb->start);
+  // 序列化中途出错时结束已开始的分段写入，Consumer 可能在 begin 中加了锁.
+  if (sb->stream_begun) {
+    sb->stream->end(sb->stream_this);
+  }
+  sb->allocator->deallocate(sb->start, (sb->end - sb->start) + 1, sb->allocator->ctx);
 }
 
 
@@ -149,8 +542,11 @@ enum SANodeTag {
 struct SAListNode;
 
 typedef struct SANode {
-  // 引用计数，初始值为 1.
-  unsigned int ref_count;
+  // 引用计数，初始值为 1. 公共属性等节点会被多个线程同时引用，因此使用原子操作.
+  long ref_count;
+
+  // 为 SA_TRUE 时 key 和字符串值指向调用方的缓冲区（sa_parse_event），释放节点时不释放它们.
+  SABool borrowed;
 
   // 属性的 key，以 \0 结尾.
   char* key;
@@ -180,7 +576,7 @@ static void _sa_free_node(struct SANode* node);
 
 // 初始化事件属性或用户属性对象.
 static struct SANode* _sa_malloc_node(enum SANodeTag tag, const char* key) {
-  struct SANode* node = (struct SANode*)SA_SAFE_MALLOC(sizeof(SANode));
+  struct SANode* node = (struct SANode*)SA_ALLOC(sizeof(SANode));
   memset(node, 0, sizeof(struct SANode));
 
   node->ref_count = 1;
@@ -244,7 +640,13 @@ static struct SANode* _sa_init_string_node(const char* key, const char* str, uns
     return NULL;
   }
 
-  node->string_ = (char*)SA_SAFE_MALLOC(length + 1);
+  // 字符串在第一个 '\0' 处截断，释放时可由 strlen 得到分配的大小.
+  const char* nul = (const char*)memchr(str, 0, length);
+  if (NULL != nul) {
+    length = nul - str;
+  }
+
+  node->string_ = (char*)SA_ALLOC(length + 1);
   memcpy(node->string_, str, length);
   node->string_[length] = 0;
 
@@ -299,7 +701,7 @@ static void _sa_remove_child(const char* key, struct SANode* parent) {
       }
       _sa_free_node(curr->value);
       // SAListNode 对象只在这里 free.
-      free(curr);
+      SA_RELEASE(curr, sizeof(struct SAListNode));
     } else {
       prev = curr;
     }
@@ -322,14 +724,14 @@ static struct SAListNode* _sa_add_child(struct SANode* child, struct SANode* par
   }
 
   // SAListNode 对象只在这里 malloc.
-  struct SAListNode* element = (struct SAListNode*)SA_SAFE_MALLOC(sizeof(struct SAListNode));
+  struct SAListNode* element = (struct SAListNode*)SA_ALLOC(sizeof(struct SAListNode));
 
   element->next = parent->array_;
   parent->array_ = element;
 
   element->value = child;
   // 操作引用计数.
-  ++element->value->ref_count;
+  SA_ATOMIC_INCREMENT(&element->value->ref_count);
 
   return element;
 }
@@ -337,15 +739,17 @@ static struct SAListNode* _sa_add_child(struct SANode* child, struct SANode* par
 
 // 释放事件属性或用户属性对象.
 static void _sa_free_node(struct SANode* node) {
-  if ((--node->ref_count) == 0) {
-    if (NULL != node->key) {
-      free(node->key);
+  if (SA_ATOMIC_DECREMENT(&node->ref_count) == 0) {
+    if (NULL != node->key && !node->borrowed) {
+      SA_RELEASE(node->key, strlen(node->key) + 1);
     }
 
     // 释放属性的值.
     switch(node->tag) {
     case SA_STRING:
-      free(node->string_);
+      if (!node->borrowed) {
+        SA_RELEASE(node->string_, strlen(node->string_) + 1);
+      }
       break;
     case SA_LIST:
     case SA_DICT:
@@ -355,17 +759,59 @@ static void _sa_free_node(struct SANode* node) {
       // DO NOTHING
       break;
     }
-    free(node);
+    SA_RELEASE(node, sizeof(struct SANode));
   }
 }
 
-int _sa_dump_node(const struct SANode* node, SAStringBuffer* sb);
+// 深拷贝属性对象. 副本的 key 与值都由 SDK 分配，不与原对象共享任何节点，也不引用解析事件的输入缓冲区.
+static struct SANode* _sa_copy_node(const struct SANode* node) {
+  struct SANode* copy = _sa_malloc_node(node->tag, node->key);
+  switch (node->tag) {
+  case SA_STRING:
+    copy->string_ = _sa_strdup(node->string_);
+    break;
+  case SA_LIST:
+  case SA_DICT: {
+    // 按原顺序追加到末尾.
+    struct SAListNode** tail = &copy->array_;
+    const struct SAListNode* curr;
+    for (curr = node->array_; NULL != curr; curr = curr->next) {
+      struct SAListNode* element = (struct SAListNode*)SA_ALLOC(sizeof(struct SAListNode));
+      element->value = _sa_copy_node(curr->value);
+      element->next = NULL;
+      *tail = element;
+      tail = &element->next;
+    }
+    break;
+  }
+  case SA_BOOL:
+    copy->bool_ = node->bool_;
+    break;
+  case SA_NUMBER:
+    copy->number_ = node->number_;
+    break;
+  case SA_INT:
+    copy->int_ = node->int_;
+    break;
+  case SA_DATE:
+    copy->date_.seconds = node->date_.seconds;
+    copy->date_.microseconds = node->date_.microseconds;
+    break;
+  default:
+    break;
+  }
+  return copy;
+}
 
-int _sa_dump_dict(const struct SANode* node, SAStringBuffer* sb) {
-  _sa_sb_putc(sb, '{');
+int _sa_dump_node(const struct SANode* node, SAStringBuffer* sb);
 
+// 写入字典的成员（不含括号），written 为已写入的成员数，用于在同一个对象中继续拼接.
+static int _sa_dump_members(const struct SANode* node, SAStringBuffer* sb, int* written) {
   struct SAListNode* child = node->array_;
   while (NULL != child) {
+    if ((*written)++ > 0) {
+      _sa_sb_putc(sb, ',');
+    }
     _sa_sb_putc(sb, '"');
     _sa_sb_put(sb, child->value->key, strlen(child->value->key));
     _sa_sb_putc(sb, '"');
@@ -373,11 +819,14 @@ int _sa_dump_dict(const struct SANode* node, SAStringBuffer* sb) {
     _sa_dump_node(child->value, sb);
 
     child = child->next;
-    if (child != NULL) {
-      _sa_sb_putc(sb, ',');
-    }
   }
+  return SA_OK;
+}
 
+int _sa_dump_dict(const struct SANode* node, SAStringBuffer* sb) {
+  int written = 0;
+  _sa_sb_putc(sb, '{');
+  _sa_dump_members(node, sb, &written);
   _sa_sb_putc(sb, '}');
   return SA_OK;
 }
@@ -558,13 +1007,13 @@ static void _sa_to_surrogate_pair(unsigned int unicode, uint16_t *uc, uint16_t *
   *lc = (n & 0x3FF) | 0xDC00;
 }
 
-int _sa_dump_string(const struct SANode* node, SAStringBuffer* sb) {
+// 将以 \0 结尾的 UTF-8 字符串序列化为 JSON 字符串.
+static int _sa_dump_cstring(const char* s, SAStringBuffer* sb) {
   SABool escape_unicode = SA_FALSE;
-  const char *s = node->string_;
   char *b;
 
   if (!sa_utf8_validate(s)) {
-    fprintf(stderr, "Invalid utf-8 string.");
+    _sa_log_error(SA_ERROR_INVALID_UTF8, "Invalid utf-8 string.");
     return SA_INVALID_PARAMETER_ERROR;
   }
 
@@ -679,6 +1128,10 @@ int _sa_dump_string(const struct SANode* node, SAStringBuffer* sb) {
   return SA_OK;
 }
 
+int _sa_dump_string(const struct SANode* node, SAStringBuffer* sb) {
+  return _sa_dump_cstring(node->string_, sb);
+}
+
 // 将 struct SANode JSON 序列化至文件.
 int _sa_dump_node(const struct SANode* node, SAStringBuffer* sb) {
   if (NULL == node || NULL == sb) {
@@ -744,14 +1197,14 @@ void sa_free_properties(SAProperties* properties) {
 
 int sa_add_bool(const char* key, SABool bool_, SAProperties* properties) {
   if (NULL == properties) {
-    fprintf(stderr, "Parameter 'properties' is NULL.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Parameter 'properties' is NULL.");
     return SA_INVALID_PARAMETER_ERROR;
   }
   // TODO: check key
 
   struct SANode* child = _sa_init_bool_node(key, bool_);
   if (NULL == child) {
-    fprintf(stderr, "Out of memory.");
+    _sa_log_error(SA_ERROR_SYSTEM, "Out of memory.");
     return SA_MALLOC_ERROR;
   }
 
@@ -763,14 +1216,14 @@ int sa_add_bool(const char* key, SABool bool_, SAProperties* properties) {
 
 int sa_add_number(const char* key, double number_, SAProperties* properties) {
   if (NULL == properties) {
-    fprintf(stderr, "Parameter 'properties' is NULL.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Parameter 'properties' is NULL.");
     return SA_INVALID_PARAMETER_ERROR;
   }
   // TODO: check key
 
   struct SANode* child = _sa_init_number_node(key, number_);
   if (NULL == child) {
-    fprintf(stderr, "Out of memory.");
+    _sa_log_error(SA_ERROR_SYSTEM, "Out of memory.");
     return SA_MALLOC_ERROR;
   }
 
@@ -782,14 +1235,14 @@ int sa_add_number(const char* key, double number_, SAProperties* properties) {
 
 int sa_add_int(const char* key, long long int_, SAProperties* properties) {
   if (NULL == properties) {
-    fprintf(stderr, "Parameter 'properties' is NULL.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Parameter 'properties' is NULL.");
     return SA_INVALID_PARAMETER_ERROR;
   }
   // TODO: check key
 
   struct SANode* child = _sa_init_int_node(key, int_);
   if (NULL == child) {
-    fprintf(stderr, "Out of memory.");
+    _sa_log_error(SA_ERROR_SYSTEM, "Out of memory.");
     return SA_MALLOC_ERROR;
   }
 
@@ -801,14 +1254,14 @@ int sa_add_int(const char* key, long long int_, SAProperties* properties) {
 
 int sa_add_date(const char* key, time_t seconds, int microseconds, SAProperties* properties) {
   if (NULL == properties) {
-    fprintf(stderr, "Parameter 'properties' is NULL.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Parameter 'properties' is NULL.");
     return SA_INVALID_PARAMETER_ERROR;
   }
   // TODO: check key
 
   struct SANode* child = _sa_init_date_node(key, seconds, microseconds);
   if (NULL == child) {
-    fprintf(stderr, "Out of memory.");
+    _sa_log_error(SA_ERROR_SYSTEM, "Out of memory.");
     return SA_MALLOC_ERROR;
   }
 
@@ -820,14 +1273,14 @@ int sa_add_date(const char* key, time_t seconds, int microseconds, SAProperties*
 
 int sa_add_string(const char* key, const char* string_, unsigned int length, SAProperties* properties) {
   if (NULL == properties) {
-    fprintf(stderr, "Parameter 'properties' is NULL.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Parameter 'properties' is NULL.");
     return SA_INVALID_PARAMETER_ERROR;
   }
   // TODO: check key
 
   struct SANode* child = _sa_init_string_node(key, string_, length);
   if (NULL == child) {
-    fprintf(stderr, "Out of memory.");
+    _sa_log_error(SA_ERROR_SYSTEM, "Out of memory.");
     return SA_MALLOC_ERROR;
   }
 
@@ -840,7 +1293,7 @@ int sa_add_string(const char* key, const char* string_, unsigned int length, SAP
 // 向事件属性或用户属性的 List 类型的属性中插入新对象，对象必须是 String 类型的.
 int sa_append_list(const char* key, const char* string_, unsigned int length, SAProperties* properties) {
   if (NULL == properties) {
-    fprintf(stderr, "Parameter 'properties' is NULL.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Parameter 'properties' is NULL.");
     return SA_INVALID_PARAMETER_ERROR;
   }
   // TODO: check key
@@ -855,7 +1308,7 @@ int sa_append_list(const char* key, const char* string_, unsigned int length, SA
     _sa_add_child(list, properties);
 
   } else {
-    ++list->ref_count;
+    SA_ATOMIC_INCREMENT(&list->ref_count);
   }
 
   // 向 List 对象中添加字符串属性.
@@ -884,13 +1337,16 @@ typedef struct {
   FILE* file;
 } SALoggingConsumerInter;
 
-static int _sa_get_current_date() {
-  time_t t = time(NULL);
+static int _sa_get_date(time_t t) {
   struct tm tm;
   LOCALTIME(&t, &tm);
   return tm.tm_year * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
 }
 
+static int _sa_get_current_date() {
+  return _sa_get_date(time(NULL));
+}
+
 static int _sa_logging_consumer_flush(void* this_) {
   SALoggingConsumerInter* inter = (SALoggingConsumerInter*)this_;
   if (NULL != inter->file && 0 == fflush(inter->file)) {
@@ -914,17 +1370,12 @@ static int _sa_logging_consumer_close(void* this_) {
   return SA_OK;
 }
 
-static int _sa_logging_consumer_send(void* this_, const char* event, unsigned long length) {
-  if (NULL == this_ || NULL == event) {
-    return SA_INVALID_PARAMETER_ERROR;
-  }
-
-  SALoggingConsumerInter* inter = (SALoggingConsumerInter*)this_;
-
+// 打开当日的日志文件，日期变化时关闭前一天的文件.
+static int _sa_logging_consumer_open(SALoggingConsumerInter* inter) {
   // 判断日志文件的日期是否为当日.
   int date = _sa_get_current_date();
-  if (date != inter->date) {
-    _sa_logging_consumer_close(this_);
+  if (date != inter->date || NULL == inter->file) {
+    _sa_logging_consumer_close(inter);
 
     inter->date = date;
     snprintf(inter->file_name, 512, "%s.log.%d", inter->file_name_prefix, date);
@@ -932,21 +1383,73 @@ static int _sa_logging_consumer_send(void* this_, const char* event, unsigned lo
     // Append 模式打开文件.
     FOPEN(&inter->file, inter->file_name, "a");
     if (NULL == inter->file) {
-      fprintf(stderr, "Failed to open file.");
+      _sa_log_error(SA_ERROR_IO, "Failed to open file [%s].", inter->file_name);
       return SA_IO_ERROR;
     }
+    // 探针 rotate(文件名, 日期).
+    SA_PROBE2(rotate, inter->file_name, date);
+  }
+  return SA_OK;
+}
+
+static int _sa_logging_consumer_send(void* this_, const char* event, unsigned long length) {
+  if (NULL == this_ || NULL == event) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SALoggingConsumerInter* inter = (SALoggingConsumerInter*)this_;
+
+  int res = _sa_logging_consumer_open(inter);
+  if (SA_OK != res) {
+    return res;
   }
 
+  // 与分段写入的事件互斥，避免其他线程的事件插入到一行中间.
+  FLOCKFILE(inter->file);
   fwrite(event, length, 1, inter->file);
   fwrite("\n", 1, 1, inter->file);
+  FUNLOCKFILE(inter->file);
+
+  return SA_OK;
+}
+
+// 分段写入: begin 锁定日志文件直到 end 写入换行，同一行中不会插入其他线程的事件.
+static int _sa_logging_consumer_begin(void* this_) {
+  SALoggingConsumerInter* inter = (SALoggingConsumerInter*)this_;
+
+  int res = _sa_logging_consumer_open(inter);
+  if (SA_OK != res) {
+    return res;
+  }
+  FLOCKFILE(inter->file);
+  return SA_OK;
+}
 
+static int _sa_logging_consumer_append(void* this_, const char* data, unsigned long length) {
+  SALoggingConsumerInter* inter = (SALoggingConsumerInter*)this_;
+  if (1 != fwrite(data, length, 1, inter->file)) {
+    return SA_IO_ERROR;
+  }
   return SA_OK;
 }
 
+static int _sa_logging_consumer_end(void* this_) {
+  SALoggingConsumerInter* inter = (SALoggingConsumerInter*)this_;
+  int res = (1 == fwrite("\n", 1, 1, inter->file)) ? SA_OK : SA_IO_ERROR;
+  FUNLOCKFILE(inter->file);
+  return res;
+}
+
+static const struct SAConsumerStreamOp _sa_logging_consumer_stream_op = {
+  &_sa_logging_consumer_begin,
+  &_sa_logging_consumer_append,
+  &_sa_logging_consumer_end
+};
+
 // 初始化 Logging Consumer.
 int sa_init_logging_consumer(const char* file_name, SALoggingConsumer** sa) {
   if (strlen(file_name) > 500) {
-    fprintf(stderr,"The file name length must not exceed 500.");
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "The file name length must not exceed 500.");
     return SA_INVALID_PARAMETER_ERROR;
   }
 
@@ -965,422 +1468,4501 @@ int sa_init_logging_consumer(const char* file_name, SALoggingConsumer** sa) {
   return SA_OK;
 }
 
-// Sensors Analytics ----------------------------------------------------------
-typedef struct SensorsAnalytics {
-  // 存储事件公共属性.
-  SAProperties* super_properties;
-#if defined(USE_POSIX)
-  // Mutex
-  pthread_mutex_t mutex;
-  // 检查事件、属性规范的正则表达式.
-  regex_t regex[2];
-#elif defined(_WIN32)
-  CRITICAL_SECTION mutex;
-  pcre* regex[2];
-#endif
-  struct SAConsumer* consumer;
-} SensorsAnalytics;
+// Backfill Consumer ----------------------------------------------------------
 
-int sa_init(struct SAConsumer* consumer, SensorsAnalytics** sa) {
-  *sa = (SensorsAnalytics*)SA_SAFE_MALLOC(sizeof(SensorsAnalytics));
+typedef struct {
+  // 日志文件日期，格式与 LoggingConsumer 相同.
+  int date;
+  FILE* file;
+  // 最近一次写入的序号，用于淘汰最久未使用的文件.
+  unsigned long long last_used;
+} SABackfillFile;
 
-  (*sa)->super_properties = sa_init_properties();
-  if (NULL == (*sa)->super_properties) {
-    free(*sa);
-    return SA_MALLOC_ERROR;
+typedef struct {
+  char file_name_prefix[512];
+#if defined(SA_HAS_THREADS)
+  SAMutex mutex;
+#endif
+  unsigned long long clock;
+  unsigned int max_open_files;
+  unsigned int open_files;
+  // 紧跟在结构体之后分配 max_open_files 个元素.
+  SABackfillFile* files;
+} SABackfillConsumerInter;
+
+// 读取事件 JSON 中顶层 "time" 字段的值（毫秒），跳过属性等嵌套对象以及字符串中的内容.
+static int _sa_get_event_time(const char* event, unsigned long length, long long* time_ms) {
+  const char* p = event;
+  const char* end = event + length;
+  int depth = 0;
+  while (p < end) {
+    char c = *p++;
+    if ('"' == c) {
+      const char* key = p;
+      while (p < end && '"' != *p) {
+        p += ('\\' == *p) ? 2 : 1;
+      }
+      if (p >= end) {
+        break;
+      }
+      const char* key_end = p++;
+      if (1 == depth && 4 == key_end - key && 0 == memcmp(key, "time", 4) && p < end && ':' == *p) {
+        long long value = 0;
+        const char* digits = ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+          value = value * 10 + (*p++ - '0');
+        }
+        if (p == digits) {
+          break;
+        }
+        *time_ms = value;
+        return SA_OK;
+      }
+    } else if ('{' == c || '[' == c) {
+      ++depth;
+    } else if ('}' == c || ']' == c) {
+      --depth;
+    }
   }
+  return SA_INVALID_PARAMETER_ERROR;
+}
 
-#if defined(USE_POSIX)
-  if (pthread_mutex_init(&((*sa)->mutex), NULL) != 0) {
-    fprintf(stderr, "Initialize mutex error.");
-    return SA_MALLOC_ERROR;
+// 返回 date 对应的文件，未打开时打开该文件，必要时关闭最久未写入的文件.
+static FILE* _sa_backfill_consumer_open(SABackfillConsumerInter* inter, int date) {
+  SABackfillFile* victim = NULL;
+  unsigned int i;
+  for (i = 0; i < inter->open_files; ++i) {
+    SABackfillFile* f = &inter->files[i];
+    if (f->date == date) {
+      f->last_used = ++inter->clock;
+      return f->file;
+    }
+    if (NULL == victim || f->last_used < victim->last_used) {
+      victim = f;
+    }
   }
 
-  if (0 != regcomp(&((*sa)->regex[0]), KEY_WORD_PATTERN, REG_EXTENDED | REG_ICASE | REG_NOSUB)) {
-    fprintf(stderr, "Compile regex error.");
-    return SA_MALLOC_ERROR;
-  }
-  if (0 != regcomp(&((*sa)->regex[1]), NAME_PATTERN, REG_EXTENDED | REG_ICASE | REG_NOSUB)) {
-    fprintf(stderr, "Compile regex error.");
-    return SA_MALLOC_ERROR;
+  if (inter->open_files < inter->max_open_files) {
+    victim = &inter->files[inter->open_files++];
+  } else {
+    fclose(victim->file);
   }
-#elif defined(_WIN32)
-  InitializeCriticalSection(&((*sa)->mutex));
 
-  const char* error_message = NULL;
-  int offset = -1;
-  if (NULL == ((*sa)->regex[0] = pcre_compile(
-        KEY_WORD_PATTERN, PCRE_EXTENDED | PCRE_CASELESS, &error_message, &offset, NULL))) {
-    fprintf(stderr, "Compile regex error. ErrMsg:%s, Offset:%d", error_message, offset);
-    return SA_MALLOC_ERROR;
-  }
-  if (NULL == ((*sa)->regex[1] = pcre_compile(
-        NAME_PATTERN, PCRE_EXTENDED | PCRE_CASELESS, &error_message, &offset, NULL))) {
-    fprintf(stderr, "Compile regex error. ErrMsg:%s, Offset:%d", error_message, offset);
-    return SA_MALLOC_ERROR;
+  char file_name[528];
+  snprintf(file_name, sizeof(file_name), "%s.log.%d", inter->file_name_prefix, date);
+  // Append 模式打开文件.
+  FOPEN(&victim->file, file_name, "a");
+  if (NULL == victim->file) {
+    _sa_log_error(SA_ERROR_IO, "Failed to open file [%s].", file_name);
+    *victim = inter->files[--inter->open_files];
+    return NULL;
   }
-#endif
-
-  (*sa)->consumer = consumer;
-
-  return SA_OK;
+  victim->date = date;
+  victim->last_used = ++inter->clock;
+  // 探针 rotate(文件名, 日期).
+  SA_PROBE2(rotate, file_name, date);
+  return victim->file;
 }
 
-// 释放 sa.
-void sa_free(SensorsAnalytics* sa) {
-  if (NULL == sa) {
-    return;
+static int _sa_backfill_consumer_send(void* this_, const char* event, unsigned long length) {
+  if (NULL == this_ || NULL == event) {
+    return SA_INVALID_PARAMETER_ERROR;
   }
 
-  sa_free_properties(sa->super_properties);
+  SABackfillConsumerInter* inter = (SABackfillConsumerInter*)this_;
 
-#if defined(USE_POSIX)
-  pthread_mutex_destroy(&(sa->mutex));
+  // 按事件时间所在的日期写入对应的文件，没有 time 字段时使用当前日期.
+  long long time_ms = 0;
+  int date;
+  if (SA_OK == _sa_get_event_time(event, length, &time_ms)) {
+    date = _sa_get_date((time_t)(time_ms / 1000));
+  } else {
+    date = _sa_get_current_date();
+  }
 
-  regfree(&(sa->regex[0]));
-  regfree(&(sa->regex[1]));
-#elif defined(_WIN32)
-  DeleteCriticalSection(&(sa->mutex));
-  pcre_free(sa->regex[0]);
-  pcre_free(sa->regex[1]);
+  int res = SA_OK;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&inter->mutex);
 #endif
-
-  sa->consumer->op.close(sa->consumer->this_);
-  free(sa->consumer->this_);
-  free(sa->consumer);
-
-  free(sa);
-}
-
-// 同步 sa 的状态，将发送 sa 的缓存中所有数据.
-void sa_flush(SensorsAnalytics* sa) {
-  sa->consumer->op.flush(sa->consumer->this_);
+  FILE* file = _sa_backfill_consumer_open(inter, date);
+  if (NULL == file) {
+    res = SA_IO_ERROR;
+  } else {
+    fwrite(event, length, 1, file);
+    fwrite("\n", 1, 1, file);
+  }
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&inter->mutex);
+#endif
+  return res;
 }
 
-int sa_register_super_properties(const SAProperties* properties, SensorsAnalytics *sa) {
-  if (NULL == sa || NULL == properties || SA_DICT != properties->tag) {
+static int _sa_backfill_consumer_flush(void* this_) {
+  if (NULL == this_) {
     return SA_INVALID_PARAMETER_ERROR;
   }
 
-  // 遍历 properties 中所有属性，逐个保存在 super properties 中.
-#if defined(USE_POSIX)
-  pthread_mutex_lock(&sa->mutex);
-#elif defined(_WIN32)
-  EnterCriticalSection(&sa->mutex);
+  SABackfillConsumerInter* inter = (SABackfillConsumerInter*)this_;
+  int res = SA_OK;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&inter->mutex);
 #endif
-  struct SAListNode* curr = properties->array_;
-  while (NULL != curr) {
-    _sa_add_child(curr->value, sa->super_properties);
-    curr = curr->next;
+  unsigned int i;
+  for (i = 0; i < inter->open_files; ++i) {
+    if (0 != fflush(inter->files[i].file)) {
+      res = SA_IO_ERROR;
+    }
   }
-#if defined(USE_POSIX)
-  pthread_mutex_unlock(&sa->mutex);
-#elif defined(_WIN32)
-  LeaveCriticalSection(&sa->mutex);
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&inter->mutex);
+#endif
+  return res;
+}
+
+static int _sa_backfill_consumer_close(void* this_) {
+  if (NULL == this_) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SABackfillConsumerInter* inter = (SABackfillConsumerInter*)this_;
+  unsigned int i;
+  for (i = 0; i < inter->open_files; ++i) {
+    fclose(inter->files[i].file);
+  }
+  inter->open_files = 0;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_DESTROY(&inter->mutex);
 #endif
 
   return SA_OK;
 }
 
-int sa_unregister_super_properties(const char* key, SensorsAnalytics *sa) {
-#if defined(USE_POSIX)
-  pthread_mutex_lock(&sa->mutex);
-#elif defined(_WIN32)
-  EnterCriticalSection(&sa->mutex);
-#endif
-  _sa_remove_child(key, sa->super_properties);
-#if defined(USE_POSIX)
-  pthread_mutex_unlock(&sa->mutex);
-#elif defined(_WIN32)
-  LeaveCriticalSection(&sa->mutex);
+// 初始化 Backfill Consumer.
+int sa_init_backfill_consumer(
+    const char* file_name, unsigned int max_open_files, SABackfillConsumer** consumer) {
+  if (NULL == file_name || NULL == consumer || 0 == max_open_files) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Invalid parameter for backfill consumer.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (strlen(file_name) > 500) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "The file name length must not exceed 500.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  // 文件句柄数组与内部数据一起分配，sa_free 释放 this_ 时一并释放.
+  SABackfillConsumerInter* inter = (SABackfillConsumerInter*)SA_SAFE_MALLOC(
+      sizeof(SABackfillConsumerInter) + max_open_files * sizeof(SABackfillFile));
+  memset(inter, 0, sizeof(SABackfillConsumerInter));
+  memcpy(inter->file_name_prefix, file_name, strlen(file_name));
+  inter->max_open_files = max_open_files;
+  inter->files = (SABackfillFile*)(inter + 1);
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_INIT(&inter->mutex);
 #endif
+
+  *consumer = (SABackfillConsumer*)SA_SAFE_MALLOC(sizeof(SABackfillConsumer));
+
+  (*consumer)->this_ = (void*)inter;
+  (*consumer)->op.send = &_sa_backfill_consumer_send;
+  (*consumer)->op.flush = &_sa_backfill_consumer_flush;
+  (*consumer)->op.close = &_sa_backfill_consumer_close;
+
   return SA_OK;
 }
 
-int sa_clear_super_properties(SensorsAnalytics *sa) {
-#if defined(USE_POSIX)
-  pthread_mutex_lock(&sa->mutex);
-#elif defined(_WIN32)
-  EnterCriticalSection(&sa->mutex);
-#endif
-  _sa_remove_child(NULL, sa->super_properties);
+// Relay Consumer -------------------------------------------------------------
+
 #if defined(USE_POSIX)
-  pthread_mutex_unlock(&sa->mutex);
-#elif defined(_WIN32)
-  LeaveCriticalSection(&sa->mutex);
-#endif
+
+typedef struct {
+  struct sockaddr_un address;
+  int fd;
+  // 积攒的事件，每条以换行符结尾，超过 batch_bytes 时作为一个数据报发送.
+  char* batch;
+  unsigned long length;
+  unsigned long batch_bytes;
+  // 积攒的事件数，以及积攒后发送失败而丢弃的事件数.
+  unsigned long count;
+  volatile long long dropped;
+  SAMutex mutex;
+} SARelayConsumerInter;
+
+// 将 iov 中的内容作为一个数据报发送给 relay. 未连接的 socket 每次按路径发送，relay 重启后自动恢复.
+static int _sa_relay_consumer_sendmsg(SARelayConsumerInter* inter, struct iovec* iov, int iovcnt) {
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &inter->address;
+  msg.msg_namelen = sizeof(inter->address);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  while (sendmsg(inter->fd, &msg, 0) < 0) {
+    if (EINTR != errno) {
+      _sa_log_error(SA_ERROR_IO, "Failed to send to relay [%s]: %s.", inter->address.sun_path, strerror(errno));
+      return SA_IO_ERROR;
+    }
+  }
   return SA_OK;
 }
 
-// Track events ---------------------------------------------------------------
+// 发送积攒的事件，调用时须持有 mutex. 发送失败时丢弃这些事件，并计入 dropped.
+static int _sa_relay_consumer_send_batch(SARelayConsumerInter* inter) {
+  if (0 == inter->length) {
+    return SA_OK;
+  }
+  struct iovec iov;
+  iov.iov_base = inter->batch;
+  iov.iov_len = inter->length;
+  inter->length = 0;
+  int res = _sa_relay_consumer_sendmsg(inter, &iov, 1);
+  if (SA_OK != res) {
+    SA_ATOMIC_ADD64(&inter->dropped, (long long)inter->count);
+  }
+  inter->count = 0;
+  return res;
+}
 
-#if defined(USE_POSIX)
-static int _sa_assert_key_name(const char* key, regex_t* regex) {
-#elif defined(_WIN32)
-static int _sa_assert_key_name(const char* key, pcre** regex) {
-#else
-static int _sa_assert_key_name(const char* key) {
-#endif
-  unsigned long key_len = (NULL == key ? (unsigned long)-1 : strlen(key));
-  if (key_len < 1 || key_len > 255) {
+static int _sa_relay_consumer_send(void* this_, const char* event, unsigned long length) {
+  if (NULL == this_ || NULL == event) {
     return SA_INVALID_PARAMETER_ERROR;
   }
-#if defined(USE_POSIX)
-  if (0 == regexec(&regex[0], key, 0, NULL, 0)) {
-    // Match keywords
+  if (length + 1 > SA_RELAY_MAX_DATAGRAM) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "The event length must not exceed %d for relay.",
+        SA_RELAY_MAX_DATAGRAM - 1);
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SARelayConsumerInter* inter = (SARelayConsumerInter*)this_;
+  int res = SA_OK;
+  SA_MUTEX_LOCK(&inter->mutex);
+  // 之前积攒的事件发送失败时计入 dropped，不作为本条事件的结果.
+  if (inter->length + length + 1 > inter->batch_bytes) {
+    _sa_relay_consumer_send_batch(inter);
+  }
+  if (length + 1 > inter->batch_bytes) {
+    // 不积攒或超过积攒大小的事件单独发送.
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)event;
+    iov[0].iov_len = length;
+    iov[1].iov_base = (void*)"\n";
+    iov[1].iov_len = 1;
+    res = _sa_relay_consumer_sendmsg(inter, iov, 2);
+  } else {
+    memcpy(inter->batch + inter->length, event, length);
+    inter->batch[inter->length + length] = '\n';
+    inter->length += length + 1;
+    ++inter->count;
+  }
+  SA_MUTEX_UNLOCK(&inter->mutex);
+  return res;
+}
+
+static int _sa_relay_consumer_flush(void* this_) {
+  if (NULL == this_) {
     return SA_INVALID_PARAMETER_ERROR;
   }
-  if (0 != regexec(&regex[1], key, 0, NULL, 0)) {
-    // Match keywords
+
+  SARelayConsumerInter* inter = (SARelayConsumerInter*)this_;
+  SA_MUTEX_LOCK(&inter->mutex);
+  int res = _sa_relay_consumer_send_batch(inter);
+  SA_MUTEX_UNLOCK(&inter->mutex);
+  return res;
+}
+
+static int _sa_relay_consumer_close(void* this_) {
+  if (NULL == this_) {
     return SA_INVALID_PARAMETER_ERROR;
   }
-#elif defined(_WIN32)
-  // the match case
-  if (0 <= pcre_exec(regex[0], NULL, key, strlen(key), 0, 0, NULL, 0)) {
+
+  SARelayConsumerInter* inter = (SARelayConsumerInter*)this_;
+  _sa_relay_consumer_send_batch(inter);
+  close(inter->fd);
+  if (NULL != inter->batch) {
+    SA_RELEASE(inter->batch, inter->batch_bytes);
+    inter->batch = NULL;
+  }
+  SA_MUTEX_DESTROY(&inter->mutex);
+
+  return SA_OK;
+}
+
+// 返回 RelayConsumer 的内部数据，consumer 不是 RelayConsumer 时返回 NULL.
+static SARelayConsumerInter* _sa_get_relay_consumer(const struct SAConsumer* consumer) {
+  if (NULL != consumer && consumer->op.send == &_sa_relay_consumer_send) {
+    return (SARelayConsumerInter*)consumer->this_;
+  }
+  return NULL;
+}
+
+#endif  // USE_POSIX
+
+// 初始化 Relay Consumer.
+int sa_init_relay_consumer(const char* socket_path, unsigned long batch_bytes, SARelayConsumer** consumer) {
+#if defined(USE_POSIX)
+  if (NULL == socket_path || NULL == consumer || batch_bytes > SA_RELAY_MAX_DATAGRAM) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Invalid parameter for relay consumer.");
     return SA_INVALID_PARAMETER_ERROR;
   }
-  if (0 > pcre_exec(regex[1], NULL, key, strlen(key), 0, 0, NULL, 0)) {
+
+  SARelayConsumerInter* inter = (SARelayConsumerInter*)SA_SAFE_MALLOC(sizeof(SARelayConsumerInter));
+  memset(inter, 0, sizeof(SARelayConsumerInter));
+  if (strlen(socket_path) >= sizeof(inter->address.sun_path)) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "The socket path length must be less than %d.",
+        (int)sizeof(inter->address.sun_path));
+    free(inter);
     return SA_INVALID_PARAMETER_ERROR;
   }
+  inter->address.sun_family = AF_UNIX;
+  memcpy(inter->address.sun_path, socket_path, strlen(socket_path));
+
+  inter->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (inter->fd < 0) {
+    _sa_log_error(SA_ERROR_SYSTEM, "Failed to create socket: %s.", strerror(errno));
+    free(inter);
+    return SA_IO_ERROR;
+  }
+  fcntl(inter->fd, F_SETFD, FD_CLOEXEC);
+  // 发送缓冲区至少容纳一个完整的数据报.
+  int sndbuf = SA_RELAY_MAX_DATAGRAM * 2;
+  setsockopt(inter->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  inter->batch_bytes = batch_bytes;
+  if (batch_bytes > 0) {
+    inter->batch = (char*)SA_ALLOC(batch_bytes);
+  }
+  SA_MUTEX_INIT(&inter->mutex);
+
+  *consumer = (SARelayConsumer*)SA_SAFE_MALLOC(sizeof(SARelayConsumer));
+
+  (*consumer)->this_ = (void*)inter;
+  (*consumer)->op.send = &_sa_relay_consumer_send;
+  (*consumer)->op.flush = &_sa_relay_consumer_flush;
+  (*consumer)->op.close = &_sa_relay_consumer_close;
 
-#endif
   return SA_OK;
+#else
+  (void)socket_path;
+  (void)batch_bytes;
+  (void)consumer;
+  _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Relay consumer requires Unix domain sockets.");
+  return SA_INVALID_PARAMETER_ERROR;
+#endif
 }
 
-static int _sa_is_track(const char* type) {
-  return 0 == strncmp(type, "track", strlen("track"));
+// 日志文件读取 -----------------------------------------------------------------
+
+struct SALogReader {
+  // 文件内容，POSIX 平台上为只读映射，其他平台上读入内存. data 对应文件中的 data_offset 处.
+  char* data;
+  unsigned long long data_length;
+  unsigned long long data_offset;
+  // 映射的起始地址与长度，起始地址按页对齐.
+  void* mapping;
+  unsigned long long mapping_length;
+  // 下一条记录的位置; 起点不小于 end 的记录属于之后的范围; limit 为文件结尾.
+  const char* cur;
+  const char* end;
+  const char* limit;
+};
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SA_HAS_SSE2 1
+
+// 最低的非 0 位的位置，mask 不为 0.
+static int _sa_ctz(unsigned int mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, (unsigned long)mask);
+  return (int)index;
+#else
+  return __builtin_ctz(mask);
+#endif
 }
+#endif
 
-static int _sa_is_track_signup(const char* type) {
-  return 0 == strncmp(type, "track_signup", strlen("track_signup"));
+// 返回 [p, end) 中第一个换行符的位置，没有时返回 end. 支持 SSE2 时每次比较 64 字节.
+static const char* _sa_find_newline(const char* p, const char* end) {
+#if defined(SA_HAS_SSE2)
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; end - p >= 64; p += 64) {
+    __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline);
+    __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), newline);
+    __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), newline);
+    __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), newline);
+    if (0 != _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) {
+      break;
+    }
+  }
+  for (; end - p >= 16; p += 16) {
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+    if (0 != mask) {
+      return p + _sa_ctz((unsigned int)mask);
+    }
+  }
+#endif
+  const char* found = (const char*)memchr(p, '\n', end - p);
+  return NULL != found ? found : end;
 }
 
-static int _sa_check_legality(
-  const char* distinct_id,
-  const char* origin_id,
-  const char* type,
-  const char* event,
-  const struct SANode* properties,
-  SensorsAnalytics* sa) {
-  // 合法性检查.
-  unsigned long distinct_id_len = (NULL == distinct_id ? (unsigned long)-1 : strlen(distinct_id));
-  if (distinct_id_len < 1 || distinct_id_len > 255) {
-    fprintf(
-      stderr,
-      "Invalid distinct id [%s].\n",
-      distinct_id == NULL ? "NULL" : distinct_id);
+// 将 reader 的范围设置为文件中 [offset, offset + length) 内开始的记录，length 为 0 表示到文件结尾.
+// offset 不是记录的开始时跳过其所在的记录，该记录属于前一个范围.
+static void _sa_log_reader_range(
+  SALogReader* reader, unsigned long long offset, unsigned long long length) {
+  reader->limit = reader->data + reader->data_length;
+  unsigned long long file_size = reader->data_offset + reader->data_length;
+  if (offset >= file_size) {
+    reader->cur = reader->end = reader->limit;
+    return;
+  }
+
+  reader->cur = reader->data + (offset - reader->data_offset);
+  if (offset > 0 && '\n' != reader->cur[-1]) {
+    reader->cur = _sa_find_newline(reader->cur, reader->limit);
+    if (reader->cur < reader->limit) {
+      ++reader->cur;
+    }
+  }
+  if (0 == length || length >= file_size - offset) {
+    reader->end = reader->limit;
+  } else {
+    reader->end = reader->data + (offset + length - reader->data_offset);
+  }
+}
+
+int sa_log_reader_open(
+    const char* path, unsigned long long offset, unsigned long long length, SALogReader** reader) {
+  if (NULL == path || NULL == reader) {
     return SA_INVALID_PARAMETER_ERROR;
   }
-  if (_sa_is_track_signup(type)) {
-    unsigned long origin_id_len = (NULL == origin_id ? (unsigned long)-1 : strlen(origin_id));
-    if (origin_id_len < 1 || origin_id_len > 255) {
-      fprintf(
-        stderr,
-        "Invalid original distinct id [%s].\n",
-        origin_id == NULL ? "NULL" : origin_id);
-      return SA_INVALID_PARAMETER_ERROR;
+
+  SALogReader* inter = (SALogReader*)SA_ALLOC(sizeof(SALogReader));
+  memset(inter, 0, sizeof(SALogReader));
+  // 从 offset 的前一个字节开始，用于判断 offset 是否为记录的开始.
+  unsigned long long start = offset > 0 ? offset - 1 : 0;
+
+#if defined(USE_POSIX)
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || 0 != fstat(fd, &st)) {
+    _sa_log_error(SA_ERROR_IO, "Failed to open file [%s].", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    SA_RELEASE(inter, sizeof(SALogReader));
+    return SA_IO_ERROR;
+  }
+
+  unsigned long long file_size = (unsigned long long)st.st_size;
+  if (start < file_size) {
+    unsigned long long page = (unsigned long long)sysconf(_SC_PAGESIZE);
+    unsigned long long map_offset = start / page * page;
+    inter->mapping_length = file_size - map_offset;
+    inter->mapping = mmap(NULL, (size_t)inter->mapping_length, PROT_READ, MAP_PRIVATE, fd, (off_t)map_offset);
+    if (MAP_FAILED == inter->mapping) {
+      _sa_log_error(SA_ERROR_IO, "Failed to map file [%s].", path);
+      close(fd);
+      SA_RELEASE(inter, sizeof(SALogReader));
+      return SA_IO_ERROR;
+    }
+    // 记录按顺序读取，内核可以加大预读并及时回收已读过的页.
+    posix_madvise(inter->mapping, (size_t)inter->mapping_length, POSIX_MADV_SEQUENTIAL);
+    inter->data = (char*)inter->mapping + (start - map_offset);
+    inter->data_length = file_size - start;
+  }
+  inter->data_offset = start;
+  close(fd);
+#else
+  FILE* file = NULL;
+  FOPEN(&file, path, "rb");
+  if (NULL == file) {
+    _sa_log_error(SA_ERROR_IO, "Failed to open file [%s].", path);
+    SA_RELEASE(inter, sizeof(SALogReader));
+    return SA_IO_ERROR;
+  }
+
+  // 不支持 mmap 时读入从 start 到文件结尾的内容.
+  unsigned long long capacity = 64 * 1024;
+  inter->data = (char*)SA_ALLOC(capacity);
+  if (0 == fseek(file, (long)start, SEEK_SET)) {
+    size_t n;
+    while ((n = fread(inter->data + inter->data_length, 1,
+                      (size_t)(capacity - inter->data_length), file)) > 0) {
+      inter->data_length += n;
+      if (inter->data_length == capacity) {
+        char* data = (char*)SA_ALLOC(capacity * 2);
+        memcpy(data, inter->data, (size_t)capacity);
+        SA_RELEASE(inter->data, capacity);
+        inter->data = data;
+        capacity *= 2;
+      }
+    }
+  }
+  inter->mapping_length = capacity;
+  inter->data_offset = start;
+  fclose(file);
+#endif
+
+  _sa_log_reader_range(inter, offset, length);
+  *reader = inter;
+  return SA_OK;
+}
+
+int sa_log_reader_next(SALogReader* reader, const char** record, unsigned long* length) {
+  if (NULL == reader || NULL == record || NULL == length) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  while (reader->cur < reader->end) {
+    const char* begin = reader->cur;
+    const char* newline = _sa_find_newline(begin, reader->limit);
+    reader->cur = newline < reader->limit ? newline + 1 : reader->limit;
+
+    // 去掉行尾的 \r，跳过空行.
+    const char* stop = newline;
+    if (stop > begin && '\r' == stop[-1]) {
+      --stop;
+    }
+    if (stop > begin) {
+      *record = begin;
+      *length = (unsigned long)(stop - begin);
+      return SA_OK;
+    }
+  }
+
+  *record = NULL;
+  *length = 0;
+  return SA_OK;
+}
+
+unsigned long long sa_log_reader_offset(const SALogReader* reader, const char* record) {
+  return reader->data_offset + (unsigned long long)(record - reader->data);
+}
+
+void sa_log_reader_close(SALogReader* reader) {
+  if (NULL == reader) {
+    return;
+  }
+#if defined(USE_POSIX)
+  if (NULL != reader->mapping) {
+    munmap(reader->mapping, (size_t)reader->mapping_length);
+  }
+#else
+  SA_RELEASE(reader->data, reader->mapping_length);
+#endif
+  SA_RELEASE(reader, sizeof(SALogReader));
+}
+
+// 事件解析 ---------------------------------------------------------------------
+
+// 只支持 SDK 输出的 JSON 子集: 顶层的信封字段、lib 与 properties 两个字典，
+// 字典中的值为字符串、数字、布尔值或字符串数组.
+typedef struct {
+  char* cur;
+  char* end;
+} SAEventParser;
+
+static void _sa_parser_skip_ws(SAEventParser* parser) {
+  while (parser->cur < parser->end
+         && (' ' == *parser->cur || '\t' == *parser->cur || '\r' == *parser->cur || '\n' == *parser->cur)) {
+    ++parser->cur;
+  }
+}
+
+static int _sa_parser_expect(SAEventParser* parser, char c) {
+  _sa_parser_skip_ws(parser);
+  if (parser->cur < parser->end && c == *parser->cur) {
+    ++parser->cur;
+    return 1;
+  }
+  return 0;
+}
+
+// 返回 [p, end) 中第一个 '"' 或 '\\' 的位置，没有时返回 end.
+static char* _sa_find_quote(char* p, char* end) {
+#if defined(SA_HAS_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+    if (0 != mask) {
+      return p + _sa_ctz((unsigned int)mask);
+    }
+  }
+#endif
+  while (p < end && '"' != *p && '\\' != *p) {
+    ++p;
+  }
+  return p;
+}
+
+static int _sa_parse_hex4(const char* p, const char* end, unsigned int* code) {
+  int i;
+  if (end - p < 4) {
+    return 0;
+  }
+  *code = 0;
+  for (i = 0; i < 4; ++i) {
+    char c = p[i];
+    *code <<= 4;
+    if (c >= '0' && c <= '9') {
+      *code |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      *code |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      *code |= c - 'A' + 10;
+    } else {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// 将 code 以 UTF-8 编码写入 out，返回写入的字节数.
+static int _sa_put_utf8(char* out, unsigned int code) {
+  if (code < 0x80) {
+    out[0] = (char)code;
+    return 1;
+  } else if (code < 0x800) {
+    out[0] = (char)(0xC0 | (code >> 6));
+    out[1] = (char)(0x80 | (code & 0x3F));
+    return 2;
+  } else if (code < 0x10000) {
+    out[0] = (char)(0xE0 | (code >> 12));
+    out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (code & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (code >> 18));
+  out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (code & 0x3F));
+  return 4;
+}
+
+// 解析 JSON 字符串. 转义序列原地还原（还原后不会变长），并将结尾的引号改为 \0，
+// 返回字符串在输入缓冲区中的开始位置，格式错误时返回 NULL.
+static char* _sa_parse_string(SAEventParser* parser, unsigned long* length) {
+  if (!_sa_parser_expect(parser, '"')) {
+    return NULL;
+  }
+  char* start = parser->cur;
+  char* out = start;
+  char* in = start;
+  for (;;) {
+    char* next = _sa_find_quote(in, parser->end);
+    if (next >= parser->end) {
+      return NULL;
+    }
+    if (out != in) {
+      memmove(out, in, next - in);
+    }
+    out += next - in;
+    in = next + 1;
+    if ('"' == *next) {
+      break;
+    }
+
+    // 转义序列.
+    if (in >= parser->end) {
+      return NULL;
+    }
+    unsigned int code;
+    switch (*in++) {
+    case '"': *out++ = '"'; break;
+    case '\\': *out++ = '\\'; break;
+    case '/': *out++ = '/'; break;
+    case 'b': *out++ = '\b'; break;
+    case 'f': *out++ = '\f'; break;
+    case 'n': *out++ = '\n'; break;
+    case 'r': *out++ = '\r'; break;
+    case 't': *out++ = '\t'; break;
+    case 'u':
+      if (!_sa_parse_hex4(in, parser->end, &code)) {
+        return NULL;
+      }
+      in += 4;
+      if (code >= 0xD800 && code <= 0xDBFF) {
+        // UTF-16 代理对.
+        unsigned int low;
+        if (parser->end - in < 6 || '\\' != in[0] || 'u' != in[1]
+            || !_sa_parse_hex4(in + 2, parser->end, &low) || low < 0xDC00 || low > 0xDFFF) {
+          return NULL;
+        }
+        in += 6;
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+      }
+      out += _sa_put_utf8(out, code);
+      break;
+    default:
+      return NULL;
+    }
+  }
+  *out = 0;
+  *length = (unsigned long)(out - start);
+  parser->cur = in;
+  return start;
+}
+
+// 同一线程最近一次转换的日期所在的分钟，同一分钟内的日期不再调用 mktime.
+static SA_THREAD_LOCAL char _sa_date_minute[16];
+static SA_THREAD_LOCAL time_t _sa_date_minute_seconds = 0;
+
+// 识别 _sa_dump_node 输出的 "yyyy-MM-dd HH:mm:ss.SSS" 格式的日期，SSS 为 microseconds 字段.
+static int _sa_parse_date(const char* s, unsigned long length, time_t* seconds, int* microseconds) {
+  static const char kPattern[] = "0000-00-00 00:00:00.000";
+  unsigned long i;
+  if (length != sizeof(kPattern) - 1) {
+    return 0;
+  }
+  for (i = 0; i < length; ++i) {
+    if ('0' == kPattern[i] ? (s[i] < '0' || s[i] > '9') : s[i] != kPattern[i]) {
+      return 0;
     }
   }
-  if (_sa_is_track(type) &&
-      (NULL == event
-#if defined(USE_POSIX)
-    || SA_OK != _sa_assert_key_name(event, sa->regex))) {
-#elif defined(_WIN32)
-    || SA_OK != _sa_assert_key_name(event, sa->regex))) {
-#else
-    || SA_OK != _sa_assert_key_name(event))) {
-#endif
-    fprintf(stderr, "Invalid event name [%s].\n", event == NULL ? "NULL" : event);
-    return SA_INVALID_PARAMETER_ERROR;
+
+#define SA_DIGITS2(p) (((p)[0] - '0') * 10 + ((p)[1] - '0'))
+  if (0 != memcmp(_sa_date_minute, s, 16)) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = SA_DIGITS2(s) * 100 + SA_DIGITS2(s + 2) - 1900;
+    tm.tm_mon = SA_DIGITS2(s + 5) - 1;
+    tm.tm_mday = SA_DIGITS2(s + 8);
+    tm.tm_hour = SA_DIGITS2(s + 11);
+    tm.tm_min = SA_DIGITS2(s + 14);
+    tm.tm_isdst = -1;
+    _sa_date_minute_seconds = mktime(&tm);
+    memcpy(_sa_date_minute, s, 16);
+  }
+  *seconds = _sa_date_minute_seconds + SA_DIGITS2(s + 17);
+  *microseconds = (s[20] - '0') * 100 + SA_DIGITS2(s + 21);
+#undef SA_DIGITS2
+  return 1;
+}
+
+// 创建 key 和字符串值引用输入缓冲区的节点.
+static struct SANode* _sa_malloc_borrowed_node(enum SANodeTag tag, char* key) {
+  struct SANode* node = (struct SANode*)SA_ALLOC(sizeof(SANode));
+  memset(node, 0, sizeof(struct SANode));
+  node->ref_count = 1;
+  node->borrowed = SA_TRUE;
+  node->tag = tag;
+  node->key = key;
+  return node;
+}
+
+// 将 child 链接到 *link 之前，转移 child 的引用.
+static void _sa_link_child(struct SANode* child, struct SAListNode** link) {
+  struct SAListNode* element = (struct SAListNode*)SA_ALLOC(sizeof(struct SAListNode));
+  element->value = child;
+  element->next = *link;
+  *link = element;
+}
+
+static struct SANode* _sa_parse_number(SAEventParser* parser, char* key) {
+  char* start = parser->cur;
+  int is_int = 1;
+  while (parser->cur < parser->end) {
+    char c = *parser->cur;
+    if ('.' == c || 'e' == c || 'E' == c || '+' == c) {
+      is_int = 0;
+    } else if ('-' != c && (c < '0' || c > '9')) {
+      break;
+    }
+    ++parser->cur;
+  }
+  unsigned long length = (unsigned long)(parser->cur - start);
+  if (0 == length) {
+    return NULL;
+  }
+
+  if (is_int) {
+    // 超出 long long 范围时按浮点数解析.
+    const char* p = start + ('-' == *start ? 1 : 0);
+    unsigned long long value = 0;
+    for (; p < parser->cur && value <= (unsigned long long)LLONG_MAX / 10; ++p) {
+      if (*p < '0' || *p > '9') {
+        return NULL;
+      }
+      value = value * 10 + (*p - '0');
+    }
+    if (p == parser->cur && value <= (unsigned long long)LLONG_MAX && p > start + ('-' == *start ? 1 : 0)) {
+      struct SANode* node = _sa_malloc_borrowed_node(SA_INT, key);
+      node->int_ = '-' == *start ? -(long long)value : (long long)value;
+      return node;
+    }
+  }
+
+  char buf[64];
+  char* end = NULL;
+  if (length >= sizeof(buf)) {
+    return NULL;
+  }
+  memcpy(buf, start, length);
+  buf[length] = 0;
+  double number = strtod(buf, &end);
+  if (end != buf + length) {
+    return NULL;
+  }
+  struct SANode* node = _sa_malloc_borrowed_node(SA_NUMBER, key);
+  node->number_ = number;
+  return node;
+}
+
+// 解析字典中的一个值.
+static struct SANode* _sa_parse_value(SAEventParser* parser, char* key) {
+  _sa_parser_skip_ws(parser);
+  if (parser->cur >= parser->end) {
+    return NULL;
+  }
+
+  struct SANode* node = NULL;
+  unsigned long length = 0;
+  char* string_;
+  switch (*parser->cur) {
+  case '"': {
+    if (NULL == (string_ = _sa_parse_string(parser, &length))) {
+      return NULL;
+    }
+    time_t seconds;
+    int microseconds;
+    if (_sa_parse_date(string_, length, &seconds, &microseconds)) {
+      node = _sa_malloc_borrowed_node(SA_DATE, key);
+      node->date_.seconds = seconds;
+      node->date_.microseconds = microseconds;
+    } else {
+      node = _sa_malloc_borrowed_node(SA_STRING, key);
+      node->string_ = string_;
+    }
+    return node;
+  }
+  case '[': {
+    ++parser->cur;
+    node = _sa_malloc_borrowed_node(SA_LIST, key);
+    if (_sa_parser_expect(parser, ']')) {
+      return node;
+    }
+    // 元素按原顺序排列，再次序列化时顺序不变.
+    struct SAListNode** tail = &node->array_;
+    do {
+      if (NULL == (string_ = _sa_parse_string(parser, &length))) {
+        _sa_free_node(node);
+        return NULL;
+      }
+      struct SANode* item = _sa_malloc_borrowed_node(SA_STRING, NULL);
+      item->string_ = string_;
+      _sa_link_child(item, tail);
+      tail = &(*tail)->next;
+    } while (_sa_parser_expect(parser, ','));
+    if (!_sa_parser_expect(parser, ']')) {
+      _sa_free_node(node);
+      return NULL;
+    }
+    return node;
+  }
+  case 't':
+  case 'f': {
+    int bool_ = ('t' == *parser->cur);
+    length = bool_ ? 4 : 5;
+    if ((unsigned long)(parser->end - parser->cur) < length
+        || 0 != memcmp(parser->cur, bool_ ? "true" : "false", length)) {
+      return NULL;
+    }
+    parser->cur += length;
+    node = _sa_malloc_borrowed_node(SA_BOOL, key);
+    node->bool_ = bool_;
+    return node;
+  }
+  default:
+    return _sa_parse_number(parser, key);
+  }
+}
+
+// 解析字典，节点按出现的相反顺序链接，与按出现顺序调用 sa_add_* 得到的 SAProperties 相同，
+// 因此再次跟踪时属性的顺序不变. 不检查重复的属性名.
+static int _sa_parse_dict(SAEventParser* parser, SAProperties* dict) {
+  if (!_sa_parser_expect(parser, '{')) {
+    return 0;
+  }
+  if (_sa_parser_expect(parser, '}')) {
+    return 1;
+  }
+  do {
+    unsigned long length = 0;
+    char* key = _sa_parse_string(parser, &length);
+    if (NULL == key || !_sa_parser_expect(parser, ':')) {
+      return 0;
+    }
+    struct SANode* node = _sa_parse_value(parser, key);
+    if (NULL == node) {
+      return 0;
+    }
+    _sa_link_child(node, &dict->array_);
+  } while (_sa_parser_expect(parser, ','));
+  return _sa_parser_expect(parser, '}');
+}
+
+static int _sa_parse_envelope(SAEventParser* parser, SAParsedEvent* event) {
+  if (!_sa_parser_expect(parser, '{')) {
+    return 0;
+  }
+  do {
+    unsigned long length = 0;
+    char* key = _sa_parse_string(parser, &length);
+    if (NULL == key || !_sa_parser_expect(parser, ':')) {
+      return 0;
+    }
+
+    const char** field = NULL;
+    if (0 == strcmp(key, "properties")) {
+      if (!_sa_parse_dict(parser, event->properties)) {
+        return 0;
+      }
+    } else if (0 == strcmp(key, "lib")) {
+      if (NULL == event->lib) {
+        event->lib = sa_init_properties();
+      }
+      if (!_sa_parse_dict(parser, event->lib)) {
+        return 0;
+      }
+    } else if (0 == strcmp(key, "time")) {
+      struct SANode* node = _sa_parse_number(parser, NULL);
+      if (NULL == node) {
+        return 0;
+      }
+      event->time = SA_INT == node->tag ? node->int_ : (long long)node->number_;
+      _sa_free_node(node);
+    } else if (0 == strcmp(key, "type")) {
+      field = &event->type;
+    } else if (0 == strcmp(key, "distinct_id")) {
+      field = &event->distinct_id;
+    } else if (0 == strcmp(key, "original_id")) {
+      field = &event->original_id;
+    } else if (0 == strcmp(key, "event")) {
+      field = &event->event;
+    } else if (0 == strcmp(key, "project")) {
+      field = &event->project;
+    } else {
+      return 0;
+    }
+    if (NULL != field && NULL == (*field = _sa_parse_string(parser, &length))) {
+      return 0;
+    }
+  } while (_sa_parser_expect(parser, ','));
+
+  if (!_sa_parser_expect(parser, '}')) {
+    return 0;
+  }
+  _sa_parser_skip_ws(parser);
+  return parser->cur == parser->end && NULL != event->type && NULL != event->distinct_id;
+}
+
+int sa_parse_event(char* line, unsigned long length, SAParsedEvent* event) {
+  if (NULL == line || NULL == event) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  memset(event, 0, sizeof(SAParsedEvent));
+  event->properties = sa_init_properties();
+
+  SAEventParser parser;
+  parser.cur = line;
+  parser.end = line + length;
+  if (!_sa_parse_envelope(&parser, event)) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Invalid event at offset %lu.",
+                  (unsigned long)(parser.cur - line));
+    sa_free_parsed_event(event);
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  return SA_OK;
+}
+
+void sa_free_parsed_event(SAParsedEvent* event) {
+  if (NULL == event) {
+    return;
+  }
+  if (NULL != event->lib) {
+    sa_free_properties(event->lib);
+  }
+  if (NULL != event->properties) {
+    sa_free_properties(event->properties);
+  }
+  memset(event, 0, sizeof(SAParsedEvent));
+}
+
+// 统计 -------------------------------------------------------------------------
+
+// 耗时直方图各个桶的上界（纳秒），之后还有一个 +Inf 桶.
+static const long long _sa_latency_bounds_ns[] = {
+  1000, 5000, 10000, 50000, 100000, 500000,
+  1000000, 5000000, 10000000, 50000000, 100000000, 500000000, 1000000000
+};
+#define SA_LATENCY_BUCKETS (sizeof(_sa_latency_bounds_ns) / sizeof(_sa_latency_bounds_ns[0]) + 1)
+
+typedef struct {
+  // 各个桶中的样本数，不累加.
+  volatile long long buckets[SA_LATENCY_BUCKETS];
+  volatile long long count;
+  volatile long long sum_ns;
+} SAHistogram;
+
+static void _sa_histogram_observe(SAHistogram* histogram, long long ns) {
+  unsigned long i = 0;
+  while (i + 1 < SA_LATENCY_BUCKETS && ns > _sa_latency_bounds_ns[i]) {
+    ++i;
+  }
+  SA_ATOMIC_ADD64(&histogram->buckets[i], 1);
+  SA_ATOMIC_ADD64(&histogram->count, 1);
+  SA_ATOMIC_ADD64(&histogram->sum_ns, ns);
+}
+
+// 以 Prometheus 文本格式输出一个 counter 或 gauge.
+static void _sa_write_metric(
+  FILE* out, const char* name, const char* type, const char* help, long long value) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", name, help, name, type, name, value);
+}
+
+// 以 Prometheus 文本格式输出耗时直方图，单位为秒.
+static void _sa_write_histogram(
+  FILE* out, const char* name, const char* help, const SAHistogram* histogram) {
+  long long cumulative = 0;
+  unsigned long i;
+  fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (i = 0; i < SA_LATENCY_BUCKETS; ++i) {
+    cumulative += SA_ATOMIC_LOAD64(&histogram->buckets[i]);
+    if (i + 1 < SA_LATENCY_BUCKETS) {
+      fprintf(out, "%s_bucket{le=\"%g\"} %lld\n", name, _sa_latency_bounds_ns[i] / 1e9, cumulative);
+    } else {
+      fprintf(out, "%s_bucket{le=\"+Inf\"} %lld\n", name, cumulative);
+    }
+  }
+  fprintf(out, "%s_sum %.9f\n", name, SA_ATOMIC_LOAD64(&histogram->sum_ns) / 1e9);
+  fprintf(out, "%s_count %lld\n", name, SA_ATOMIC_LOAD64(&histogram->count));
+}
+
+// Async Consumer -------------------------------------------------------------
+
+#if defined(SA_HAS_THREADS)
+
+// 队列中元素的类型: 事件、flush 标记，以及在写线程中预热下游 Consumer 的标记.
+typedef enum {
+  SA_ASYNC_EVENT,
+  SA_ASYNC_FLUSH,
+  SA_ASYNC_RESERVE
+} SAAsyncItemKind;
+
+// 队列中的元素.
+typedef struct SAAsyncItem {
+  struct SAAsyncItem* next;
+  // 标记完成时的回调，事件为 NULL.
+  sa_completion_callback callback;
+  void* user_data;
+  SAAsyncItemKind kind;
+  unsigned long length;
+  char data[];
+} SAAsyncItem;
+
+// 等待队列出现空位的回调.
+typedef struct SAAsyncWaiter {
+  struct SAAsyncWaiter* next;
+  sa_completion_callback callback;
+  void* user_data;
+} SAAsyncWaiter;
+
+typedef struct {
+  struct SAConsumer* consumer;
+  SABackpressure backpressure;
+
+  SAMutex mutex;
+  SACond not_empty;
+  SACond not_full;
+
+  SAAsyncItem* head;
+  SAAsyncItem* tail;
+  // 队列中的事件数，不包括 flush 标记.
+  unsigned long size;
+  unsigned long capacity;
+  SAAsyncWaiter* waiters;
+
+  int stop;
+  SAThread thread;
+
+  // 写线程调用下游 Consumer 发送事件的耗时及失败次数.
+  SAHistogram send_latency;
+  volatile long long send_errors;
+} SAAsyncConsumerInter;
+
+static int _sa_consumer_reserve(struct SAConsumer* consumer);
+
+// 当前线程是否为某个 AsyncConsumer 的写线程. 写线程中执行的回调再次写入事件时不阻塞，避免死锁.
+static SA_THREAD_LOCAL SAAsyncConsumerInter* _sa_async_writer = NULL;
+
+static void _sa_async_push(SAAsyncConsumerInter* inter, SAAsyncItem* item) {
+  item->next = NULL;
+  if (NULL == inter->tail) {
+    inter->head = item;
+  } else {
+    inter->tail->next = item;
+  }
+  inter->tail = item;
+  SA_COND_SIGNAL(&inter->not_empty);
+}
+
+// 调用并释放所有等待空位的回调，调用时不持有锁.
+static void _sa_async_notify_waiters(SAAsyncWaiter* waiters, int result) {
+  while (NULL != waiters) {
+    SAAsyncWaiter* next = waiters->next;
+    waiters->callback(result, waiters->user_data);
+    SA_RELEASE(waiters, sizeof(SAAsyncWaiter));
+    waiters = next;
+  }
+}
+
+static SA_THREAD_PROC(_sa_async_consumer_run, arg) {
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)arg;
+  _sa_async_writer = inter;
+
+  SA_MUTEX_LOCK(&inter->mutex);
+  for (;;) {
+    while (NULL == inter->head && !inter->stop) {
+      SA_COND_WAIT(&inter->not_empty, &inter->mutex);
+    }
+    SAAsyncItem* item = inter->head;
+    if (NULL == item) {
+      break;
+    }
+    inter->head = item->next;
+    if (NULL == inter->head) {
+      inter->tail = NULL;
+    }
+
+    SAAsyncWaiter* waiters = NULL;
+    if (SA_ASYNC_EVENT == item->kind) {
+      --inter->size;
+      SA_COND_BROADCAST(&inter->not_full);
+      waiters = inter->waiters;
+      inter->waiters = NULL;
+    }
+    SA_MUTEX_UNLOCK(&inter->mutex);
+
+    _sa_async_notify_waiters(waiters, SA_OK);
+    if (SA_ASYNC_EVENT != item->kind) {
+      int res = SA_ASYNC_FLUSH == item->kind
+        ? inter->consumer->op.flush(inter->consumer->this_)
+        : _sa_consumer_reserve(inter->consumer);
+      if (NULL != item->callback) {
+        item->callback(res, item->user_data);
+      }
+    } else {
+      unsigned long long start = _sa_monotonic_ns();
+      if (SA_OK != inter->consumer->op.send(inter->consumer->this_, item->data, item->length)) {
+        SA_ATOMIC_ADD64(&inter->send_errors, 1);
+      }
+      _sa_histogram_observe(&inter->send_latency, (long long)(_sa_monotonic_ns() - start));
+    }
+    SA_RELEASE(item, sizeof(SAAsyncItem) + item->length);
+
+    SA_MUTEX_LOCK(&inter->mutex);
+  }
+  SA_MUTEX_UNLOCK(&inter->mutex);
+
+  SA_THREAD_RETURN;
+}
+
+// 将事件放入队列. nonblocking 为 SA_TRUE 时，队列已满则直接返回 SA_QUEUE_FULL_ERROR.
+static int _sa_async_consumer_enqueue(
+  SAAsyncConsumerInter* inter, const char* event, unsigned long length, SABool nonblocking) {
+  SAAsyncItem* item = (SAAsyncItem*)SA_ALLOC(sizeof(SAAsyncItem) + length);
+  memcpy(item->data, event, length);
+  item->length = length;
+  item->kind = SA_ASYNC_EVENT;
+  item->callback = NULL;
+  item->user_data = NULL;
+
+  SA_MUTEX_LOCK(&inter->mutex);
+  while (inter->size >= inter->capacity && _sa_async_writer != inter && !inter->stop) {
+    if (nonblocking || SA_BACKPRESSURE_DROP == inter->backpressure) {
+      SA_MUTEX_UNLOCK(&inter->mutex);
+      SA_RELEASE(item, sizeof(SAAsyncItem) + length);
+      return SA_QUEUE_FULL_ERROR;
+    }
+    SA_COND_WAIT(&inter->not_full, &inter->mutex);
+  }
+  if (inter->stop) {
+    SA_MUTEX_UNLOCK(&inter->mutex);
+    SA_RELEASE(item, sizeof(SAAsyncItem) + length);
+    return SA_IO_ERROR;
+  }
+  ++inter->size;
+  _sa_async_push(inter, item);
+  SA_MUTEX_UNLOCK(&inter->mutex);
+
+  return SA_OK;
+}
+
+static int _sa_async_consumer_send(void* this_, const char* event, unsigned long length) {
+  if (NULL == this_ || NULL == event) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  return _sa_async_consumer_enqueue((SAAsyncConsumerInter*)this_, event, length, SA_FALSE);
+}
+
+// 在队列中放入标记，写线程处理到 flush 标记时 flush 下游 Consumer，处理到预热标记时预热下游
+// Consumer，之后调用 callback.
+static int _sa_async_consumer_mark(
+  SAAsyncConsumerInter* inter, SAAsyncItemKind kind, sa_completion_callback callback, void* user_data) {
+  SAAsyncItem* item = (SAAsyncItem*)SA_ALLOC(sizeof(SAAsyncItem));
+  item->length = 0;
+  item->kind = kind;
+  item->callback = callback;
+  item->user_data = user_data;
+
+  SA_MUTEX_LOCK(&inter->mutex);
+  if (inter->stop) {
+    SA_MUTEX_UNLOCK(&inter->mutex);
+    SA_RELEASE(item, sizeof(SAAsyncItem));
+    return SA_IO_ERROR;
+  }
+  _sa_async_push(inter, item);
+  SA_MUTEX_UNLOCK(&inter->mutex);
+
+  return SA_OK;
+}
+
+typedef struct {
+  SAAsyncConsumerInter* inter;
+  int done;
+  int result;
+  SACond cond;
+} SAAsyncFlushWait;
+
+static void _sa_async_flush_done(int result, void* user_data) {
+  SAAsyncFlushWait* wait = (SAAsyncFlushWait*)user_data;
+  SA_MUTEX_LOCK(&wait->inter->mutex);
+  wait->done = 1;
+  wait->result = result;
+  SA_COND_SIGNAL(&wait->cond);
+  SA_MUTEX_UNLOCK(&wait->inter->mutex);
+}
+
+// 放入标记并等待写线程处理完成.
+static int _sa_async_consumer_wait(SAAsyncConsumerInter* inter, SAAsyncItemKind kind) {
+  SAAsyncFlushWait wait;
+  wait.inter = inter;
+  wait.done = 0;
+  wait.result = SA_OK;
+  SA_COND_INIT(&wait.cond);
+
+  int res = _sa_async_consumer_mark(inter, kind, &_sa_async_flush_done, &wait);
+  if (SA_OK == res) {
+    SA_MUTEX_LOCK(&inter->mutex);
+    while (!wait.done) {
+      SA_COND_WAIT(&wait.cond, &inter->mutex);
+    }
+    SA_MUTEX_UNLOCK(&inter->mutex);
+    res = wait.result;
+  }
+
+  SA_COND_DESTROY(&wait.cond);
+  return res;
+}
+
+static int _sa_async_consumer_flush(void* this_) {
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)this_;
+
+  if (_sa_async_writer == inter) {
+    // 在写线程的回调中无法等待自身，只 flush 下游 Consumer.
+    return inter->consumer->op.flush(inter->consumer->this_);
+  }
+  return _sa_async_consumer_wait(inter, SA_ASYNC_FLUSH);
+}
+
+static int _sa_async_consumer_close(void* this_) {
+  if (NULL == this_) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)this_;
+
+  // 写线程处理完队列中剩余的数据后退出.
+  SA_MUTEX_LOCK(&inter->mutex);
+  inter->stop = 1;
+  SA_COND_SIGNAL(&inter->not_empty);
+  SA_COND_BROADCAST(&inter->not_full);
+  SA_MUTEX_UNLOCK(&inter->mutex);
+  SA_THREAD_JOIN(inter->thread);
+
+  _sa_async_notify_waiters(inter->waiters, SA_IO_ERROR);
+  inter->waiters = NULL;
+
+  int res = inter->consumer->op.close(inter->consumer->this_);
+  free(inter->consumer->this_);
+  free(inter->consumer);
+  inter->consumer = NULL;
+
+  SA_COND_DESTROY(&inter->not_empty);
+  SA_COND_DESTROY(&inter->not_full);
+  SA_MUTEX_DESTROY(&inter->mutex);
+
+  return res;
+}
+
+#endif  // SA_HAS_THREADS
+
+int sa_init_async_consumer(
+    struct SAConsumer* consumer,
+    unsigned int queue_size,
+    SABackpressure backpressure,
+    SAAsyncConsumer** async_consumer) {
+#if defined(SA_HAS_THREADS)
+  if (NULL == consumer || NULL == async_consumer || 0 == queue_size) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Invalid parameter for async consumer.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)SA_SAFE_MALLOC(sizeof(SAAsyncConsumerInter));
+  memset(inter, 0, sizeof(SAAsyncConsumerInter));
+  inter->consumer = consumer;
+  inter->backpressure = backpressure;
+  inter->capacity = queue_size;
+
+  SA_MUTEX_INIT(&inter->mutex);
+  SA_COND_INIT(&inter->not_empty);
+  SA_COND_INIT(&inter->not_full);
+
+  if (!SA_THREAD_CREATE(&inter->thread, &_sa_async_consumer_run, inter)) {
+    _sa_log_error(SA_ERROR_SYSTEM, "Create thread error.");
+    SA_COND_DESTROY(&inter->not_empty);
+    SA_COND_DESTROY(&inter->not_full);
+    SA_MUTEX_DESTROY(&inter->mutex);
+    free(inter);
+    return SA_MALLOC_ERROR;
+  }
+
+  *async_consumer = (SAAsyncConsumer*)SA_SAFE_MALLOC(sizeof(SAAsyncConsumer));
+
+  (*async_consumer)->this_ = (void*)inter;
+  (*async_consumer)->op.send = &_sa_async_consumer_send;
+  (*async_consumer)->op.flush = &_sa_async_consumer_flush;
+  (*async_consumer)->op.close = &_sa_async_consumer_close;
+
+  return SA_OK;
+#else
+  (void)consumer;
+  (void)queue_size;
+  (void)backpressure;
+  (void)async_consumer;
+  _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Async consumer requires thread support.");
+  return SA_INVALID_PARAMETER_ERROR;
+#endif
+}
+
+// 返回 AsyncConsumer 的内部数据，其他 Consumer 返回 NULL.
+static void* _sa_get_async_consumer(const struct SAConsumer* consumer) {
+#if defined(SA_HAS_THREADS)
+  if (NULL != consumer && consumer->op.send == &_sa_async_consumer_send) {
+    return consumer->this_;
+  }
+#else
+  (void)consumer;
+#endif
+  return NULL;
+}
+
+// 预热 SDK 内置的 Consumer: LoggingConsumer 打开当日的日志文件，AsyncConsumer 在写线程中预热
+// 下游 Consumer. 其他 Consumer 不需要预热.
+static int _sa_consumer_reserve(struct SAConsumer* consumer) {
+  if (NULL == consumer) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (consumer->op.send == &_sa_logging_consumer_send) {
+    return _sa_logging_consumer_open((SALoggingConsumerInter*)consumer->this_);
+  }
+#if defined(SA_HAS_THREADS)
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)_sa_get_async_consumer(consumer);
+  if (NULL != inter && _sa_async_writer != inter) {
+    return _sa_async_consumer_wait(inter, SA_ASYNC_RESERVE);
+  }
+#endif
+  return SA_OK;
+}
+
+// 采样性能分析 ----------------------------------------------------------------
+
+// 各阶段的计时点: 开始、检查完成、合并属性完成、序列化完成、发送完成.
+enum {
+  SA_PROFILE_START,
+  SA_PROFILE_VALIDATE,
+  SA_PROFILE_MERGE,
+  SA_PROFILE_SERIALIZE,
+  SA_PROFILE_SEND,
+  SA_PROFILE_STAMPS
+};
+
+#define SA_PROFILE_RING_SIZE 1024
+
+typedef struct {
+  unsigned long long stamps[SA_PROFILE_STAMPS];
+} SAProfileSample;
+
+typedef struct {
+  // 写入第 n 条样本时先置为 0，写完后置为 n + 1，读取方据此丢弃写入中的样本.
+  volatile long seq;
+  SAProfileSample sample;
+} SAProfileEntry;
+
+// 每个线程一个环形缓冲区，只有所属线程写入，写入时不加锁.
+typedef struct SAProfileRing {
+  struct SAProfileRing* next;
+  // 所属线程，取该线程 _sa_profile_slots 的地址.
+  const void* thread;
+  // 已写入的样本总数.
+  volatile long head;
+  SAProfileEntry entries[SA_PROFILE_RING_SIZE];
+} SAProfileRing;
+
+// 读取时间戳计数器，不支持的平台上使用单调时钟的纳秒数.
+static unsigned long long _sa_cycles() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  return __rdtsc();
+#elif defined(_WIN32)
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (unsigned long long)counter.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+// SensorsAnalytics 实例的统计数据，均为进程启动以来的累计值.
+typedef struct {
+  // 成功交给 Consumer 的事件数及字节数.
+  volatile long long events;
+  volatile long long bytes;
+  // 未通过合法性检查的事件数.
+  volatile long long invalid;
+  // AsyncConsumer 队列已满而丢弃的事件数.
+  volatile long long dropped;
+  // Consumer 发送失败的事件数.
+  volatile long long send_errors;
+  // 开启去重后未发送的重复 track_signup 事件数.
+  volatile long long signups_suppressed;
+  // profile_set_once 属性在已发送缓存中命中与未命中的次数，以及属性全部命中而不再发送的事件数.
+  volatile long long set_once_hits;
+  volatile long long set_once_misses;
+  volatile long long set_once_dropped;
+  // 同步 Consumer 发送事件的耗时.
+  SAHistogram send_latency;
+} SAStats;
+
+// Sensors Analytics ----------------------------------------------------------
+typedef struct SensorsAnalytics {
+  // 存储事件公共属性.
+  SAProperties* super_properties;
+#if defined(USE_POSIX)
+  // Mutex
+  pthread_mutex_t mutex;
+#elif defined(_WIN32)
+  CRITICAL_SECTION mutex;
+#endif
+  struct SAConsumer* consumer;
+  // 批量跟踪时序列化事件的线程池，为 NULL 时在调用线程中序列化.
+  struct SASerializePool* serialize_pool;
+  // 非 0 时按固定的顺序输出事件. canonical_keys 为调用方属性的优先顺序，按属性名排序以便查找.
+  long canonical;
+  struct SACanonicalKey* canonical_keys;
+  unsigned long canonical_key_count;
+  // track_signup 去重，为 NULL 表示未开启.
+  struct SASignupDedup* signup_dedup;
+  // 已发送的 profile_set_once 属性，为 NULL 表示未开启.
+  struct SASetOnceCache* set_once_cache;
+  // 预计单个事件序列化后的字节数，用作序列化缓冲区的初始容量，0 表示使用默认值.
+  volatile long event_bytes;
+  // 分段序列化的分段大小，0 表示不分段.
+  unsigned long stream_chunk;
+  struct SAConsumerStreamOp stream_op;
+  // 采样间隔，0 表示不采样.
+  volatile long profile_interval;
+  // 实例的唯一编号，用于判断线程私有的采样缓冲区、作用域属于哪个实例.
+  long id;
+  // 各线程的样本，链表头由 mutex 保护. 新的缓冲区只加在头部，sa_free 之前不会移除.
+  SAProfileRing* profile_rings;
+  // sa_reserve 预先分配、尚未被线程使用的缓冲区，由 mutex 保护.
+  SAProfileRing* profile_spare;
+  // 开启采样时的时间，用于换算计时单位.
+  unsigned long long profile_start_cycles;
+  unsigned long long profile_start_ns;
+  // 统计数据.
+  SAStats stats;
+  // 定期输出统计数据的线程，为 NULL 表示未开启.
+  struct SAStatsExporter* exporter;
+} SensorsAnalytics;
+
+static void _sa_serialize_pool_free(struct SASerializePool* pool);
+static void _sa_stats_exporter_stop(SensorsAnalytics* sa);
+static unsigned long long _sa_signup_dedup_bytes(struct SASignupDedup* dedup);
+static unsigned long long _sa_set_once_entries(struct SASetOnceCache* cache);
+static void _sa_scope_drain(const SensorsAnalytics* sa);
+static void _sa_serialize_pool_reserve(const SAProperties* properties, SensorsAnalytics* sa);
+
+// 上一个 SensorsAnalytics 实例的编号.
+static volatile long _sa_next_instance_id = 0;
+
+// 当前线程在某个实例上的采样倒计数及环形缓冲区.
+typedef struct {
+  long owner;
+  unsigned long countdown;
+  SAProfileRing* ring;
+} SAProfileSlot;
+
+// 每个线程按实例编号缓存最近使用的几个实例，第 0 项为最近一次使用的实例.
+#define SA_PROFILE_THREAD_SLOTS 4
+static SA_THREAD_LOCAL SAProfileSlot _sa_profile_slots[SA_PROFILE_THREAD_SLOTS];
+
+// 查找当前线程在 sa 上的采样状态并移到第 0 项，没有时替换最久未使用的一项.
+static SAProfileSlot* _sa_profile_slot(SensorsAnalytics* sa) {
+  if (_sa_profile_slots[0].owner == sa->id) {
+    return _sa_profile_slots;
+  }
+  SAProfileSlot slot = {sa->id, 0, NULL};
+  int i;
+  for (i = 1; i < SA_PROFILE_THREAD_SLOTS; ++i) {
+    if (_sa_profile_slots[i].owner == sa->id) {
+      break;
+    }
+  }
+  if (i < SA_PROFILE_THREAD_SLOTS) {
+    slot = _sa_profile_slots[i];
+  } else {
+    i = SA_PROFILE_THREAD_SLOTS - 1;
+  }
+  for (; i > 0; --i) {
+    _sa_profile_slots[i] = _sa_profile_slots[i - 1];
+  }
+  _sa_profile_slots[0] = slot;
+  return _sa_profile_slots;
+}
+
+int sa_set_profiling(unsigned long sample_interval, SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (0 == sa->profile_start_ns) {
+    sa->profile_start_cycles = _sa_cycles();
+    sa->profile_start_ns = _sa_monotonic_ns();
+  }
+  SA_ATOMIC_STORE(&sa->profile_interval, (long)sample_interval);
+  return SA_OK;
+}
+
+// 是否对本次调用采样，calls 为本次调用跟踪的事件数. 未开启时只有一次读取和比较.
+static SAProfileSample* _sa_profile_begin(SensorsAnalytics* sa, unsigned long calls, SAProfileSample* sample) {
+  long interval = SA_ATOMIC_LOAD(&sa->profile_interval);
+  if (0 == interval) {
+    return NULL;
+  }
+  SAProfileSlot* slot = _sa_profile_slot(sa);
+  if (slot->countdown > calls) {
+    slot->countdown -= calls;
+    return NULL;
+  }
+  slot->countdown = (unsigned long)interval;
+  sample->stamps[SA_PROFILE_START] = _sa_cycles();
+  return sample;
+}
+
+#define SA_PROFILE_STAMP(sample, stage) do { \
+  if (NULL != (sample)) { \
+    (sample)->stamps[stage] = _sa_cycles(); \
+  } \
+} while (0)
+
+// 将样本写入当前线程的环形缓冲区.
+static void _sa_profile_commit(SensorsAnalytics* sa, const SAProfileSample* sample) {
+  if (NULL == sample) {
+    return;
+  }
+
+  SAProfileSlot* slot = _sa_profile_slot(sa);
+  if (NULL == slot->ring) {
+    // 先找回本线程已在该实例上登记的缓冲区，每个线程第一次采样时才取用预先分配的缓冲区或新建一个，
+    // 由 sa_free 释放.
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_LOCK(&sa->mutex);
+#endif
+    SAProfileRing* ring;
+    for (ring = sa->profile_rings; NULL != ring; ring = ring->next) {
+      if (ring->thread == (const void*)_sa_profile_slots) {
+        break;
+      }
+    }
+    if (NULL == ring) {
+      ring = sa->profile_spare;
+      if (NULL != ring) {
+        sa->profile_spare = ring->next;
+      } else {
+        ring = (SAProfileRing*)SA_ALLOC(sizeof(SAProfileRing));
+        memset(ring, 0, sizeof(SAProfileRing));
+      }
+      ring->thread = (const void*)_sa_profile_slots;
+      ring->next = sa->profile_rings;
+      sa->profile_rings = ring;
+    }
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_UNLOCK(&sa->mutex);
+#endif
+    slot->ring = ring;
+  }
+
+  SAProfileRing* ring = slot->ring;
+  long n = ring->head;
+  SAProfileEntry* entry = ring->entries + n % SA_PROFILE_RING_SIZE;
+  SA_ATOMIC_STORE(&entry->seq, 0);
+  SA_ATOMIC_FENCE();
+  entry->sample = *sample;
+  SA_ATOMIC_STORE(&entry->seq, n + 1);
+  SA_ATOMIC_STORE(&ring->head, n + 1);
+}
+
+static int _sa_compare_ull(const void* a, const void* b) {
+  unsigned long long x = *(const unsigned long long*)a;
+  unsigned long long y = *(const unsigned long long*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int sa_dump_profile(FILE* out, SensorsAnalytics* sa) {
+  static const char* kStages[] = {"validate", "merge", "serialize", "send", "total"};
+  if (NULL == out || NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  // 复制所有线程中已完成的样本. 只在锁内读取链表头，之后加入的缓冲区在其之前，已有的节点不会改变，
+  // 复制时不阻塞读取公共属性的 sa_track.
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&sa->mutex);
+#endif
+  SAProfileRing* rings = sa->profile_rings;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&sa->mutex);
+#endif
+  unsigned long capacity = 0;
+  SAProfileRing* ring;
+  for (ring = rings; NULL != ring; ring = ring->next) {
+    capacity += SA_PROFILE_RING_SIZE;
+  }
+  unsigned long count = 0;
+  SAProfileSample* samples = NULL;
+  if (capacity > 0) {
+    samples = (SAProfileSample*)SA_ALLOC(sizeof(SAProfileSample) * capacity);
+  }
+  for (ring = rings; NULL != ring; ring = ring->next) {
+    long head = SA_ATOMIC_LOAD(&ring->head);
+    long n = head > SA_PROFILE_RING_SIZE ? head - SA_PROFILE_RING_SIZE : 0;
+    for (; n < head; ++n) {
+      SAProfileEntry* entry = ring->entries + n % SA_PROFILE_RING_SIZE;
+      if (SA_ATOMIC_LOAD(&entry->seq) != n + 1) {
+        continue;
+      }
+      samples[count] = entry->sample;
+      SA_ATOMIC_FENCE();
+      if (SA_ATOMIC_LOAD(&entry->seq) == n + 1) {
+        ++count;
+      }
+    }
+  }
+
+  // 计时单位换算为纳秒.
+  double ns_per_cycle = 1.0;
+  unsigned long long elapsed_ns = _sa_monotonic_ns() - sa->profile_start_ns;
+  unsigned long long elapsed_cycles = _sa_cycles() - sa->profile_start_cycles;
+  if (elapsed_cycles > 0) {
+    ns_per_cycle = (double)elapsed_ns / elapsed_cycles;
+  }
+
+  fprintf(out, "Sensors Analytics profile: %lu samples, 1 in %ld calls, %.3f ns/cycle\n",
+          count, SA_ATOMIC_LOAD(&sa->profile_interval), ns_per_cycle);
+  fprintf(out, "%-10s %14s %14s %14s %14s %14s\n",
+          "stage", "mean(cycles)", "mean(ns)", "p50(ns)", "p99(ns)", "max(ns)");
+
+  if (count > 0) {
+    unsigned long long* values = (unsigned long long*)SA_ALLOC(sizeof(unsigned long long) * count);
+    int stage;
+    for (stage = 0; stage < SA_PROFILE_STAMPS; ++stage) {
+      // 最后一行为从开始到发送完成的总耗时.
+      int from = (SA_PROFILE_STAMPS - 1 == stage) ? SA_PROFILE_START : stage;
+      int to = (SA_PROFILE_STAMPS - 1 == stage) ? SA_PROFILE_SEND : stage + 1;
+      double sum = 0;
+      unsigned long i;
+      for (i = 0; i < count; ++i) {
+        values[i] = samples[i].stamps[to] - samples[i].stamps[from];
+        sum += values[i];
+      }
+      qsort(values, count, sizeof(unsigned long long), &_sa_compare_ull);
+      fprintf(out, "%-10s %14.0f %14.0f %14.0f %14.0f %14.0f\n",
+              kStages[stage],
+              sum / count,
+              sum / count * ns_per_cycle,
+              values[count / 2] * ns_per_cycle,
+              values[(count - 1) * 99 / 100] * ns_per_cycle,
+              values[count - 1] * ns_per_cycle);
+    }
+    SA_RELEASE(values, sizeof(unsigned long long) * count);
+  }
+
+  if (NULL != samples) {
+    SA_RELEASE(samples, sizeof(SAProfileSample) * capacity);
+  }
+  return SA_OK;
+}
+
+static void _sa_profile_free_rings(SAProfileRing* ring) {
+  while (NULL != ring) {
+    SAProfileRing* next = ring->next;
+    SA_RELEASE(ring, sizeof(SAProfileRing));
+    ring = next;
+  }
+}
+
+static void _sa_profile_free(SensorsAnalytics* sa) {
+  _sa_profile_free_rings(sa->profile_rings);
+  _sa_profile_free_rings(sa->profile_spare);
+  sa->profile_rings = NULL;
+  sa->profile_spare = NULL;
+}
+
+
+int sa_init(struct SAConsumer* consumer, SensorsAnalytics** sa) {
+  *sa = (SensorsAnalytics*)SA_ALLOC(sizeof(SensorsAnalytics));
+
+  (*sa)->super_properties = sa_init_properties();
+  if (NULL == (*sa)->super_properties) {
+    SA_RELEASE(*sa, sizeof(SensorsAnalytics));
+    return SA_MALLOC_ERROR;
+  }
+
+#if defined(USE_POSIX)
+  if (pthread_mutex_init(&((*sa)->mutex), NULL) != 0) {
+    _sa_log_error(SA_ERROR_SYSTEM, "Initialize mutex error.");
+    return SA_MALLOC_ERROR;
+  }
+#elif defined(_WIN32)
+  InitializeCriticalSection(&((*sa)->mutex));
+#endif
+
+  (*sa)->consumer = consumer;
+  (*sa)->serialize_pool = NULL;
+  (*sa)->canonical = 0;
+  (*sa)->canonical_keys = NULL;
+  (*sa)->canonical_key_count = 0;
+  (*sa)->signup_dedup = NULL;
+  (*sa)->set_once_cache = NULL;
+  (*sa)->event_bytes = 0;
+  (*sa)->stream_chunk = 0;
+  memset(&(*sa)->stream_op, 0, sizeof(struct SAConsumerStreamOp));
+  (*sa)->profile_interval = 0;
+  (*sa)->id = SA_ATOMIC_INCREMENT(&_sa_next_instance_id);
+  (*sa)->profile_rings = NULL;
+  (*sa)->profile_spare = NULL;
+  (*sa)->profile_start_cycles = 0;
+  (*sa)->profile_start_ns = 0;
+  memset(&(*sa)->stats, 0, sizeof(SAStats));
+  (*sa)->exporter = NULL;
+
+  return SA_OK;
+}
+
+// 释放 sa.
+void sa_free(SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return;
+  }
+
+  _sa_stats_exporter_stop(sa);
+  _sa_serialize_pool_free(sa->serialize_pool);
+  _sa_profile_free(sa);
+  _sa_scope_drain(sa);
+
+  sa_free_properties(sa->super_properties);
+  sa_set_canonical_order(SA_FALSE, NULL, 0, sa);
+  sa_set_signup_dedup(0, 0, 0, sa);
+  sa_set_profile_set_once_cache(0, 0, sa);
+
+#if defined(USE_POSIX)
+  pthread_mutex_destroy(&(sa->mutex));
+#elif defined(_WIN32)
+  DeleteCriticalSection(&(sa->mutex));
+#endif
+
+  sa->consumer->op.close(sa->consumer->this_);
+  free(sa->consumer->this_);
+  free(sa->consumer);
+
+  SA_RELEASE(sa, sizeof(SensorsAnalytics));
+}
+
+// 同步 sa 的状态，将发送 sa 的缓存中所有数据.
+void sa_flush(SensorsAnalytics* sa) {
+  SA_PROBE0(flush__start);
+  int res = sa->consumer->op.flush(sa->consumer->this_);
+  SA_PROBE1(flush__done, res);
+  (void)res;
+}
+
+int sa_flush_async(SensorsAnalytics* sa, sa_completion_callback callback, void* user_data) {
+  if (NULL == sa || NULL == callback) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+#if defined(SA_HAS_THREADS)
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)_sa_get_async_consumer(sa->consumer);
+  if (NULL != inter) {
+    return _sa_async_consumer_mark(inter, SA_ASYNC_FLUSH, callback, user_data);
+  }
+#endif
+
+  // 同步的 Consumer 直接 flush 并调用 callback.
+  callback(sa->consumer->op.flush(sa->consumer->this_), user_data);
+  return SA_OK;
+}
+
+int sa_notify_writable(SensorsAnalytics* sa, sa_completion_callback callback, void* user_data) {
+  if (NULL == sa || NULL == callback) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+#if defined(SA_HAS_THREADS)
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)_sa_get_async_consumer(sa->consumer);
+  if (NULL != inter) {
+    SA_MUTEX_LOCK(&inter->mutex);
+    if (inter->size >= inter->capacity && !inter->stop) {
+      SAAsyncWaiter* waiter = (SAAsyncWaiter*)SA_ALLOC(sizeof(SAAsyncWaiter));
+      waiter->callback = callback;
+      waiter->user_data = user_data;
+      waiter->next = inter->waiters;
+      inter->waiters = waiter;
+      SA_MUTEX_UNLOCK(&inter->mutex);
+      return SA_QUEUE_FULL_ERROR;
+    }
+    SA_MUTEX_UNLOCK(&inter->mutex);
+  }
+#endif
+
+  return SA_OK;
+}
+
+// 使用 sa 的 Consumer 发送事件，flags 为 SA_TRACK_* 选项.
+//
+// 探针 send__start(长度) 与 send__done(长度, 结果). 使用 AsyncConsumer 时只包含入队的耗时.
+static int _sa_send(SensorsAnalytics* sa, const char* event, unsigned long length, unsigned int flags) {
+  int res = SA_OK;
+  SA_PROBE1(send__start, length);
+#if defined(SA_HAS_THREADS)
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)_sa_get_async_consumer(sa->consumer);
+  if (NULL != inter) {
+    res = _sa_async_consumer_enqueue(
+        inter, event, length, (flags & SA_TRACK_NONBLOCKING) ? SA_TRUE : SA_FALSE);
+  } else
+#else
+  (void)flags;
+#endif
+  {
+    unsigned long long start = _sa_monotonic_ns();
+    res = sa->consumer->op.send(sa->consumer->this_, event, length);
+    _sa_histogram_observe(&sa->stats.send_latency, (long long)(_sa_monotonic_ns() - start));
+  }
+  SA_PROBE2(send__done, length, res);
+
+  if (SA_OK == res) {
+    SA_ATOMIC_ADD64(&sa->stats.events, 1);
+    SA_ATOMIC_ADD64(&sa->stats.bytes, (long long)length);
+  } else if (SA_QUEUE_FULL_ERROR == res) {
+    // 非阻塞调用会在队列出现空位后重试，不计为丢弃.
+    if (!(flags & SA_TRACK_NONBLOCKING)) {
+      SA_ATOMIC_ADD64(&sa->stats.dropped, 1);
+    }
+  } else {
+    SA_ATOMIC_ADD64(&sa->stats.send_errors, 1);
+  }
+  return res;
+}
+
+// 初始化单个事件的序列化缓冲区. 开启分段序列化时容量固定为分段大小，写满后交给 Consumer.
+static int _sa_event_sb_init(SAStringBuffer* sb, SensorsAnalytics* sa) {
+  if (0 == sa->stream_chunk) {
+    return _sa_sb_init_size(sb, (unsigned long)SA_ATOMIC_LOAD(&sa->event_bytes));
+  }
+  int res = _sa_sb_init_size(sb, sa->stream_chunk);
+  sb->stream = &sa->stream_op;
+  sb->stream_this = sa->consumer->this_;
+  return res;
+}
+
+// 写入已分段写入的事件的剩余部分并调用 end. 统计数据与探针与 _sa_send 相同，长度为整个事件的长度.
+static int _sa_send_stream(SensorsAnalytics* sa, SAStringBuffer* sb) {
+  unsigned long length = sb->streamed + (sb->cur - sb->start);
+  SA_PROBE1(send__start, length);
+
+  _sa_sb_drain(sb);
+  int res = sb->stream_res;
+  if (sb->stream_begun) {
+    int end_res = sb->stream->end(sb->stream_this);
+    sb->stream_begun = SA_FALSE;
+    if (SA_OK == res) {
+      res = end_res;
+    }
+  }
+  SA_PROBE2(send__done, length, res);
+
+  if (SA_OK == res) {
+    SA_ATOMIC_ADD64(&sa->stats.events, 1);
+    SA_ATOMIC_ADD64(&sa->stats.bytes, (long long)length);
+  } else {
+    SA_ATOMIC_ADD64(&sa->stats.send_errors, 1);
+  }
+  return res;
+}
+
+int sa_set_streaming(const struct SAConsumerStreamOp* op, unsigned long chunk_size, SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (0 == chunk_size) {
+    sa->stream_chunk = 0;
+    return SA_OK;
+  }
+
+  if (NULL != _sa_get_async_consumer(sa->consumer)) {
+    // AsyncConsumer 的队列中保存的是完整的事件.
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Async consumer does not support streaming.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (NULL == op) {
+    if (sa->consumer->op.send != &_sa_logging_consumer_send) {
+      _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Streaming requires stream operations for this consumer.");
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+    op = &_sa_logging_consumer_stream_op;
+  }
+  if (NULL == op->begin || NULL == op->append || NULL == op->end) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  sa->stream_op = *op;
+  // 至少容纳 _sa_dump_cstring 一次写入的 14 字节以及数字、日期等一次写入的内容.
+  sa->stream_chunk = chunk_size < 64 ? 64 : chunk_size;
+  return SA_OK;
+}
+
+int sa_write_stats(FILE* out, SensorsAnalytics* sa) {
+  if (NULL == out || NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  _sa_write_metric(out, "sa_events_total", "counter",
+                   "Events handed to the consumer.", SA_ATOMIC_LOAD64(&sa->stats.events));
+  _sa_write_metric(out, "sa_event_bytes_total", "counter",
+                   "Bytes of serialized events handed to the consumer.",
+                   SA_ATOMIC_LOAD64(&sa->stats.bytes));
+  _sa_write_metric(out, "sa_events_invalid_total", "counter",
+                   "Events rejected by validation.", SA_ATOMIC_LOAD64(&sa->stats.invalid));
+  _sa_write_metric(out, "sa_events_dropped_total", "counter",
+                   "Events dropped because the async queue was full.",
+                   SA_ATOMIC_LOAD64(&sa->stats.dropped));
+  if (NULL != sa->signup_dedup) {
+    _sa_write_metric(out, "sa_signups_suppressed_total", "counter",
+                     "Repeated track_signup events suppressed by the dedup filter.",
+                     SA_ATOMIC_LOAD64(&sa->stats.signups_suppressed));
+    _sa_write_metric(out, "sa_signup_filter_bytes", "gauge",
+                     "Memory used by the track_signup dedup filter.",
+                     (long long)_sa_signup_dedup_bytes(sa->signup_dedup));
+  }
+  if (NULL != sa->set_once_cache) {
+    _sa_write_metric(out, "sa_set_once_cache_hits_total", "counter",
+                     "profile_set_once properties stripped because they were already sent.",
+                     SA_ATOMIC_LOAD64(&sa->stats.set_once_hits));
+    _sa_write_metric(out, "sa_set_once_cache_misses_total", "counter",
+                     "profile_set_once properties not found in the cache.",
+                     SA_ATOMIC_LOAD64(&sa->stats.set_once_misses));
+    _sa_write_metric(out, "sa_set_once_events_dropped_total", "counter",
+                     "profile_set_once events dropped because every property was stripped.",
+                     SA_ATOMIC_LOAD64(&sa->stats.set_once_dropped));
+    _sa_write_metric(out, "sa_set_once_cache_entries", "gauge",
+                     "Entries in the profile_set_once cache.",
+                     (long long)_sa_set_once_entries(sa->set_once_cache));
+  }
+
+  long long send_errors = SA_ATOMIC_LOAD64(&sa->stats.send_errors);
+  const SAHistogram* send_latency = &sa->stats.send_latency;
+#if defined(SA_HAS_THREADS)
+  SAAsyncConsumerInter* inter = (SAAsyncConsumerInter*)_sa_get_async_consumer(sa->consumer);
+  if (NULL != inter) {
+    // 使用 AsyncConsumer 时，发送耗时和失败次数由写线程统计.
+    send_errors += SA_ATOMIC_LOAD64(&inter->send_errors);
+    send_latency = &inter->send_latency;
+
+    SA_MUTEX_LOCK(&inter->mutex);
+    unsigned long size = inter->size;
+    SA_MUTEX_UNLOCK(&inter->mutex);
+    _sa_write_metric(out, "sa_queue_depth", "gauge",
+                     "Events waiting in the async queue.", (long long)size);
+    _sa_write_metric(out, "sa_queue_capacity", "gauge",
+                     "Capacity of the async queue.", (long long)inter->capacity);
+  }
+#endif
+  _sa_write_metric(out, "sa_send_errors_total", "counter",
+                   "Events the consumer failed to write.", send_errors);
+
+#if defined(USE_POSIX)
+  // RelayConsumer 可能由 AsyncConsumer 包装.
+  const SARelayConsumerInter* relay = _sa_get_relay_consumer(sa->consumer);
+#if defined(SA_HAS_THREADS)
+  if (NULL != inter) {
+    relay = _sa_get_relay_consumer(inter->consumer);
+  }
+#endif
+  if (NULL != relay) {
+    _sa_write_metric(out, "sa_relay_events_dropped_total", "counter",
+                     "Buffered events dropped because sending the batch to the relay failed.",
+                     SA_ATOMIC_LOAD64(&relay->dropped));
+  }
+#endif
+
+  // 错误信息的计数是全局的，不区分 SensorsAnalytics 实例.
+  int kind;
+  fprintf(out, "# HELP sa_errors_total Diagnostic messages reported by the SDK.\n"
+               "# TYPE sa_errors_total counter\n");
+  for (kind = 1; kind < SA_ERROR_KIND_COUNT; ++kind) {
+    fprintf(out, "sa_errors_total{kind=\"%s\"} %lld\n",
+            _sa_error_kind_names[kind], SA_ATOMIC_LOAD64(&_sa_error_counters[kind].total));
+  }
+  fprintf(out, "# HELP sa_errors_suppressed_total Diagnostic messages dropped by rate limiting.\n"
+               "# TYPE sa_errors_suppressed_total counter\n");
+  for (kind = 1; kind < SA_ERROR_KIND_COUNT; ++kind) {
+    fprintf(out, "sa_errors_suppressed_total{kind=\"%s\"} %lld\n",
+            _sa_error_kind_names[kind], SA_ATOMIC_LOAD64(&_sa_error_counters[kind].suppressed));
+  }
+  _sa_write_histogram(out, "sa_send_duration_seconds",
+                      "Time spent writing one event in the consumer.", send_latency);
+
+  return ferror(out) ? SA_IO_ERROR : SA_OK;
+}
+
+#if defined(SA_HAS_THREADS)
+
+typedef struct SAStatsExporter {
+  SensorsAnalytics* sa;
+  char path[512];
+  char tmp_path[520];
+  unsigned int interval;
+  SAMutex mutex;
+  SACond cond;
+  int stop;
+  SAThread thread;
+} SAStatsExporter;
+
+// 先写入临时文件再改名，读取方不会读到写了一半的文件.
+static int _sa_stats_exporter_write(SAStatsExporter* exporter) {
+  FILE* file = NULL;
+  FOPEN(&file, exporter->tmp_path, "w");
+  if (NULL == file) {
+    return SA_IO_ERROR;
+  }
+  int res = sa_write_stats(file, exporter->sa);
+  if (0 != fclose(file)) {
+    res = SA_IO_ERROR;
+  }
+  if (SA_OK != res) {
+    remove(exporter->tmp_path);
+    return res;
+  }
+#if defined(_WIN32)
+  if (!MoveFileExA(exporter->tmp_path, exporter->path, MOVEFILE_REPLACE_EXISTING)) {
+    return SA_IO_ERROR;
+  }
+#else
+  if (0 != rename(exporter->tmp_path, exporter->path)) {
+    return SA_IO_ERROR;
+  }
+#endif
+  return SA_OK;
+}
+
+// 等待 ms 毫秒或被唤醒，调用时须持有 mutex.
+static void _sa_cond_timedwait(SACond* cond, SAMutex* mutex, unsigned long ms) {
+#if defined(_WIN32)
+  SleepConditionVariableCS(cond, mutex, ms);
+#else
+  struct timeval now;
+  struct timespec deadline;
+  gettimeofday(&now, NULL);
+  deadline.tv_sec = now.tv_sec + ms / 1000;
+  deadline.tv_nsec = now.tv_usec * 1000L + (long)(ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    ++deadline.tv_sec;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  pthread_cond_timedwait(cond, mutex, &deadline);
+#endif
+}
+
+static SA_THREAD_PROC(_sa_stats_exporter_run, arg) {
+  SAStatsExporter* exporter = (SAStatsExporter*)arg;
+  unsigned long long interval_ns = exporter->interval * 1000000000ULL;
+  unsigned long long next = _sa_monotonic_ns() + interval_ns;
+
+  SA_MUTEX_LOCK(&exporter->mutex);
+  while (!exporter->stop) {
+    unsigned long long now = _sa_monotonic_ns();
+    if (now < next) {
+      _sa_cond_timedwait(&exporter->cond, &exporter->mutex, (unsigned long)((next - now) / 1000000) + 1);
+      continue;
+    }
+    next += interval_ns;
+    SA_MUTEX_UNLOCK(&exporter->mutex);
+    // 错误停止后，剩余的被抑制信息也能及时汇总.
+    _sa_error_summary((long long)_sa_monotonic_ns());
+    if (SA_OK != _sa_stats_exporter_write(exporter)) {
+      _sa_log_error(SA_ERROR_IO, "Failed to write stats to [%s].", exporter->path);
+    }
+    SA_MUTEX_LOCK(&exporter->mutex);
+  }
+  SA_MUTEX_UNLOCK(&exporter->mutex);
+
+  // 退出前写入最终的统计数据.
+  _sa_stats_exporter_write(exporter);
+
+  SA_THREAD_RETURN;
+}
+
+static void _sa_stats_exporter_stop(SensorsAnalytics* sa) {
+  SAStatsExporter* exporter = sa->exporter;
+  if (NULL == exporter) {
+    return;
+  }
+
+  SA_MUTEX_LOCK(&exporter->mutex);
+  exporter->stop = 1;
+  SA_COND_SIGNAL(&exporter->cond);
+  SA_MUTEX_UNLOCK(&exporter->mutex);
+  SA_THREAD_JOIN(exporter->thread);
+
+  SA_COND_DESTROY(&exporter->cond);
+  SA_MUTEX_DESTROY(&exporter->mutex);
+  SA_RELEASE(exporter, sizeof(SAStatsExporter));
+  sa->exporter = NULL;
+}
+
+#else
+static void _sa_stats_exporter_stop(SensorsAnalytics* sa) {
+  (void)sa;
+}
+#endif  // SA_HAS_THREADS
+
+int sa_start_stats_exporter(const char* path, unsigned int interval_seconds, SensorsAnalytics* sa) {
+  if (NULL == path || NULL == sa || 0 == interval_seconds || strlen(path) >= 512) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+#if defined(SA_HAS_THREADS)
+  _sa_stats_exporter_stop(sa);
+
+  SAStatsExporter* exporter = (SAStatsExporter*)SA_ALLOC(sizeof(SAStatsExporter));
+  memset(exporter, 0, sizeof(SAStatsExporter));
+  exporter->sa = sa;
+  exporter->interval = interval_seconds;
+  snprintf(exporter->path, sizeof(exporter->path), "%s", path);
+  snprintf(exporter->tmp_path, sizeof(exporter->tmp_path), "%s.tmp", path);
+  SA_MUTEX_INIT(&exporter->mutex);
+  SA_COND_INIT(&exporter->cond);
+
+  if (!SA_THREAD_CREATE(&exporter->thread, &_sa_stats_exporter_run, exporter)) {
+    _sa_log_error(SA_ERROR_SYSTEM, "Create thread error.");
+    SA_COND_DESTROY(&exporter->cond);
+    SA_MUTEX_DESTROY(&exporter->mutex);
+    SA_RELEASE(exporter, sizeof(SAStatsExporter));
+    return SA_MALLOC_ERROR;
+  }
+  sa->exporter = exporter;
+  return SA_OK;
+#else
+  _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Stats exporter requires thread support.");
+  return SA_INVALID_PARAMETER_ERROR;
+#endif
+}
+
+int sa_register_super_properties(const SAProperties* properties, SensorsAnalytics *sa) {
+  if (NULL == sa || NULL == properties || SA_DICT != properties->tag) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  // 遍历 properties 中所有属性，逐个保存在 super properties 中.
+#if defined(USE_POSIX)
+  pthread_mutex_lock(&sa->mutex);
+#elif defined(_WIN32)
+  EnterCriticalSection(&sa->mutex);
+#endif
+  // sa_parse_event 得到的属性引用调用方的缓冲区，复制后再保存.
+  struct SAListNode* curr = properties->array_;
+  while (NULL != curr) {
+    if (curr->value->borrowed) {
+      SANode* copy = _sa_copy_node(curr->value);
+      _sa_add_child(copy, sa->super_properties);
+      _sa_free_node(copy);
+    } else {
+      _sa_add_child(curr->value, sa->super_properties);
+    }
+    curr = curr->next;
+  }
+#if defined(USE_POSIX)
+  pthread_mutex_unlock(&sa->mutex);
+#elif defined(_WIN32)
+  LeaveCriticalSection(&sa->mutex);
+#endif
+
+  return SA_OK;
+}
+
+int sa_unregister_super_properties(const char* key, SensorsAnalytics *sa) {
+#if defined(USE_POSIX)
+  pthread_mutex_lock(&sa->mutex);
+#elif defined(_WIN32)
+  EnterCriticalSection(&sa->mutex);
+#endif
+  _sa_remove_child(key, sa->super_properties);
+#if defined(USE_POSIX)
+  pthread_mutex_unlock(&sa->mutex);
+#elif defined(_WIN32)
+  LeaveCriticalSection(&sa->mutex);
+#endif
+  return SA_OK;
+}
+
+int sa_clear_super_properties(SensorsAnalytics *sa) {
+#if defined(USE_POSIX)
+  pthread_mutex_lock(&sa->mutex);
+#elif defined(_WIN32)
+  EnterCriticalSection(&sa->mutex);
+#endif
+  _sa_remove_child(NULL, sa->super_properties);
+#if defined(USE_POSIX)
+  pthread_mutex_unlock(&sa->mutex);
+#elif defined(_WIN32)
+  LeaveCriticalSection(&sa->mutex);
+#endif
+  return SA_OK;
+}
+
+// Track events ---------------------------------------------------------------
+
+// 当前线程最近通过检查的名称，按哈希值分组，每组 SA_NAME_CACHE_WAYS 项，新名称放在第一项. 检查规则是
+// 固定的，与 SensorsAnalytics 实例无关，命中时不再逐字节检查. 只缓存短于 SA_NAME_CACHE_BYTES 的名称.
+#define SA_NAME_CACHE_SETS 64
+#define SA_NAME_CACHE_WAYS 4
+#define SA_NAME_CACHE_BYTES 32
+static SA_THREAD_LOCAL char _sa_name_cache[SA_NAME_CACHE_SETS][SA_NAME_CACHE_WAYS][SA_NAME_CACHE_BYTES];
+
+// 检查名称: 逐字节检查 [a-zA-Z_$][a-zA-Z0-9_$]{0,99}，再与保留字做不区分大小写的比较.
+static int _sa_scan_key_name(const char* key) {
+  static const char* kKeywords[] = {
+      "distinct_id", "original_id", "time", "properties", "id", "first_id", "second_id",
+      "users", "events", "event", "user_id", "date", "datetime"};
+  if (NULL == key) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  unsigned long length = 0;
+  for (; '\0' != key[length]; ++length) {
+    char c = key[length];
+    if (length >= 100 || !(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || '_' == c || '$' == c
+        || (length > 0 && '0' <= c && c <= '9'))) {
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+  }
+  if (0 == length) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  unsigned int i;
+  for (i = 0; i < sizeof(kKeywords) / sizeof(kKeywords[0]); ++i) {
+    const char* word = kKeywords[i];
+    unsigned long j = 0;
+    while (j < length && '\0' != word[j]
+        && (('A' <= key[j] && key[j] <= 'Z') ? key[j] - 'A' + 'a' : key[j]) == word[j]) {
+      ++j;
+    }
+    if (j == length && '\0' == word[j]) {
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+  }
+  return SA_OK;
+}
+
+// 检查事件名或属性名，先查找当前线程的缓存.
+static int _sa_check_name(const char* key) {
+  if (NULL == key || '\0' == key[0]) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  // FNV-1a.
+  unsigned int hash = 2166136261u;
+  unsigned long length = 0;
+  while ('\0' != key[length] && length < SA_NAME_CACHE_BYTES) {
+    hash = (hash ^ (unsigned char)key[length]) * 16777619u;
+    ++length;
+  }
+  char (*set)[SA_NAME_CACHE_BYTES] = NULL;
+  if (length < SA_NAME_CACHE_BYTES) {
+    // FNV-1a 的低位分布较差，取组号前再混合一次.
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    set = _sa_name_cache[hash % SA_NAME_CACHE_SETS];
+    int way;
+    for (way = 0; way < SA_NAME_CACHE_WAYS; ++way) {
+      if (0 == memcmp(set[way], key, length + 1)) {
+        return SA_OK;
+      }
+    }
+  }
+  int res = _sa_scan_key_name(key);
+  if (SA_OK == res && NULL != set) {
+    memmove(set[1], set[0], (SA_NAME_CACHE_WAYS - 1) * SA_NAME_CACHE_BYTES);
+    memcpy(set[0], key, length + 1);
+  }
+  return res;
+}
+
+int sa_check_key_name(const char* key, SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  return _sa_check_name(key);
+}
+
+// 当前时间，单位为毫秒.
+static long long _sa_now_ms() {
+#if defined(USE_POSIX)
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (long long)now.tv_sec * 1000 + now.tv_usec / 1000;
+#elif defined(_WIN32)
+  struct timeb now;
+  ftime(&now);
+  return (long long)now.time * 1000 + now.millitm;
+#elif defined(__linux__)
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#else
+  return (long long)time(NULL) * 1000;
+#endif
+}
+
+static int _sa_is_track(const char* type) {
+  return 0 == strncmp(type, "track", strlen("track"));
+}
+
+static int _sa_is_track_signup(const char* type) {
+  return 0 == strncmp(type, "track_signup", strlen("track_signup"));
+}
+
+static int _sa_check_distinct_id(const char* distinct_id) {
+  unsigned long distinct_id_len = (NULL == distinct_id ? (unsigned long)-1 : strlen(distinct_id));
+  if (distinct_id_len < 1 || distinct_id_len > 255) {
+    _sa_log_error(SA_ERROR_INVALID_DISTINCT_ID, "Invalid distinct id [%s].",
+      distinct_id == NULL ? "NULL" : distinct_id);
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  return SA_OK;
+}
+
+static int _sa_check_legality(
+  const char* distinct_id,
+  const char* origin_id,
+  const char* type,
+  const char* event,
+  const struct SANode* properties) {
+  // 合法性检查.
+  if (SA_OK != _sa_check_distinct_id(distinct_id)) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (_sa_is_track_signup(type)) {
+    unsigned long origin_id_len = (NULL == origin_id ? (unsigned long)-1 : strlen(origin_id));
+    if (origin_id_len < 1 || origin_id_len > 255) {
+      _sa_log_error(SA_ERROR_INVALID_ORIGINAL_ID, "Invalid original distinct id [%s].",
+        origin_id == NULL ? "NULL" : origin_id);
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+  }
+  if (_sa_is_track(type) && (NULL == event || SA_OK != _sa_check_name(event))) {
+    _sa_log_error(SA_ERROR_INVALID_EVENT_NAME, "Invalid event name [%s].", event == NULL ? "NULL" : event);
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (NULL != properties) {
+    SAListNode* curr = properties->array_;
+    while (NULL != curr) {
+      if (NULL == curr->value->key || SA_OK != _sa_check_name(curr->value->key)) {
+        _sa_log_error(SA_ERROR_INVALID_PROPERTY_NAME, "Invalid property name [%s].",
+          NULL == curr->value->key ? "NULL" : curr->value->key);
+        return SA_INVALID_PARAMETER_ERROR;
+      }
+      curr = curr->next;
+    }
+  }
+  return SA_OK;
+}
+
+// 检查字典中的字符串值以及列表中的字符串是否为合法的 UTF-8.
+static int _sa_check_utf8_values(const struct SANode* dict) {
+  const SAListNode* curr;
+  for (curr = dict->array_; NULL != curr; curr = curr->next) {
+    const SANode* value = curr->value;
+    if (SA_STRING == value->tag && !sa_utf8_validate(value->string_)) {
+      _sa_log_error(SA_ERROR_INVALID_UTF8, "Invalid utf-8 string in property [%s].", value->key);
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+    if (SA_LIST == value->tag) {
+      const SAListNode* item;
+      for (item = value->array_; NULL != item; item = item->next) {
+        if (SA_STRING == item->value->tag && !sa_utf8_validate(item->value->string_)) {
+          _sa_log_error(SA_ERROR_INVALID_UTF8, "Invalid utf-8 string in property [%s].", value->key);
+          return SA_INVALID_PARAMETER_ERROR;
+        }
+      }
+    }
+  }
+  return SA_OK;
+}
+
+static int _sa_check_parsed_event(const SAParsedEvent* event, SensorsAnalytics* sa) {
+  if (NULL == event || NULL == event->type || NULL == sa) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Invalid parameter for parsed event.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (SA_OK != _sa_check_legality(
+      event->distinct_id, event->original_id, event->type, event->event, event->properties)) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  // 序列化时 _sa_dump_cstring 拒绝不合法的 UTF-8，解析出的字符串须满足同样的规则.
+  if (!sa_utf8_validate(event->distinct_id)
+      || (NULL != event->original_id && !sa_utf8_validate(event->original_id))) {
+    _sa_log_error(SA_ERROR_INVALID_UTF8, "Invalid utf-8 string in distinct id.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  return _sa_check_utf8_values(event->properties);
+}
+
+int sa_check_parsed_event(const SAParsedEvent* event, SACheckError* error, SensorsAnalytics* sa) {
+  if (NULL != error) {
+    error->kind = SA_ERROR_SUMMARY;
+    error->message[0] = '\0';
+  }
+  _sa_error_capture = error;
+  int res = _sa_check_parsed_event(event, sa);
+  _sa_error_capture = NULL;
+  return res;
+}
+
+// 判断预序列化的属性片段中是否已包含 key. 片段中字符串值内的 '"' 都已转义，因此位于片段开头
+// 或 ',' 之后、形如 "key": 的内容只可能是属性名.
+static int _sa_fragment_has_key(const char* fragment, unsigned long length, const char* key) {
+  unsigned long key_len = strlen(key);
+  const char* end = fragment + length;
+  const char* p = fragment;
+
+  while (NULL != p && p + key_len + 3 <= end) {
+    if ('"' == p[0]
+        && (p == fragment || ',' == p[-1])
+        && 0 == memcmp(p + 1, key, key_len)
+        && '"' == p[key_len + 1]
+        && ':' == p[key_len + 2]) {
+      return 1;
+    }
+    p = (const char*)memchr(p + 1, '"', end - p - 1);
+  }
+  return 0;
+}
+
+// 作用域属性 ------------------------------------------------------------------
+
+// 作用域中一个属性 "key":value 在预序列化片段中的位置.
+typedef struct {
+  const char* key;
+  unsigned long offset;
+  unsigned long length;
+} SAScopePiece;
+
+typedef struct SAScope {
+  // 当前线程中更早压入的作用域.
+  struct SAScope* prev;
+  // 所属实例的编号. 不保存实例的指针，实例释放后同一地址上的新实例不会用到旧的作用域.
+  long owner;
+  // 合并了外层作用域之后的属性，内层优先. 均为压入时的深拷贝.
+  SANode* properties;
+  // 预序列化的属性片段，形如 "k1":v1,"k2":v2，各属性的位置记录在 pieces 中.
+  char* fragment;
+  unsigned long length;
+  SAScopePiece* pieces;
+  unsigned long count;
+} SAScope;
+
+static SA_THREAD_LOCAL SAScope* _sa_scope_top = NULL;
+
+static void _sa_scope_free(SAScope* scope) {
+  _sa_free_node(scope->properties);
+  SA_RELEASE(scope->fragment, scope->length + 1);
+  SA_RELEASE(scope->pieces, sizeof(SAScopePiece) * (scope->count > 0 ? scope->count : 1));
+  SA_RELEASE(scope, sizeof(SAScope));
+}
+
+#if defined(USE_POSIX)
+// 线程退出时释放该线程未弹出的作用域，键的值为线程的栈顶.
+static pthread_key_t _sa_scope_key;
+static pthread_once_t _sa_scope_key_once = PTHREAD_ONCE_INIT;
+
+static void _sa_scope_thread_exit(void* top) {
+  SAScope* scope = (SAScope*)top;
+  while (NULL != scope) {
+    SAScope* prev = scope->prev;
+    _sa_scope_free(scope);
+    scope = prev;
+  }
+}
+
+static void _sa_scope_key_init(void) {
+  pthread_key_create(&_sa_scope_key, &_sa_scope_thread_exit);
+}
+#endif
+
+static void _sa_scope_set_top(SAScope* top) {
+  _sa_scope_top = top;
+#if defined(USE_POSIX)
+  pthread_once(&_sa_scope_key_once, &_sa_scope_key_init);
+  pthread_setspecific(_sa_scope_key, top);
+#endif
+}
+
+// 返回当前线程中 sa 最内层的作用域.
+static const SAScope* _sa_scope_find(const SensorsAnalytics* sa) {
+  const SAScope* scope = _sa_scope_top;
+  while (NULL != scope && scope->owner != sa->id) {
+    scope = scope->prev;
+  }
+  return scope;
+}
+
+// 释放当前线程中 sa 的所有作用域，由 sa_free 调用.
+static void _sa_scope_drain(const SensorsAnalytics* sa) {
+  SAScope** link = &_sa_scope_top;
+  int drained = 0;
+  while (NULL != *link) {
+    SAScope* scope = *link;
+    if (scope->owner == sa->id) {
+      *link = scope->prev;
+      _sa_scope_free(scope);
+      drained = 1;
+    } else {
+      link = &scope->prev;
+    }
+  }
+  if (drained) {
+    _sa_scope_set_top(_sa_scope_top);
+  }
+}
+
+int sa_scope_push(const SAProperties* properties, SensorsAnalytics* sa) {
+  if (NULL == sa || NULL == properties || SA_DICT != properties->tag) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "Invalid parameter for scope.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  // $time、$project 会被改写到事件的 time、project 字段，$lib、$lib_version 由 SDK 写入，
+  // 作用域中不支持这些属性.
+  static const char* kReservedKeys[] = { "$time", "$project", "$lib", "$lib_version" };
+  const SAListNode* curr;
+  for (curr = properties->array_; NULL != curr; curr = curr->next) {
+    int reserved = 0;
+    if (NULL != curr->value->key) {
+      unsigned int i;
+      for (i = 0; i < sizeof(kReservedKeys) / sizeof(kReservedKeys[0]); ++i) {
+        reserved |= 0 == strncmp(kReservedKeys[i], curr->value->key, 256);
+      }
+    }
+    if (NULL == curr->value->key || reserved || SA_OK != _sa_check_name(curr->value->key)) {
+      _sa_log_error(SA_ERROR_INVALID_PROPERTY_NAME, "Invalid property name [%s].",
+        NULL == curr->value->key ? "NULL" : curr->value->key);
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+  }
+
+  SANode* merged = _sa_init_dict_node(NULL);
+  if (NULL == merged) {
+    return SA_MALLOC_ERROR;
+  }
+  // 先加入外层作用域的属性，再由本层覆盖同名属性.
+  const SAScope* outer = _sa_scope_find(sa);
+  if (NULL != outer) {
+    for (curr = outer->properties->array_; NULL != curr; curr = curr->next) {
+      _sa_add_child(curr->value, merged);
+    }
+  }
+  // 复制本层的属性，之后调用方可以任意修改或释放 properties.
+  for (curr = properties->array_; NULL != curr; curr = curr->next) {
+    SANode* copy = _sa_copy_node(curr->value);
+    _sa_add_child(copy, merged);
+    _sa_free_node(copy);
+  }
+
+  unsigned long count = 0;
+  for (curr = merged->array_; NULL != curr; curr = curr->next) {
+    ++count;
+  }
+
+  SAScope* scope = (SAScope*)SA_ALLOC(sizeof(SAScope));
+  scope->owner = sa->id;
+  scope->properties = merged;
+  scope->count = count;
+  scope->pieces = (SAScopePiece*)SA_ALLOC(sizeof(SAScopePiece) * (count > 0 ? count : 1));
+
+  // 只在压入时序列化一次.
+  SAStringBuffer sb;
+  _sa_sb_init(&sb);
+  unsigned long i = 0;
+  for (curr = merged->array_; NULL != curr; curr = curr->next, ++i) {
+    if (i > 0) {
+      _sa_sb_putc(&sb, ',');
+    }
+    SAScopePiece* piece = &scope->pieces[i];
+    piece->key = curr->value->key;
+    piece->offset = sb.cur - sb.start;
+    _sa_sb_putc(&sb, '"');
+    _sa_sb_put(&sb, curr->value->key, strlen(curr->value->key));
+    _sa_sb_put(&sb, "\":", 2);
+    _sa_dump_node(curr->value, &sb);
+    piece->length = (sb.cur - sb.start) - piece->offset;
+  }
+  // 作用域可能比当前线程的分配器存在得更久，因此复制到 SDK 的分配器中.
+  scope->length = sb.cur - sb.start;
+  scope->fragment = (char*)SA_ALLOC(scope->length + 1);
+  memcpy(scope->fragment, sb.start, scope->length);
+  scope->fragment[scope->length] = 0;
+  _sa_sb_free(&sb);
+
+  scope->prev = _sa_scope_top;
+  _sa_scope_set_top(scope);
+  return SA_OK;
+}
+
+int sa_scope_pop(SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "No scope to pop.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  SAScope** link = &_sa_scope_top;
+  while (NULL != *link && (*link)->owner != sa->id) {
+    link = &(*link)->prev;
+  }
+  if (NULL == *link) {
+    _sa_log_error(SA_ERROR_INVALID_PARAMETER, "No scope to pop.");
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SAScope* scope = *link;
+  *link = scope->prev;
+  _sa_scope_set_top(_sa_scope_top);
+  _sa_scope_free(scope);
+  return SA_OK;
+}
+
+// 写入作用域中未被调用方属性覆盖的部分. 调用方属性为 SANode（properties）或预序列化的片段
+// （fragment），written 为 properties 对象中已写入的属性数. 相邻的属性合并为一次写入.
+static int _sa_dump_scope(
+  const SAScope* scope,
+  const struct SANode* properties,
+  const char* fragment,
+  unsigned long length,
+  int written,
+  SAStringBuffer* sb) {
+  unsigned long run_begin = 0;
+  unsigned long run_end = 0;
+  unsigned long i;
+  for (i = 0; i <= scope->count; ++i) {
+    const SAScopePiece* piece = i < scope->count ? &scope->pieces[i] : NULL;
+    int overridden = NULL != piece
+      && ((NULL != properties && NULL != _sa_get_child(piece->key, properties))
+          || (length > 0 && _sa_fragment_has_key(fragment, length, piece->key)));
+    if (NULL != piece && !overridden) {
+      if (run_end == run_begin) {
+        run_begin = piece->offset;
+      }
+      run_end = piece->offset + piece->length;
+    } else if (run_end > run_begin) {
+      if (written++ > 0) {
+        _sa_sb_putc(sb, ',');
+      }
+      _sa_sb_put(sb, scope->fragment + run_begin, run_end - run_begin);
+      run_begin = run_end = 0;
+    }
+  }
+  return SA_OK;
+}
+
+// 注册事件去重 ---------------------------------------------------------------
+
+// 每个块 512 位，一个元素的各位都在同一个块中，查询与插入只访问一条缓存行.
+#define SA_BLOOM_BLOCK_WORDS 8
+#define SA_BLOOM_BLOCK_BITS (SA_BLOOM_BLOCK_WORDS * 64)
+#define SA_BLOOM_MAX_HASHES 16
+
+// 可扩展 Bloom 过滤器的一层. 第 i 层容量为 expected * 2^i，误判率为 fp_rate / 2^(i+1)，
+// 各层误判率之和不超过一个周期的 fp_rate.
+typedef struct SABloomSlice {
+  unsigned long long* blocks;
+  unsigned long block_count;
+  unsigned int hashes;
+  unsigned long capacity;
+  unsigned long count;
+  struct SABloomSlice* next;
+} SABloomSlice;
+
+typedef struct SASignupDedup {
+  unsigned long expected;
+  // 每个周期的误判率上限. 轮换时查询两个周期，各分得总上限的一半.
+  double fp_rate;
+  // 轮换周期，0 表示不轮换.
+  unsigned long long rotate_ns;
+  unsigned long long rotated_at;
+  // 当前与上一个周期的过滤器，各自新的层在前. 查询两个周期，插入当前周期.
+  SABloomSlice* current;
+  SABloomSlice* previous;
+  // 所有层占用的字节数.
+  unsigned long long bytes;
+  // 正在发送的组合. 发送完成后移出，成功时才插入过滤器; 其间其他线程的相同调用视为重复.
+  unsigned long long* sending;
+  unsigned long sending_count;
+  unsigned long sending_capacity;
+#if defined(SA_HAS_THREADS)
+  SAMutex mutex;
+#endif
+} SASignupDedup;
+
+// log2(x)，x >= 1. 只用于计算过滤器大小，不依赖 libm.
+static double _sa_log2(double x) {
+  double result = 0;
+  while (x >= 2) {
+    x /= 2;
+    result += 1;
+  }
+  double bit = 0.5;
+  int i;
+  for (i = 0; i < 20; ++i) {
+    x *= x;
+    if (x >= 2) {
+      x /= 2;
+      result += bit;
+    }
+    bit /= 2;
+  }
+  return result;
+}
+
+static unsigned long long _sa_mix64(unsigned long long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// (distinct_id, origin_id) 的 64 位哈希值，两者之间以 0xff 分隔，UTF-8 中不会出现该字节.
+static unsigned long long _sa_signup_hash(const char* distinct_id, const char* origin_id) {
+  unsigned long long hash = 14695981039346656037ULL;
+  const unsigned char* p;
+  for (p = (const unsigned char*)distinct_id; '\0' != *p; ++p) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  hash = (hash ^ 0xff) * 1099511628211ULL;
+  for (p = (const unsigned char*)origin_id; '\0' != *p; ++p) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  return _sa_mix64(hash);
+}
+
+// 新建第 level 层.
+static SABloomSlice* _sa_bloom_slice_new(const SASignupDedup* dedup, unsigned int level) {
+  double fp_rate = dedup->fp_rate;
+  unsigned int i;
+  for (i = 0; i <= level; ++i) {
+    fp_rate /= 2;
+  }
+  // 标准 Bloom 过滤器每个元素需要 log2(1/p) / ln2 位. 分块使各块的负载不均匀，误判率越低需要补偿的
+  // 位越多: 按 512 位块的误判率公式数值求解，所需位数约为标准的 1 + log2(1/p)^2 / 1200 倍，
+  // 哈希函数个数约为 0.9 * log2(1/p)，此处多留少量余量.
+  double log2_inverse = _sa_log2(1 / fp_rate);
+  double hashes = 0.9 * log2_inverse;
+  double bits = (double)dedup->expected * (double)(1UL << level) * log2_inverse * 1.4427
+      * (1 + log2_inverse * log2_inverse / 1000);
+
+  SABloomSlice* slice = (SABloomSlice*)SA_ALLOC(sizeof(SABloomSlice));
+  slice->block_count = (unsigned long)(bits / SA_BLOOM_BLOCK_BITS) + 1;
+  slice->hashes = (unsigned int)(hashes + 0.5);
+  if (slice->hashes < 1) {
+    slice->hashes = 1;
+  } else if (slice->hashes > SA_BLOOM_MAX_HASHES) {
+    slice->hashes = SA_BLOOM_MAX_HASHES;
+  }
+  slice->capacity = dedup->expected << level;
+  slice->count = 0;
+  slice->next = NULL;
+  unsigned long bytes = slice->block_count * SA_BLOOM_BLOCK_WORDS * sizeof(unsigned long long);
+  slice->blocks = (unsigned long long*)SA_ALLOC(bytes);
+  memset(slice->blocks, 0, bytes);
+  return slice;
+}
+
+static unsigned long long _sa_bloom_slice_bytes(const SABloomSlice* slice) {
+  return (unsigned long long)slice->block_count * SA_BLOOM_BLOCK_WORDS * sizeof(unsigned long long);
+}
+
+static void _sa_bloom_slices_free(SABloomSlice* slice, SASignupDedup* dedup) {
+  while (NULL != slice) {
+    SABloomSlice* next = slice->next;
+    dedup->bytes -= _sa_bloom_slice_bytes(slice);
+    SA_RELEASE(slice->blocks, (unsigned long)_sa_bloom_slice_bytes(slice));
+    SA_RELEASE(slice, sizeof(SABloomSlice));
+    slice = next;
+  }
+}
+
+// 块内的各位置分别取自哈希值的 9 位，每 64 位用完后由 hash 生成下一个 64 位. 用 (a + i * b) mod 512 的双重哈希
+// 生成位置时各位置相关，实测误判率是理论值的 3 到 4 倍.
+static int _sa_bloom_slice_test(const SABloomSlice* slice, unsigned long long hash, int set) {
+  unsigned long block = (unsigned long)(((hash >> 32) * (unsigned long long)slice->block_count) >> 32);
+  unsigned long long* words = slice->blocks + (unsigned long long)block * SA_BLOOM_BLOCK_WORDS;
+  unsigned long long seed = hash;
+  unsigned long long bits = 0;
+  unsigned int remaining = 0;
+  int found = 1;
+  unsigned int i;
+  for (i = 0; i < slice->hashes; ++i) {
+    if (0 == remaining) {
+      seed += 0x9e3779b97f4a7c15ULL;
+      bits = _sa_mix64(seed);
+      remaining = 7;
+    }
+    unsigned int position = (unsigned int)(bits & (SA_BLOOM_BLOCK_BITS - 1));
+    bits >>= 9;
+    --remaining;
+    unsigned long long mask = 1ULL << (position & 63);
+    if (0 == (words[position >> 6] & mask)) {
+      if (!set) {
+        return 0;
+      }
+      found = 0;
+      words[position >> 6] |= mask;
+    }
+  }
+  return found;
+}
+
+static int _sa_bloom_contains(const SABloomSlice* slice, unsigned long long hash) {
+  for (; NULL != slice; slice = slice->next) {
+    if (_sa_bloom_slice_test(slice, hash, 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// 插入当前周期，当前层已满时新增一层. 调用时持有 dedup->mutex.
+static void _sa_signup_dedup_insert(SASignupDedup* dedup, unsigned long long hash) {
+  SABloomSlice* head = dedup->current;
+  if (NULL == head || head->count >= head->capacity) {
+    unsigned int level = 0;
+    SABloomSlice* slice;
+    for (slice = head; NULL != slice; slice = slice->next) {
+      ++level;
+    }
+    // 超过 32 层时容量已经远大于实际可能的元素数，不再新增.
+    if (NULL == head || level < 32) {
+      SABloomSlice* created = _sa_bloom_slice_new(dedup, level);
+      created->next = head;
+      dedup->current = head = created;
+      dedup->bytes += _sa_bloom_slice_bytes(created);
+    }
+  }
+  if (!_sa_bloom_slice_test(head, hash, 1)) {
+    ++head->count;
+  }
+}
+
+// 到期时丢弃上一个周期的过滤器. 调用时持有 dedup->mutex.
+static void _sa_signup_dedup_rotate(SASignupDedup* dedup) {
+  if (0 == dedup->rotate_ns) {
+    return;
+  }
+  unsigned long long now = _sa_monotonic_ns();
+  if (now - dedup->rotated_at < dedup->rotate_ns) {
+    return;
+  }
+  _sa_bloom_slices_free(dedup->previous, dedup);
+  // 超过两个周期没有调用时，当前周期的内容也已过期.
+  if (now - dedup->rotated_at >= 2 * dedup->rotate_ns) {
+    _sa_bloom_slices_free(dedup->current, dedup);
+    dedup->previous = NULL;
+  } else {
+    dedup->previous = dedup->current;
+  }
+  dedup->current = NULL;
+  dedup->rotated_at = now;
+}
+
+// 检查并占用一个组合: 已发送过或正在由其他线程发送时返回 1，否则记为正在发送并返回 0，之后须调用
+// _sa_signup_dedup_end. 只在上一个周期中出现时同时插入当前周期，持续登录的用户不会因轮换而重新发送.
+static int _sa_signup_dedup_begin(SASignupDedup* dedup, unsigned long long hash) {
+  int seen = 0;
+  unsigned long i;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&dedup->mutex);
+#endif
+  _sa_signup_dedup_rotate(dedup);
+  if (_sa_bloom_contains(dedup->current, hash)) {
+    seen = 1;
+  } else if (_sa_bloom_contains(dedup->previous, hash)) {
+    _sa_signup_dedup_insert(dedup, hash);
+    seen = 1;
+  }
+  for (i = 0; i < dedup->sending_count && !seen; ++i) {
+    seen = dedup->sending[i] == hash;
+  }
+  if (!seen) {
+    if (dedup->sending_count == dedup->sending_capacity) {
+      unsigned long capacity = dedup->sending_capacity > 0 ? dedup->sending_capacity * 2 : 8;
+      unsigned long long* grown = (unsigned long long*)SA_ALLOC(sizeof(unsigned long long) * capacity);
+      if (NULL != dedup->sending) {
+        memcpy(grown, dedup->sending, sizeof(unsigned long long) * dedup->sending_count);
+        SA_RELEASE(dedup->sending, sizeof(unsigned long long) * dedup->sending_capacity);
+      }
+      dedup->sending = grown;
+      dedup->sending_capacity = capacity;
+    }
+    dedup->sending[dedup->sending_count++] = hash;
+  }
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&dedup->mutex);
+#endif
+  return seen;
+}
+
+// 结束发送: 移出正在发送的组合，发送成功时插入当前周期，失败的组合下次调用时重新发送.
+static void _sa_signup_dedup_end(SASignupDedup* dedup, unsigned long long hash, int sent) {
+  unsigned long i;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&dedup->mutex);
+#endif
+  for (i = 0; i < dedup->sending_count; ++i) {
+    if (dedup->sending[i] == hash) {
+      dedup->sending[i] = dedup->sending[--dedup->sending_count];
+      break;
+    }
+  }
+  if (sent) {
+    _sa_signup_dedup_insert(dedup, hash);
+  }
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&dedup->mutex);
+#endif
+}
+
+static unsigned long long _sa_signup_dedup_bytes(SASignupDedup* dedup) {
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&dedup->mutex);
+#endif
+  unsigned long long bytes = dedup->bytes;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&dedup->mutex);
+#endif
+  return bytes;
+}
+
+int sa_set_signup_dedup(
+    unsigned long expected, double fp_rate, unsigned int rotate_seconds, SensorsAnalytics* sa) {
+  if (NULL == sa || (expected > 0 && !(fp_rate > 0 && fp_rate < 1))) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  SASignupDedup* dedup = sa->signup_dedup;
+  if (NULL != dedup) {
+    _sa_bloom_slices_free(dedup->current, dedup);
+    _sa_bloom_slices_free(dedup->previous, dedup);
+    if (NULL != dedup->sending) {
+      SA_RELEASE(dedup->sending, sizeof(unsigned long long) * dedup->sending_capacity);
+    }
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_DESTROY(&dedup->mutex);
+#endif
+    SA_RELEASE(dedup, sizeof(SASignupDedup));
+    sa->signup_dedup = NULL;
+  }
+  if (0 == expected) {
+    return SA_OK;
+  }
+
+  dedup = (SASignupDedup*)SA_ALLOC(sizeof(SASignupDedup));
+  dedup->expected = expected;
+  dedup->fp_rate = 0 == rotate_seconds ? fp_rate : fp_rate / 2;
+  dedup->rotate_ns = (unsigned long long)rotate_seconds * 1000000000ULL;
+  dedup->rotated_at = _sa_monotonic_ns();
+  dedup->current = NULL;
+  dedup->previous = NULL;
+  dedup->bytes = 0;
+  dedup->sending = NULL;
+  dedup->sending_count = 0;
+  dedup->sending_capacity = 0;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_INIT(&dedup->mutex);
+#endif
+  sa->signup_dedup = dedup;
+  return SA_OK;
+}
+
+// 用户属性 set_once 去重 -----------------------------------------------------
+
+#define SA_SET_ONCE_NIL 0xffffffffu
+#define SA_SET_ONCE_DEFAULT_SHARDS 16
+
+// LRU 中的一项，只保存哈希值. 64 位哈希值碰撞的概率可以忽略，碰撞时会误去掉一个 set_once 属性.
+typedef struct {
+  // (distinct_id, key) 与 distinct_id 的哈希值，后者用于 sa_profile_delete 时清除该用户的所有项.
+  unsigned long long hash;
+  unsigned long long user;
+  // LRU 双向链表与哈希桶中的下一项，SA_SET_ONCE_NIL 表示没有.
+  unsigned int prev;
+  unsigned int next;
+  unsigned int chain;
+} SASetOnceEntry;
+
+// 同一用户的所有项都在同一个分片中.
+typedef struct {
+#if defined(SA_HAS_THREADS)
+  SAMutex mutex;
+#endif
+  SASetOnceEntry* entries;
+  unsigned int capacity;
+  unsigned int count;
+  unsigned int* buckets;
+  unsigned int bucket_mask;
+  // 最近与最久使用的项.
+  unsigned int head;
+  unsigned int tail;
+} SASetOnceShard;
+
+typedef struct SASetOnceCache {
+  SASetOnceShard* shards;
+  unsigned int shard_count;
+} SASetOnceCache;
+
+// 用户由 distinct_id 与事件的 $project 共同确定，project 为 NULL 表示默认项目. 同一个 distinct_id 在
+// 不同项目中是不同的用户.
+static unsigned long long _sa_set_once_user_hash(const char* distinct_id, const char* project) {
+  unsigned long long hash = 14695981039346656037ULL;
+  const unsigned char* p;
+  for (p = (const unsigned char*)distinct_id; '\0' != *p; ++p) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  if (NULL != project) {
+    // 以 distinct_id 中不会出现的 '\0' 分隔，再混入项目名.
+    hash = (hash ^ 0) * 1099511628211ULL;
+    for (p = (const unsigned char*)project; '\0' != *p; ++p) {
+      hash = (hash ^ *p) * 1099511628211ULL;
+    }
+  }
+  return _sa_mix64(hash);
+}
+
+static unsigned long long _sa_set_once_key_hash(unsigned long long user, const char* key) {
+  unsigned long long hash = user;
+  const unsigned char* p;
+  for (p = (const unsigned char*)key; '\0' != *p; ++p) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  return _sa_mix64(hash);
+}
+
+static SASetOnceShard* _sa_set_once_shard(const SASetOnceCache* cache, unsigned long long user) {
+  return &cache->shards[(unsigned long)((user >> 32) % cache->shard_count)];
+}
+
+static void _sa_set_once_unlink(SASetOnceShard* shard, unsigned int index) {
+  SASetOnceEntry* entry = &shard->entries[index];
+  if (SA_SET_ONCE_NIL != entry->prev) {
+    shard->entries[entry->prev].next = entry->next;
+  } else {
+    shard->head = entry->next;
+  }
+  if (SA_SET_ONCE_NIL != entry->next) {
+    shard->entries[entry->next].prev = entry->prev;
+  } else {
+    shard->tail = entry->prev;
+  }
+}
+
+static void _sa_set_once_push_front(SASetOnceShard* shard, unsigned int index) {
+  SASetOnceEntry* entry = &shard->entries[index];
+  entry->prev = SA_SET_ONCE_NIL;
+  entry->next = shard->head;
+  if (SA_SET_ONCE_NIL != shard->head) {
+    shard->entries[shard->head].prev = index;
+  } else {
+    shard->tail = index;
+  }
+  shard->head = index;
+}
+
+// 从哈希桶中移除第 index 项.
+static void _sa_set_once_unchain(SASetOnceShard* shard, unsigned int index) {
+  unsigned int* link = &shard->buckets[shard->entries[index].hash & shard->bucket_mask];
+  while (*link != index) {
+    link = &shard->entries[*link].chain;
+  }
+  *link = shard->entries[index].chain;
+}
+
+static unsigned int _sa_set_once_find(const SASetOnceShard* shard, unsigned long long hash) {
+  unsigned int index = shard->buckets[hash & shard->bucket_mask];
+  while (SA_SET_ONCE_NIL != index && shard->entries[index].hash != hash) {
+    index = shard->entries[index].chain;
+  }
+  return index;
+}
+
+// 查找并标记为最近使用. 调用时持有 shard->mutex.
+static int _sa_set_once_touch(SASetOnceShard* shard, unsigned long long hash) {
+  unsigned int index = _sa_set_once_find(shard, hash);
+  if (SA_SET_ONCE_NIL == index) {
+    return 0;
+  }
+  if (shard->head != index) {
+    _sa_set_once_unlink(shard, index);
+    _sa_set_once_push_front(shard, index);
+  }
+  return 1;
+}
+
+// 插入一项，已满时淘汰最久未使用的项. 调用时持有 shard->mutex.
+static void _sa_set_once_insert(SASetOnceShard* shard, unsigned long long hash, unsigned long long user) {
+  if (_sa_set_once_touch(shard, hash)) {
+    return;
+  }
+  unsigned int index;
+  if (shard->count < shard->capacity) {
+    index = shard->count++;
+  } else {
+    index = shard->tail;
+    _sa_set_once_unlink(shard, index);
+    _sa_set_once_unchain(shard, index);
+  }
+  SASetOnceEntry* entry = &shard->entries[index];
+  entry->hash = hash;
+  entry->user = user;
+  unsigned int* bucket = &shard->buckets[hash & shard->bucket_mask];
+  entry->chain = *bucket;
+  *bucket = index;
+  _sa_set_once_push_front(shard, index);
+}
+
+// 移除一项，最后一项移到空出的位置，使已用的项保持在 [0, count) 中. 调用时持有 shard->mutex.
+static void _sa_set_once_erase(SASetOnceShard* shard, unsigned int index) {
+  _sa_set_once_unlink(shard, index);
+  _sa_set_once_unchain(shard, index);
+  unsigned int last = --shard->count;
+  if (index == last) {
+    return;
+  }
+  unsigned int* link = &shard->buckets[shard->entries[last].hash & shard->bucket_mask];
+  while (*link != last) {
+    link = &shard->entries[*link].chain;
+  }
+  *link = index;
+  SASetOnceEntry* entry = &shard->entries[index];
+  *entry = shard->entries[last];
+  if (SA_SET_ONCE_NIL != entry->prev) {
+    shard->entries[entry->prev].next = index;
+  } else {
+    shard->head = index;
+  }
+  if (SA_SET_ONCE_NIL != entry->next) {
+    shard->entries[entry->next].prev = index;
+  } else {
+    shard->tail = index;
+  }
+}
+
+// sa_profile_unset 与 sa_profile_delete 之后，同名的 set_once 属性需要重新发送. key 为 NULL 时清除该用户的所有项.
+static void _sa_set_once_forget(SASetOnceCache* cache, const char* distinct_id, const char* key) {
+  if (NULL == cache || NULL == distinct_id) {
+    return;
+  }
+  // profile_unset 与 profile_delete 不带 $project，只作用于默认项目.
+  unsigned long long user = _sa_set_once_user_hash(distinct_id, NULL);
+  SASetOnceShard* shard = _sa_set_once_shard(cache, user);
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&shard->mutex);
+#endif
+  if (NULL != key) {
+    unsigned int index = _sa_set_once_find(shard, _sa_set_once_key_hash(user, key));
+    if (SA_SET_ONCE_NIL != index) {
+      _sa_set_once_erase(shard, index);
+    }
+  } else {
+    unsigned int index = 0;
+    while (index < shard->count) {
+      if (shard->entries[index].user == user) {
+        // 最后一项移到 index，继续检查该位置.
+        _sa_set_once_erase(shard, index);
+      } else {
+        ++index;
+      }
+    }
+  }
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&shard->mutex);
+#endif
+}
+
+static unsigned long long _sa_set_once_entries(SASetOnceCache* cache) {
+  unsigned long long entries = 0;
+  unsigned int i;
+  for (i = 0; i < cache->shard_count; ++i) {
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_LOCK(&cache->shards[i].mutex);
+#endif
+    entries += cache->shards[i].count;
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_UNLOCK(&cache->shards[i].mutex);
+#endif
+  }
+  return entries;
+}
+
+int sa_set_profile_set_once_cache(unsigned long capacity, unsigned int shards, SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (0 == shards) {
+    shards = SA_SET_ONCE_DEFAULT_SHARDS;
+  }
+  unsigned long per_shard = (capacity + shards - 1) / shards;
+  if (per_shard >= SA_SET_ONCE_NIL) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SASetOnceCache* cache = sa->set_once_cache;
+  unsigned int i;
+  if (NULL != cache) {
+    for (i = 0; i < cache->shard_count; ++i) {
+      SASetOnceShard* shard = &cache->shards[i];
+#if defined(SA_HAS_THREADS)
+      SA_MUTEX_DESTROY(&shard->mutex);
+#endif
+      SA_RELEASE(shard->entries, sizeof(SASetOnceEntry) * shard->capacity);
+      SA_RELEASE(shard->buckets, sizeof(unsigned int) * (shard->bucket_mask + 1));
+    }
+    SA_RELEASE(cache->shards, sizeof(SASetOnceShard) * cache->shard_count);
+    SA_RELEASE(cache, sizeof(SASetOnceCache));
+    sa->set_once_cache = NULL;
+  }
+  if (0 == capacity) {
+    return SA_OK;
+  }
+
+  cache = (SASetOnceCache*)SA_ALLOC(sizeof(SASetOnceCache));
+  cache->shard_count = shards;
+  cache->shards = (SASetOnceShard*)SA_ALLOC(sizeof(SASetOnceShard) * shards);
+  for (i = 0; i < shards; ++i) {
+    SASetOnceShard* shard = &cache->shards[i];
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_INIT(&shard->mutex);
+#endif
+    shard->capacity = (unsigned int)per_shard;
+    shard->count = 0;
+    shard->entries = (SASetOnceEntry*)SA_ALLOC(sizeof(SASetOnceEntry) * per_shard);
+    // 桶数为不小于容量的 2 的幂，平均链长不超过 1.
+    unsigned long buckets = 1;
+    while (buckets < per_shard) {
+      buckets <<= 1;
+    }
+    shard->bucket_mask = (unsigned int)(buckets - 1);
+    shard->buckets = (unsigned int*)SA_ALLOC(sizeof(unsigned int) * buckets);
+    memset(shard->buckets, 0xff, sizeof(unsigned int) * buckets);
+    shard->head = SA_SET_ONCE_NIL;
+    shard->tail = SA_SET_ONCE_NIL;
+  }
+  sa->set_once_cache = cache;
+  return SA_OK;
+}
+
+// 固定顺序输出 -------------------------------------------------------------
+
+typedef struct SACanonicalKey {
+  char* key;
+  unsigned long rank;
+} SACanonicalKey;
+
+// 调用方的一个属性，rank 为在 keys 中的位置，order 为在属性列表中的位置.
+// 来自预序列化片段的属性 node 为 NULL，text 指向片段中的 "key":value.
+typedef struct {
+  const SANode* node;
+  const char* text;
+  unsigned long length;
+  unsigned long rank;
+  unsigned long order;
+} SACanonicalMember;
+
+static int _sa_compare_canonical_key(const void* a, const void* b) {
+  return strcmp(((const SACanonicalKey*)a)->key, ((const SACanonicalKey*)b)->key);
+}
+
+// 先按 keys 中的顺序，其余按调用顺序. 属性列表中新加入的属性在前，order 越大越早加入.
+static int _sa_compare_canonical_member(const void* a, const void* b) {
+  const SACanonicalMember* x = (const SACanonicalMember*)a;
+  const SACanonicalMember* y = (const SACanonicalMember*)b;
+  if (x->rank != y->rank) {
+    return x->rank < y->rank ? -1 : 1;
+  }
+  return x->order > y->order ? -1 : (x->order < y->order ? 1 : 0);
+}
+
+int sa_set_canonical_order(
+    SABool canonical, const char* const* keys, unsigned long count, SensorsAnalytics* sa) {
+  if (NULL == sa || (NULL == keys && count > 0)) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  unsigned long i;
+  for (i = 0; i < sa->canonical_key_count; ++i) {
+    SA_RELEASE(sa->canonical_keys[i].key, strlen(sa->canonical_keys[i].key) + 1);
+  }
+  if (NULL != sa->canonical_keys) {
+    SA_RELEASE(sa->canonical_keys, sizeof(SACanonicalKey) * sa->canonical_key_count);
+  }
+  sa->canonical_keys = NULL;
+  sa->canonical_key_count = 0;
+  sa->canonical = canonical ? 1 : 0;
+  if (!canonical || 0 == count) {
+    return SA_OK;
+  }
+
+  sa->canonical_keys = (SACanonicalKey*)SA_ALLOC(sizeof(SACanonicalKey) * count);
+  for (i = 0; i < count; ++i) {
+    unsigned long length = strlen(keys[i]);
+    sa->canonical_keys[i].key = (char*)SA_ALLOC(length + 1);
+    memcpy(sa->canonical_keys[i].key, keys[i], length + 1);
+    sa->canonical_keys[i].rank = i;
+  }
+  sa->canonical_key_count = count;
+  qsort(sa->canonical_keys, count, sizeof(SACanonicalKey), &_sa_compare_canonical_key);
+  return SA_OK;
+}
+
+// 调用方属性的排序位置: keys 中的属性为其下标，其他属性排在之后.
+static unsigned long _sa_canonical_rank(const char* key, const SensorsAnalytics* sa) {
+  if (0 == sa->canonical_key_count) {
+    return 0;
+  }
+  SACanonicalKey target;
+  target.key = (char*)key;
+  const SACanonicalKey* found = (const SACanonicalKey*)bsearch(
+      &target, sa->canonical_keys, sa->canonical_key_count, sizeof(SACanonicalKey),
+      &_sa_compare_canonical_key);
+  return NULL != found ? found->rank : sa->canonical_key_count;
+}
+
+// 返回预序列化片段中从 p 开始的一个 "key":value 的结尾，即其后的 ',' 或片段结尾.
+// 属性名不含需要转义的字符，值中的字符串可能含有转义的 '"'.
+static const char* _sa_fragment_member_end(const char* p, const char* end) {
+  int depth = 0;
+  int in_string = 0;
+  for (; p < end; ++p) {
+    if (in_string) {
+      if ('\\' == *p) {
+        ++p;
+      } else if ('"' == *p) {
+        in_string = 0;
+      }
+    } else if ('"' == *p) {
+      in_string = 1;
+    } else if ('{' == *p || '[' == *p) {
+      ++depth;
+    } else if ('}' == *p || ']' == *p) {
+      --depth;
+    } else if (',' == *p && 0 == depth) {
+      break;
+    }
+  }
+  return p;
+}
+
+static SACanonicalMember* _sa_canonical_members_grow(
+    SACanonicalMember* members, SACanonicalMember* local, unsigned long count, unsigned long* capacity) {
+  SACanonicalMember* grown = (SACanonicalMember*)SA_ALLOC(sizeof(SACanonicalMember) * *capacity * 2);
+  memcpy(grown, members, sizeof(SACanonicalMember) * count);
+  if (members != local) {
+    SA_RELEASE(members, sizeof(SACanonicalMember) * *capacity);
+  }
+  *capacity *= 2;
+  return grown;
+}
+
+static int _sa_dump_member(const char* key, const struct SANode* value, SAStringBuffer* sb, int* written) {
+  if ((*written)++ > 0) {
+    _sa_sb_putc(sb, ',');
+  }
+  _sa_sb_putc(sb, '"');
+  _sa_sb_put(sb, key, strlen(key));
+  _sa_sb_put(sb, "\":", 2);
+  return _sa_dump_node(value, sb);
+}
+
+// 按固定的顺序序列化一条已检查过的事件. 每个调用点输出的字段名和常量值连成尽量长的相同片段，
+// 每条事件都不同的 time 与 distinct_id 放在最后. 调用方的属性为 SANode（properties）或
+// 预序列化的片段（fragment），片段中的 $time 与 $project 不改写为顶层字段.
+static int _sa_dump_canonical_event(
+  const char* distinct_id,
+  const char* origin_id,
+  const char* type,
+  const char* event,
+  const struct SANode* properties,
+  const char* fragment,
+  unsigned long length,
+  const char* __file__,
+  const char* __function__,
+  unsigned long __line__,
+  SensorsAnalytics* sa,
+  const SAScope* scope,
+  SAStringBuffer* sb) {
+  const int track = _sa_is_track(type) || _sa_is_track_signup(type);
+  char buf[256];
+
+  // 调用方的属性，$time 与 $project 改写为顶层字段.
+  long long time_ms = _sa_now_ms();
+  const char* project = NULL;
+  SACanonicalMember local[32];
+  SACanonicalMember* members = local;
+  unsigned long count = 0;
+  unsigned long capacity = sizeof(local) / sizeof(local[0]);
+  unsigned long order = 0;
+  const SAListNode* curr;
+  for (curr = NULL != properties ? properties->array_ : NULL; NULL != curr; curr = curr->next) {
+    const SANode* node = curr->value;
+    if (0 == strncmp("$time", node->key, 256)) {
+      if (SA_DATE == node->tag) {
+        time_ms = (long long)node->date_.seconds * 1000 + node->date_.microseconds / 1000;
+      }
+    } else if (0 == strncmp("$project", node->key, 256)) {
+      if (SA_STRING == node->tag) {
+        project = node->string_;
+      }
+    } else {
+      if (count == capacity) {
+        members = _sa_canonical_members_grow(members, local, count, &capacity);
+      }
+      members[count].node = node;
+      members[count].text = NULL;
+      members[count].length = 0;
+      members[count].rank = _sa_canonical_rank(node->key, sa);
+      members[count].order = order;
+      ++count;
+    }
+    ++order;
+  }
+  // 片段中的属性按写入的顺序排列，order 递减，与属性列表中新加入的在前一致.
+  const char* end = fragment + length;
+  const char* p = fragment;
+  order = (unsigned long)-1;
+  while (length > 0 && p < end) {
+    const char* member_end = _sa_fragment_member_end(p, end);
+    const char* key_end = (const char*)memchr(p + 1, '"', member_end - p - 1);
+    char key[256];
+    unsigned long key_len = NULL != key_end ? (unsigned long)(key_end - p - 1) : 0;
+    if (key_len >= sizeof(key)) {
+      key_len = sizeof(key) - 1;
+    }
+    memcpy(key, p + 1, key_len);
+    key[key_len] = 0;
+    if (count == capacity) {
+      members = _sa_canonical_members_grow(members, local, count, &capacity);
+    }
+    members[count].node = NULL;
+    members[count].text = p;
+    members[count].length = (unsigned long)(member_end - p);
+    members[count].rank = _sa_canonical_rank(key, sa);
+    members[count].order = order--;
+    ++count;
+    p = member_end + 1;
+  }
+  qsort(members, count, sizeof(SACanonicalMember), &_sa_compare_canonical_member);
+
+  int res;
+  _sa_sb_put(sb, "{\"type\":", strlen("{\"type\":"));
+  res = _sa_dump_cstring(type, sb);
+  if (SA_OK == res && track) {
+    _sa_sb_put(sb, ",\"event\":", strlen(",\"event\":"));
+    res = _sa_dump_cstring(event, sb);
+  }
+  if (SA_OK == res && NULL != project) {
+    _sa_sb_put(sb, ",\"project\":", strlen(",\"project\":"));
+    res = _sa_dump_cstring(project, sb);
+  }
+
+  if (SA_OK == res) {
+    _sa_sb_put(sb, ",\"lib\":{\"$lib\":\"" SA_LIB "\",\"$lib_version\":\"" SA_LIB_VERSION
+               "\",\"$lib_method\":\"" SA_LIB_METHOD "\",\"$lib_detail\":",
+               strlen(",\"lib\":{\"$lib\":\"" SA_LIB "\",\"$lib_version\":\"" SA_LIB_VERSION
+                      "\",\"$lib_method\":\"" SA_LIB_METHOD "\",\"$lib_detail\":"));
+    snprintf(buf, sizeof(buf), "##%s##%s##%ld", __function__, __file__, __line__);
+    res = _sa_dump_cstring(buf, sb);
+  }
+
+  int written = 0;
+  unsigned long i;
+  if (SA_OK == res) {
+    _sa_sb_put(sb, "},\"properties\":{", strlen("},\"properties\":{"));
+    for (i = 0; i < count && SA_OK == res; ++i) {
+      if (NULL != members[i].node) {
+        res = _sa_dump_member(members[i].node->key, members[i].node, sb, &written);
+      } else {
+        if (written++ > 0) {
+          _sa_sb_putc(sb, ',');
+        }
+        _sa_sb_put(sb, members[i].text, members[i].length);
+      }
+    }
+  }
+
+  if (SA_OK == res && track) {
+    if (NULL != scope) {
+      unsigned long before = sb->streamed + (unsigned long)(sb->cur - sb->start);
+      _sa_dump_scope(scope, properties, fragment, length, written, sb);
+      if (sb->streamed + (unsigned long)(sb->cur - sb->start) != before) {
+        written = 1;
+      }
+    }
+
+#if defined(USE_POSIX)
+    pthread_mutex_lock(&sa->mutex);
+#elif defined(_WIN32)
+    EnterCriticalSection(&sa->mutex);
+#endif
+    // 公共属性链表中后注册的在前，逆序输出，即按注册的顺序.
+    const SANode* local_supers[32];
+    const SANode** supers = local_supers;
+    unsigned long super_count = 0;
+    for (curr = sa->super_properties->array_; NULL != curr; curr = curr->next) {
+      ++super_count;
+    }
+    if (super_count > sizeof(local_supers) / sizeof(local_supers[0])) {
+      supers = (const SANode**)SA_ALLOC(sizeof(const SANode*) * super_count);
+    }
+    i = super_count;
+    for (curr = sa->super_properties->array_; NULL != curr; curr = curr->next) {
+      supers[--i] = curr->value;
+    }
+    for (i = 0; i < super_count && SA_OK == res; ++i) {
+      if ((NULL == properties || NULL == _sa_get_child(supers[i]->key, properties))
+          && (0 == length || !_sa_fragment_has_key(fragment, length, supers[i]->key))
+          && (NULL == scope || !_sa_fragment_has_key(scope->fragment, scope->length, supers[i]->key))) {
+        res = _sa_dump_member(supers[i]->key, supers[i], sb, &written);
+      }
+    }
+    if (supers != local_supers) {
+      SA_RELEASE(supers, sizeof(const SANode*) * super_count);
+    }
+    // 同名的公共属性或调用方属性覆盖 $lib 与 $lib_version.
+    static const char* kLibKeys[] = { "$lib", "$lib_version" };
+    static const char* kLibValues[] = { SA_LIB, SA_LIB_VERSION };
+    int k;
+    for (k = 0; k < 2; ++k) {
+      if (NULL == _sa_get_child(kLibKeys[k], sa->super_properties)
+          && (NULL == properties || NULL == _sa_get_child(kLibKeys[k], properties))
+          && (0 == length || !_sa_fragment_has_key(fragment, length, kLibKeys[k]))) {
+        if (written++ > 0) {
+          _sa_sb_putc(sb, ',');
+        }
+        _sa_sb_putc(sb, '"');
+        _sa_sb_put(sb, kLibKeys[k], strlen(kLibKeys[k]));
+        _sa_sb_put(sb, "\":", 2);
+        _sa_dump_cstring(kLibValues[k], sb);
+      }
+    }
+#if defined(USE_POSIX)
+    pthread_mutex_unlock(&sa->mutex);
+#elif defined(_WIN32)
+    LeaveCriticalSection(&sa->mutex);
+#endif
+  }
+
+  if (SA_OK == res) {
+    snprintf(buf, sizeof(buf), "},\"time\":%lld,\"distinct_id\":", time_ms);
+    _sa_sb_put(sb, buf, strlen(buf));
+    res = _sa_dump_cstring(distinct_id, sb);
+  }
+  if (SA_OK == res && _sa_is_track_signup(type)) {
+    _sa_sb_put(sb, ",\"original_id\":", strlen(",\"original_id\":"));
+    res = _sa_dump_cstring(origin_id, sb);
+  }
+  if (SA_OK == res) {
+    _sa_sb_putc(sb, '}');
+  }
+
+  if (members != local) {
+    SA_RELEASE(members, sizeof(SACanonicalMember) * capacity);
+  }
+  return res;
+}
+
+// 检查并序列化一条事件，追加写入 sb.
+static int _sa_serialize_event(
+  const char* distinct_id,
+  const char* origin_id,
+  const char* type,
+  const char* event,
+  const struct SANode* properties,
+  const char* __file__,
+  const char* __function__,
+  unsigned long __line__,
+  SensorsAnalytics* sa,
+  const SAScope* scope,
+  SAStringBuffer* sb,
+  SAProfileSample* sample) {
+  int res = SA_OK;
+
+  // 合法性检查.
+  if (SA_OK != (res = _sa_check_legality(distinct_id, origin_id, type, event, properties))) {
+    SA_PROBE3(validate__fail, type, event, res);
+    SA_ATOMIC_ADD64(&sa->stats.invalid, 1);
+    return res;
+  }
+  SA_PROFILE_STAMP(sample, SA_PROFILE_VALIDATE);
+
+  // 与公共属性相同，作用域属性只加入 track 类事件.
+  if (!_sa_is_track(type)) {
+    scope = NULL;
+  }
+
+  if (sa->canonical) {
+    res = _sa_dump_canonical_event(distinct_id, origin_id, type, event, properties, NULL, 0,
+                                   __file__, __function__, __line__, sa, scope, sb);
+    SA_PROFILE_STAMP(sample, SA_PROFILE_MERGE);
+    SA_PROFILE_STAMP(sample, SA_PROFILE_SERIALIZE);
+    return res;
+  }
+
+  // msg 记录一个事件，例如: {"type" : "track", "event" : "AppStart", "distinct_id" : "12345", "properties" : { ... }, ...}
+  SANode* msg = _sa_init_dict_node(NULL);
+
+  // 写入 type 字段.
+  if (SA_OK != (res = sa_add_string("type", type, strlen(type), msg))) {
+    return res;
+  }
+  // TODO: 写入 lib 字段
+  // 写入 distinct id.
+  if (SA_OK != (res = sa_add_string("distinct_id", distinct_id, strlen(distinct_id), msg))) {
+    return res;
+  }
+  // 写入 origin id.
+  if (_sa_is_track_signup(type)) {
+    if (SA_OK != (res = sa_add_string("original_id", origin_id, strlen(origin_id), msg))) {
+      return res;
+    }
+  }
+  // 写入 event 字段.
+  if (_sa_is_track(type) || _sa_is_track_signup(type)) {
+    sa_add_string("event", event, strlen(event), msg);
+  }
+
+  // 写入 time 字段.
+  if (SA_OK != (res = sa_add_int("time", _sa_now_ms(), msg))) {
+    return res;
+  }
+
+  // 埋点管理信息
+  // "lib":{"$lib_method":"code","$lib_detail":"testMethod##testDebug##test_sdk.py##60","$lib_version":"1.5.1","$lib":"python"}
+  SANode* lib_properties = _sa_init_dict_node("lib");
+
+  sa_add_string("$lib", SA_LIB, strlen(SA_LIB), lib_properties);
+  sa_add_string("$lib_version", SA_LIB_VERSION, strlen(SA_LIB_VERSION), lib_properties);
+  sa_add_string("$lib_method", SA_LIB_METHOD, strlen(SA_LIB_METHOD), lib_properties);
+  char lib_detail_buf[256];
+  snprintf(lib_detail_buf, 256, "##%s##%s##%ld", __function__, __file__, __line__);
+  sa_add_string("$lib_detail", lib_detail_buf, strlen(lib_detail_buf), lib_properties);
+
+  _sa_add_child(lib_properties, msg);
+
+  sa_free_properties(lib_properties);
+
+  // 事件属性.
+  SANode* inner_properties = _sa_init_dict_node("properties");
+  if (NULL == inner_properties) {
+    return SA_MALLOC_ERROR;
+  }
+
+  if (_sa_is_track(type) || _sa_is_track_signup(type)) {
+    // 属性中加入 $lib 和 $lib_version.
+    sa_add_string("$lib", SA_LIB, strlen(SA_LIB), inner_properties);
+    sa_add_string("$lib_version", SA_LIB_VERSION, strlen(SA_LIB_VERSION), inner_properties);
+
+#if defined(USE_POSIX)
+    pthread_mutex_lock(&sa->mutex);
+#elif defined(_WIN32)
+    EnterCriticalSection(&sa->mutex);
+#endif
+    // 作用域中的同名属性优先于公共属性.
+    SAListNode* curr = sa->super_properties->array_;
+    while (NULL != curr) {
+      if (NULL == scope || !_sa_fragment_has_key(scope->fragment, scope->length, curr->value->key)) {
+        _sa_add_child(curr->value, inner_properties);
+      }
+      curr = curr->next;
+    }
+#if defined(USE_POSIX)
+    pthread_mutex_unlock(&sa->mutex);
+#elif defined(_WIN32)
+    LeaveCriticalSection(&sa->mutex);
+#endif
+  }
+
+  // 浅拷贝传入的 properties.
+  if (NULL != properties) {
+    SAListNode* curr = properties->array_;
+    while (NULL != curr) {
+      if (NULL != curr->value->key && 0 == strncmp("$time", curr->value->key, 256)) {
+        // 若属性中包含 "$time" 对象，则使用它作为事件时间.
+        SANode* time_node = _sa_get_child("$time", properties);
+        if (NULL != time_node) {
+          if (SA_OK != (res = sa_add_int(
+                "time",
+                (long)(time_node->date_.seconds) * 1000
+                + (long)time_node->date_.microseconds / 1000,
+                msg))) {
+            return res;
+          }
+        }
+      } else if (NULL != curr->value->key && 0 == strncmp("$project", curr->value->key, 256)) {
+        // 若属性中包含 "$project" 对象，则将其改写为 project 属性.
+        SANode* project_node = _sa_get_child("$project", properties);
+        if (NULL != project_node) {
+          if (SA_OK != (res = sa_add_string(
+                "project",
+                project_node->string_,
+                strlen(project_node->string_),
+                msg))) {
+            return res;
+          }
+        }
+      } else {
+        _sa_add_child(curr->value, inner_properties);
+      }
+      curr = curr->next;
+    }
+  }
+
+  SA_PROFILE_STAMP(sample, SA_PROFILE_MERGE);
+
+  // 序列化为字符串.
+  if (NULL == scope) {
+    // 写入 properties 字段.
+    _sa_add_child(inner_properties, msg);
+    _sa_dump_node(msg, sb);
+  } else {
+    // 作用域属性已预先序列化，直接拼接在 properties 字段中.
+    int written = 0;
+    _sa_sb_put(sb, "{\"properties\":{", strlen("{\"properties\":{"));
+    _sa_dump_members(inner_properties, sb, &written);
+    _sa_dump_scope(scope, properties, NULL, 0, written, sb);
+    _sa_sb_putc(sb, '}');
+    written = 1;
+    _sa_dump_members(msg, sb, &written);
+    _sa_sb_putc(sb, '}');
+  }
+  SA_PROFILE_STAMP(sample, SA_PROFILE_SERIALIZE);
+
+  sa_free_properties(inner_properties);
+  _sa_free_node(msg);
+
+  return res;
+}
+
+static int _sa_track_internal(
+  const char* distinct_id,
+  const char* origin_id,
+  const char* type,
+  const char* event,
+  const struct SANode* properties,
+  const char* __file__,
+  const char* __function__,
+  unsigned long __line__,
+  SensorsAnalytics* sa) {
+  int res = SA_OK;
+
+  // 探针 track__entry(类型, 事件名) 与 track__return(类型, 事件名, 结果).
+  SA_PROBE2(track__entry, type, event);
+
+  SAStringBuffer sb;
+  if (SA_OK != (res = _sa_event_sb_init(&sb, sa))) {
+    SA_PROBE3(track__return, type, event, res);
+    return res;
+  }
+
+  SAProfileSample sample_buf;
+  SAProfileSample* sample = _sa_profile_begin(sa, 1, &sample_buf);
+
+  if (SA_OK == (res = _sa_serialize_event(distinct_id, origin_id, type, event, properties,
+                                          __file__, __function__, __line__, sa,
+                                          _sa_scope_find(sa), &sb, sample))) {
+    unsigned long msg_length = 0;
+    const char* msg_str = _sa_sb_finish(&sb, &msg_length);
+    SA_PROBE2(serialize__done, type, sb.streamed + msg_length);
+
+    // 使用 sa 发送事件，已分段写入的事件只写入剩余部分.
+    res = sb.streamed > 0 ? _sa_send_stream(sa, &sb) : _sa_send(sa, msg_str, msg_length, 0);
+    SA_PROFILE_STAMP(sample, SA_PROFILE_SEND);
+    _sa_profile_commit(sa, sample);
+  }
+
+  _sa_sb_free(&sb);
+
+  SA_PROBE3(track__return, type, event, res);
+  return res;
+}
+
+int sa_reserve(unsigned int expected_threads, unsigned long expected_event_bytes, SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  // 之后按预计大小一次分配序列化缓冲区，避免从 16 字节开始逐步扩容.
+  if (expected_event_bytes > 0) {
+    SA_ATOMIC_STORE(&sa->event_bytes, (long)expected_event_bytes);
+  }
+
+  // 已开启采样时，为尚未采样过的线程预先分配样本缓冲区.
+  if (SA_ATOMIC_LOAD(&sa->profile_interval) > 0) {
+    unsigned int rings = 0;
+    SAProfileRing* ring;
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_LOCK(&sa->mutex);
+#endif
+    for (ring = sa->profile_rings; NULL != ring; ring = ring->next) {
+      ++rings;
+    }
+    for (ring = sa->profile_spare; NULL != ring; ring = ring->next) {
+      ++rings;
+    }
+    for (; rings < expected_threads; ++rings) {
+      ring = (SAProfileRing*)SA_ALLOC(sizeof(SAProfileRing));
+      memset(ring, 0, sizeof(SAProfileRing));
+      ring->next = sa->profile_spare;
+      sa->profile_spare = ring;
+    }
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_UNLOCK(&sa->mutex);
+#endif
+  }
+
+  // 序列化一条包含各种类型属性的事件但不发送，完成时区、分配器等的首次初始化.
+  SAProperties* properties = sa_init_properties();
+  if (NULL == properties) {
+    return SA_MALLOC_ERROR;
+  }
+  sa_add_string("sa_reserve_string", "sa_reserve", strlen("sa_reserve"), properties);
+  sa_add_int("sa_reserve_int", 1, properties);
+  sa_add_number("sa_reserve_number", 1.0, properties);
+  sa_add_bool("sa_reserve_bool", SA_TRUE, properties);
+  sa_add_date("sa_reserve_date", time(NULL), 0, properties);
+  sa_append_list("sa_reserve_list", "sa_reserve", strlen("sa_reserve"), properties);
+
+  SAStringBuffer sb;
+  _sa_sb_init_size(&sb, expected_event_bytes);
+  int res = _sa_serialize_event("sa_reserve", NULL, "track", "SAReserve", properties,
+                                __FILE__, "sa_reserve", __LINE__, sa, NULL, &sb, NULL);
+  _sa_sb_free(&sb);
+  _sa_serialize_pool_reserve(properties, sa);
+  sa_free_properties(properties);
+
+  // 打开 Consumer 的日志文件.
+  int consumer_res = _sa_consumer_reserve(sa->consumer);
+  return SA_OK != res ? res : consumer_res;
+}
+
+
+// 不经过 SANode，直接将事件序列化为 JSON. properties 为预序列化的属性片段.
+static int _sa_dump_serialized_event(
+  const char* distinct_id,
+  const char* type,
+  const char* event,
+  const char* properties,
+  unsigned long length,
+  const char* __file__,
+  const char* __function__,
+  unsigned long __line__,
+  SensorsAnalytics* sa,
+  const SAScope* scope,
+  SAStringBuffer* sb) {
+  char buf[256];
+  int res = SA_OK;
+
+  _sa_sb_put(sb, "{\"type\":", strlen("{\"type\":"));
+  if (SA_OK != (res = _sa_dump_cstring(type, sb))) {
+    return res;
+  }
+  _sa_sb_put(sb, ",\"event\":", strlen(",\"event\":"));
+  if (SA_OK != (res = _sa_dump_cstring(event, sb))) {
+    return res;
+  }
+  snprintf(buf, sizeof(buf), ",\"time\":%lld,\"distinct_id\":", _sa_now_ms());
+  _sa_sb_put(sb, buf, strlen(buf));
+  if (SA_OK != (res = _sa_dump_cstring(distinct_id, sb))) {
+    return res;
+  }
+
+  // 埋点管理信息.
+  _sa_sb_put(sb, ",\"lib\":{\"$lib\":\"" SA_LIB "\",\"$lib_version\":\"" SA_LIB_VERSION
+             "\",\"$lib_method\":\"" SA_LIB_METHOD "\",\"$lib_detail\":",
+             strlen(",\"lib\":{\"$lib\":\"" SA_LIB "\",\"$lib_version\":\"" SA_LIB_VERSION
+                    "\",\"$lib_method\":\"" SA_LIB_METHOD "\",\"$lib_detail\":"));
+  snprintf(buf, sizeof(buf), "##%s##%s##%ld", __function__, __file__, __line__);
+  if (SA_OK != (res = _sa_dump_cstring(buf, sb))) {
+    return res;
+  }
+
+  // 事件属性，依次为 $lib、$lib_version、未被覆盖的公共属性、未被覆盖的作用域属性以及调用方的属性.
+  _sa_sb_put(sb, "},\"properties\":{\"$lib\":\"" SA_LIB "\",\"$lib_version\":\"" SA_LIB_VERSION "\"",
+             strlen("},\"properties\":{\"$lib\":\"" SA_LIB "\",\"$lib_version\":\"" SA_LIB_VERSION "\""));
+
+#if defined(USE_POSIX)
+  pthread_mutex_lock(&sa->mutex);
+#elif defined(_WIN32)
+  EnterCriticalSection(&sa->mutex);
+#endif
+  SAListNode* curr = sa->super_properties->array_;
+  while (NULL != curr) {
+    if (!_sa_fragment_has_key(properties, length, curr->value->key)
+        && (NULL == scope || !_sa_fragment_has_key(scope->fragment, scope->length, curr->value->key))) {
+      _sa_sb_put(sb, ",\"", 2);
+      _sa_sb_put(sb, curr->value->key, strlen(curr->value->key));
+      _sa_sb_put(sb, "\":", 2);
+      if (SA_OK != (res = _sa_dump_node(curr->value, sb))) {
+        break;
+      }
+    }
+    curr = curr->next;
+  }
+#if defined(USE_POSIX)
+  pthread_mutex_unlock(&sa->mutex);
+#elif defined(_WIN32)
+  LeaveCriticalSection(&sa->mutex);
+#endif
+  if (SA_OK != res) {
+    return res;
+  }
+
+  if (NULL != scope) {
+    _sa_dump_scope(scope, NULL, properties, length, 1, sb);
+  }
+  if (length > 0) {
+    _sa_sb_putc(sb, ',');
+    _sa_sb_put(sb, properties, length);
+  }
+  _sa_sb_put(sb, "}}", 2);
+
+  return SA_OK;
+}
+
+int _sa_track_serialized(
+        const char* distinct_id,
+        const char* event,
+        const char* properties,
+        unsigned long length,
+        unsigned int flags,
+        const char* __file__,
+        const char* __function__,
+        unsigned long __line__,
+        SensorsAnalytics* sa) {
+  int res = SA_OK;
+
+  if (NULL == sa || NULL == event || (NULL == properties && length > 0)) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+
+  SA_PROBE2(track__entry, "track", event);
+
+  SAProfileSample sample_buf;
+  SAProfileSample* sample = _sa_profile_begin(sa, 1, &sample_buf);
+
+  // 合法性检查，属性名由调用方保证合法.
+  if (flags & SA_TRACK_TRUSTED_EVENT) {
+    // 事件名已由调用方检查.
+    res = _sa_check_distinct_id(distinct_id);
+  } else {
+    res = _sa_check_legality(distinct_id, NULL, "track", event, NULL);
+  }
+  if (SA_OK != res) {
+    SA_PROBE3(validate__fail, "track", event, res);
+    SA_ATOMIC_ADD64(&sa->stats.invalid, 1);
+    SA_PROBE3(track__return, "track", event, res);
+    return res;
+  }
+
+  // 属性已预先序列化，合并与序列化计为一个阶段.
+  SA_PROFILE_STAMP(sample, SA_PROFILE_VALIDATE);
+  SA_PROFILE_STAMP(sample, SA_PROFILE_MERGE);
+
+  SAStringBuffer sb;
+  if (SA_OK != (res = _sa_event_sb_init(&sb, sa))) {
+    SA_PROBE3(track__return, "track", event, res);
+    return res;
+  }
+
+  // 固定顺序输出时与 sa_track 使用同一个序列化过程.
+  if (sa->canonical) {
+    res = _sa_dump_canonical_event(distinct_id, NULL, "track", event, NULL, properties, length,
+                                   __file__, __function__, __line__, sa, _sa_scope_find(sa), &sb);
+  } else {
+    res = _sa_dump_serialized_event(distinct_id, "track", event, properties, length,
+                                    __file__, __function__, __line__, sa, _sa_scope_find(sa), &sb);
+  }
+  if (SA_OK == res) {
+    unsigned long msg_length = 0;
+    const char* msg_str = _sa_sb_finish(&sb, &msg_length);
+    SA_PROBE2(serialize__done, "track", sb.streamed + msg_length);
+    SA_PROFILE_STAMP(sample, SA_PROFILE_SERIALIZE);
+
+    // 使用 sa 发送事件，已分段写入的事件只写入剩余部分.
+    res = sb.streamed > 0 ? _sa_send_stream(sa, &sb) : _sa_send(sa, msg_str, msg_length, flags);
+    SA_PROFILE_STAMP(sample, SA_PROFILE_SEND);
+    _sa_profile_commit(sa, sample);
   }
-  if (NULL != properties) {
-    SAListNode* curr = properties->array_;
-    while (NULL != curr) {
-      if (NULL == curr->value->key
-#if defined(USE_POSIX)
-        || SA_OK != _sa_assert_key_name(curr->value->key, sa->regex)) {
-#elif defined(_WIN32)
-        || SA_OK != _sa_assert_key_name(curr->value->key, sa->regex)) {
-#else
-        || SA_OK != _sa_assert_key_name(curr->value->key)) {
-#endif
-        fprintf(stderr, "Invalid property name [%s].\n",
-          NULL == curr->value->key ? "NULL" : curr->value->key);
-        return SA_INVALID_PARAMETER_ERROR;
-      }
-      curr = curr->next;
+
+  _sa_sb_free(&sb);
+
+  SA_PROBE3(track__return, "track", event, res);
+  return res;
+}
+
+// 批量跟踪事件 ----------------------------------------------------------------
+
+// 每个任务序列化的事件条数.
+#define SA_BATCH_CHUNK_SIZE 64
+
+struct SASerializeBatch;
+
+// 序列化任务，负责 batch 中 [begin, end) 范围内的事件.
+typedef struct {
+  struct SASerializeBatch* batch;
+  unsigned long begin;
+  unsigned long end;
+  // 依次存放各事件序列化的结果，事件之间以 '\0' 分隔.
+  SAStringBuffer sb;
+} SASerializeChunk;
+
+typedef struct SASerializeBatch {
+  const SATrackRecord* records;
+  const char* file;
+  const char* function;
+  unsigned long line;
+  SensorsAnalytics* sa;
+  // 调用线程的作用域，工作线程中没有调用线程的线程局部数据.
+  const SAScope* scope;
+  // 各事件的检查结果，以及序列化结果在所属任务缓冲区中的位置和长度.
+  int* results;
+  unsigned long* offsets;
+  unsigned long* lengths;
+  // 尚未完成的任务数，由线程池的 mutex 保护.
+  unsigned long pending;
+} SASerializeBatch;
+
+static void _sa_serialize_chunk(SASerializeChunk* chunk) {
+  SASerializeBatch* batch = chunk->batch;
+  unsigned long i;
+
+  _sa_sb_init_size(&chunk->sb, (unsigned long)SA_ATOMIC_LOAD(&batch->sa->event_bytes) * SA_BATCH_CHUNK_SIZE);
+  for (i = chunk->begin; i < chunk->end; ++i) {
+    const SATrackRecord* record = batch->records + i;
+    unsigned long offset = chunk->sb.cur - chunk->sb.start;
+
+    batch->offsets[i] = offset;
+    batch->results[i] = _sa_serialize_event(record->distinct_id, NULL, "track", record->event,
+                                            record->properties, batch->file, batch->function,
+                                            batch->line, batch->sa, batch->scope, &chunk->sb, NULL);
+    if (SA_OK != batch->results[i]) {
+      // 丢弃不合法事件写入的内容.
+      chunk->sb.cur = chunk->sb.start + offset;
+      continue;
+    }
+    batch->lengths[i] = (chunk->sb.cur - chunk->sb.start) - offset;
+    SA_PROBE2(serialize__done, "track", batch->lengths[i]);
+    if (chunk->sb.cur >= chunk->sb.end) {
+      _sa_sb_grow(&chunk->sb, 1);
     }
+    *chunk->sb.cur++ = '\0';
   }
-  return SA_OK;
 }
 
-static int _sa_track_internal(
-  const char* distinct_id,
-  const char* origin_id,
-  const char* type,
-  const char* event,
-  const struct SANode* properties,
-  const char* __file__,
-  const char* __function__,
-  unsigned long __line__,
-  SensorsAnalytics* sa) {
-  int res = SA_OK;
+#if defined(SA_HAS_THREADS)
 
-  // 合法性检查.
-  if (SA_OK != (res = _sa_check_legality(distinct_id, origin_id, type, event, properties, sa))) {
-    return res;
+// 工作线程的任务队列. 本线程从头部按顺序取任务，其他线程从尾部窃取.
+typedef struct {
+  SAMutex mutex;
+  SASerializeChunk* chunks;
+  unsigned long head;
+  unsigned long tail;
+} SAWorkDeque;
+
+// 序列化线程池. deques[threads] 属于调用 sa_track_batch 的线程.
+typedef struct SASerializePool {
+  unsigned int threads;
+  SAThread* workers;
+  SAWorkDeque* deques;
+  SAMutex mutex;
+  // 有新的批次或需要退出时通知工作线程.
+  SACond work;
+  // 批次完成时通知调用线程.
+  SACond done;
+  unsigned long generation;
+  int stop;
+  // 同一时间只处理一个批次.
+  SAMutex batch_mutex;
+} SASerializePool;
+
+typedef struct {
+  SASerializePool* pool;
+  unsigned int index;
+} SASerializeWorker;
+
+static SASerializeChunk* _sa_work_deque_pop(SAWorkDeque* deque, SABool steal) {
+  SASerializeChunk* chunk = NULL;
+  SA_MUTEX_LOCK(&deque->mutex);
+  if (deque->head < deque->tail) {
+    chunk = steal ? deque->chunks + --deque->tail : deque->chunks + deque->head++;
   }
+  SA_MUTEX_UNLOCK(&deque->mutex);
+  return chunk;
+}
 
-  // msg 记录一个事件，例如: {"type" : "track", "event" : "AppStart", "distinct_id" : "12345", "properties" : { ... }, ...}
-  SANode* msg = _sa_init_dict_node(NULL);
+// 先处理自己队列中的任务，再从其他队列窃取，直到所有队列为空.
+static void _sa_serialize_pool_work(SASerializePool* pool, unsigned int index) {
+  for (;;) {
+    SASerializeChunk* chunk = _sa_work_deque_pop(pool->deques + index, SA_FALSE);
+    unsigned int i;
+    for (i = 1; NULL == chunk && i <= pool->threads; ++i) {
+      chunk = _sa_work_deque_pop(pool->deques + (index + i) % (pool->threads + 1), SA_TRUE);
+    }
+    if (NULL == chunk) {
+      return;
+    }
 
-  // 写入 type 字段.
-  if (SA_OK != (res = sa_add_string("type", type, strlen(type), msg))) {
-    return res;
-  }
-  // TODO: 写入 lib 字段
-  // 写入 distinct id.
-  if (SA_OK != (res = sa_add_string("distinct_id", distinct_id, strlen(distinct_id), msg))) {
-    return res;
+    _sa_serialize_chunk(chunk);
+
+    SA_MUTEX_LOCK(&pool->mutex);
+    if (0 == --chunk->batch->pending) {
+      SA_COND_SIGNAL(&pool->done);
+    }
+    SA_MUTEX_UNLOCK(&pool->mutex);
   }
-  // 写入 origin id.
-  if (_sa_is_track_signup(type)) {
-    if (SA_OK != (res = sa_add_string("original_id", origin_id, strlen(origin_id), msg))) {
-      return res;
+}
+
+static SA_THREAD_PROC(_sa_serialize_worker_run, arg) {
+  SASerializeWorker* worker = (SASerializeWorker*)arg;
+  SASerializePool* pool = worker->pool;
+  unsigned int index = worker->index;
+  unsigned long generation = 0;
+
+  free(worker);
+
+  SA_MUTEX_LOCK(&pool->mutex);
+  while (!pool->stop) {
+    if (generation != pool->generation) {
+      generation = pool->generation;
+      SA_MUTEX_UNLOCK(&pool->mutex);
+      _sa_serialize_pool_work(pool, index);
+      SA_MUTEX_LOCK(&pool->mutex);
+      continue;
     }
+    SA_COND_WAIT(&pool->work, &pool->mutex);
   }
-  // 写入 event 字段.
-  if (_sa_is_track(type) || _sa_is_track_signup(type)) {
-    sa_add_string("event", event, strlen(event), msg);
+  SA_MUTEX_UNLOCK(&pool->mutex);
+
+  SA_THREAD_RETURN;
+}
+
+static void _sa_serialize_pool_free(SASerializePool* pool) {
+  unsigned int i;
+  if (NULL == pool) {
+    return;
   }
 
-  // 写入 time 字段.
-#if defined(USE_POSIX)
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  if (SA_OK != (res = sa_add_int("time", (long long)now.tv_sec * 1000 + now.tv_usec / 1000, msg))) {
-    return res;
+  SA_MUTEX_LOCK(&pool->mutex);
+  pool->stop = 1;
+  SA_COND_BROADCAST(&pool->work);
+  SA_MUTEX_UNLOCK(&pool->mutex);
+  for (i = 0; i < pool->threads; ++i) {
+    SA_THREAD_JOIN(pool->workers[i]);
   }
-#elif defined(_WIN32)
-  struct timeb now;
-  ftime(&now);
-  if (SA_OK != (res = sa_add_int("time", (long long)now.time * 1000 + now.millitm, msg))) {
-    return res;
+
+  for (i = 0; i <= pool->threads; ++i) {
+    SA_MUTEX_DESTROY(&pool->deques[i].mutex);
   }
-#elif defined(__linux__)
-  struct timespec now;
-  clock_gettime(CLOCK_REALTIME, &now);
-  if (SA_OK != (res = sa_add_int("time", (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000, msg))) {
-    return res;
+  SA_COND_DESTROY(&pool->work);
+  SA_COND_DESTROY(&pool->done);
+  SA_MUTEX_DESTROY(&pool->mutex);
+  SA_MUTEX_DESTROY(&pool->batch_mutex);
+  SA_RELEASE(pool->deques, sizeof(SAWorkDeque) * (pool->threads + 1));
+  SA_RELEASE(pool->workers, sizeof(SAThread) * pool->threads);
+  SA_RELEASE(pool, sizeof(SASerializePool));
+}
+
+static SASerializePool* _sa_serialize_pool_init(unsigned int threads) {
+  SASerializePool* pool = (SASerializePool*)SA_ALLOC(sizeof(SASerializePool));
+  unsigned int i;
+
+  memset(pool, 0, sizeof(SASerializePool));
+  pool->workers = (SAThread*)SA_ALLOC(sizeof(SAThread) * threads);
+  pool->deques = (SAWorkDeque*)SA_ALLOC(sizeof(SAWorkDeque) * (threads + 1));
+  memset(pool->deques, 0, sizeof(SAWorkDeque) * (threads + 1));
+  for (i = 0; i <= threads; ++i) {
+    SA_MUTEX_INIT(&pool->deques[i].mutex);
   }
-#else
-  time_t now = time(NULL);
-  if (SA_OK != (res = sa_add_int("time", (long long)now * 1000, msg))) {
-    return res;
+  SA_MUTEX_INIT(&pool->mutex);
+  SA_MUTEX_INIT(&pool->batch_mutex);
+  SA_COND_INIT(&pool->work);
+  SA_COND_INIT(&pool->done);
+
+  for (i = 0; i < threads; ++i) {
+    // worker 由工作线程释放，因此使用 malloc.
+    SASerializeWorker* worker = (SASerializeWorker*)SA_SAFE_MALLOC(sizeof(SASerializeWorker));
+    worker->pool = pool;
+    worker->index = i;
+    if (!SA_THREAD_CREATE(&pool->workers[i], &_sa_serialize_worker_run, worker)) {
+      _sa_log_error(SA_ERROR_SYSTEM, "Create thread error.");
+      free(worker);
+      break;
+    }
+    pool->threads = i + 1;
   }
-#endif
+  if (pool->threads != threads) {
+    _sa_serialize_pool_free(pool);
+    return NULL;
+  }
+  return pool;
+}
 
-  // 埋点管理信息
-  // "lib":{"$lib_method":"code","$lib_detail":"testMethod##testDebug##test_sdk.py##60","$lib_version":"1.5.1","$lib":"python"}
-  SANode* lib_properties = _sa_init_dict_node("lib");
+// 将批次的任务按顺序分成连续的若干段，分给各线程的队列，调用线程也参与序列化.
+static void _sa_serialize_pool_run(
+  SASerializePool* pool, SASerializeChunk* chunks, unsigned long chunk_count) {
+  unsigned int queues = pool->threads + 1;
+  unsigned long per_queue = (chunk_count + queues - 1) / queues;
+  unsigned long begin = 0;
+  unsigned int i;
+
+  SA_MUTEX_LOCK(&pool->batch_mutex);
+
+  // 仍在上一批次中窃取任务的工作线程可能在任务放入队列后立即取走并减少 pending，
+  // 因此必须先设置 pending，再放入任务.
+  SA_MUTEX_LOCK(&pool->mutex);
+  chunks[0].batch->pending = chunk_count;
+  SA_MUTEX_UNLOCK(&pool->mutex);
+
+  for (i = 0; i < queues; ++i) {
+    unsigned long end = begin + per_queue < chunk_count ? begin + per_queue : chunk_count;
+    SA_MUTEX_LOCK(&pool->deques[i].mutex);
+    pool->deques[i].chunks = chunks;
+    pool->deques[i].head = begin;
+    pool->deques[i].tail = end;
+    SA_MUTEX_UNLOCK(&pool->deques[i].mutex);
+    begin = end;
+  }
 
-  sa_add_string("$lib", SA_LIB, strlen(SA_LIB), lib_properties);
-  sa_add_string("$lib_version", SA_LIB_VERSION, strlen(SA_LIB_VERSION), lib_properties);
-  sa_add_string("$lib_method", SA_LIB_METHOD, strlen(SA_LIB_METHOD), lib_properties);
-  char lib_detail_buf[256];
-  snprintf(lib_detail_buf, 256, "##%s##%s##%ld", __function__, __file__, __line__);
-  sa_add_string("$lib_detail", lib_detail_buf, strlen(lib_detail_buf), lib_properties);
+  SA_MUTEX_LOCK(&pool->mutex);
+  ++pool->generation;
+  SA_COND_BROADCAST(&pool->work);
+  SA_MUTEX_UNLOCK(&pool->mutex);
 
-  _sa_add_child(lib_properties, msg);
+  _sa_serialize_pool_work(pool, pool->threads);
 
-  sa_free_properties(lib_properties);
+  SA_MUTEX_LOCK(&pool->mutex);
+  while (0 != chunks[0].batch->pending) {
+    SA_COND_WAIT(&pool->done, &pool->mutex);
+  }
+  SA_MUTEX_UNLOCK(&pool->mutex);
 
-  // 事件属性.
-  SANode* inner_properties = _sa_init_dict_node("properties");
-  if (NULL == inner_properties) {
+  SA_MUTEX_UNLOCK(&pool->batch_mutex);
+}
+
+#else
+typedef struct SASerializePool SASerializePool;
+
+static void _sa_serialize_pool_free(SASerializePool* pool) {
+  (void)pool;
+}
+#endif  // SA_HAS_THREADS
+
+int sa_set_serialize_threads(unsigned int threads, SensorsAnalytics* sa) {
+  if (NULL == sa) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+#if defined(SA_HAS_THREADS)
+  SASerializePool* pool = NULL;
+  if (threads > 0 && NULL == (pool = _sa_serialize_pool_init(threads))) {
     return SA_MALLOC_ERROR;
   }
+  _sa_serialize_pool_free(sa->serialize_pool);
+  sa->serialize_pool = pool;
+  return SA_OK;
+#else
+  return 0 == threads ? SA_OK : SA_INVALID_PARAMETER_ERROR;
+#endif
+}
 
-  if (_sa_is_track(type) || _sa_is_track_signup(type)) {
-    // 属性中加入 $lib 和 $lib_version.
-    sa_add_string("$lib", SA_LIB, strlen(SA_LIB), inner_properties);
-    sa_add_string("$lib_version", SA_LIB_VERSION, strlen(SA_LIB_VERSION), inner_properties);
+// 序列化 batch 中的 count 条事件，batch 的 records、file 等字段由调用方设置. 返回的各任务保存序列化
+// 结果，由 _sa_batch_release 释放.
+static SASerializeChunk* _sa_batch_serialize(
+        SASerializeBatch* batch,
+        unsigned long count,
+        unsigned long* chunk_count) {
+  batch->results = (int*)SA_ALLOC(sizeof(int) * count);
+  batch->offsets = (unsigned long*)SA_ALLOC(sizeof(unsigned long) * count);
+  batch->lengths = (unsigned long*)SA_ALLOC(sizeof(unsigned long) * count);
+  batch->pending = 0;
+
+  *chunk_count = (count + SA_BATCH_CHUNK_SIZE - 1) / SA_BATCH_CHUNK_SIZE;
+  SASerializeChunk* chunks = (SASerializeChunk*)SA_ALLOC(sizeof(SASerializeChunk) * *chunk_count);
+  unsigned long i;
+  for (i = 0; i < *chunk_count; ++i) {
+    chunks[i].batch = batch;
+    chunks[i].begin = i * SA_BATCH_CHUNK_SIZE;
+    chunks[i].end = (i + 1) * SA_BATCH_CHUNK_SIZE < count ? (i + 1) * SA_BATCH_CHUNK_SIZE : count;
+  }
 
-#if defined(USE_POSIX)
-    pthread_mutex_lock(&sa->mutex);
-#elif defined(_WIN32)
-    EnterCriticalSection(&sa->mutex);
+  // 未设置线程池或只有一个任务时，在当前线程序列化.
+#if defined(SA_HAS_THREADS)
+  if (NULL != batch->sa->serialize_pool && *chunk_count > 1) {
+    _sa_serialize_pool_run(batch->sa->serialize_pool, chunks, *chunk_count);
+  } else
 #endif
-    SAListNode* curr = sa->super_properties->array_;
-    while (NULL != curr) {
-      _sa_add_child(curr->value, inner_properties);
-      curr = curr->next;
+  {
+    for (i = 0; i < *chunk_count; ++i) {
+      _sa_serialize_chunk(chunks + i);
     }
-#if defined(USE_POSIX)
-    pthread_mutex_unlock(&sa->mutex);
-#elif defined(_WIN32)
-    LeaveCriticalSection(&sa->mutex);
-#endif
   }
+  return chunks;
+}
 
-  // 浅拷贝传入的 properties.
-  if (NULL != properties) {
-    SAListNode* curr = properties->array_;
-    while (NULL != curr) {
-      if (NULL != curr->value->key && 0 == strncmp("$time", curr->value->key, 256)) {
-        // 若属性中包含 "$time" 对象，则使用它作为事件时间.
-        SANode* time_node = _sa_get_child("$time", properties);
-        if (NULL != time_node) {
-          if (SA_OK != (res = sa_add_int(
-                "time",
-                (long)(time_node->date_.seconds) * 1000
-                + (long)time_node->date_.microseconds / 1000,
-                msg))) {
-            return res;
-          }
-        }
-      } else if (NULL != curr->value->key && 0 == strncmp("$project", curr->value->key, 256)) {
-        // 若属性中包含 "$project" 对象，则将其改写为 project 属性.
-        SANode* project_node = _sa_get_child("$project", properties);
-        if (NULL != project_node) {
-          if (SA_OK != (res = sa_add_string(
-                "project",
-                project_node->string_,
-                strlen(project_node->string_),
-                msg))) {
-            return res;
-          }
-        }
-      } else {
-        _sa_add_child(curr->value, inner_properties);
-      }
-      curr = curr->next;
-    }
+static void _sa_batch_release(
+        SASerializeBatch* batch,
+        unsigned long count,
+        SASerializeChunk* chunks,
+        unsigned long chunk_count) {
+  unsigned long i;
+  for (i = 0; i < chunk_count; ++i) {
+    _sa_sb_free(&chunks[i].sb);
   }
+  SA_RELEASE(chunks, sizeof(SASerializeChunk) * chunk_count);
+  SA_RELEASE(batch->lengths, sizeof(unsigned long) * count);
+  SA_RELEASE(batch->offsets, sizeof(unsigned long) * count);
+  SA_RELEASE(batch->results, sizeof(int) * count);
+}
 
-  // 写入 properties 字段.
-  _sa_add_child(inner_properties, msg);
-
-  sa_free_properties(inner_properties);
-
-  // 序列化为字符串.
-  SAStringBuffer sb;
-  if (SA_OK != (res = _sa_sb_init(&sb))) {
-    return res;
+// 由 sa_reserve 调用: 设置了序列化线程池时，为每个线程准备两个任务，经线程池序列化但不发送，
+// 使工作线程完成首次序列化.
+static void _sa_serialize_pool_reserve(const SAProperties* properties, SensorsAnalytics* sa) {
+#if defined(SA_HAS_THREADS)
+  if (NULL == sa->serialize_pool) {
+    return;
   }
+  unsigned long count = (sa->serialize_pool->threads + 1) * 2 * SA_BATCH_CHUNK_SIZE;
+  SATrackRecord* records = (SATrackRecord*)SA_ALLOC(sizeof(SATrackRecord) * count);
+  unsigned long i;
+  for (i = 0; i < count; ++i) {
+    records[i].distinct_id = "sa_reserve";
+    records[i].event = "SAReserve";
+    records[i].properties = properties;
+  }
+  SASerializeBatch batch;
+  batch.records = records;
+  batch.file = __FILE__;
+  batch.function = "sa_reserve";
+  batch.line = __LINE__;
+  batch.sa = sa;
+  batch.scope = NULL;
+  unsigned long chunk_count = 0;
+  SASerializeChunk* chunks = _sa_batch_serialize(&batch, count, &chunk_count);
+  _sa_batch_release(&batch, count, chunks, chunk_count);
+  SA_RELEASE(records, sizeof(SATrackRecord) * count);
+#else
+  (void)properties;
+  (void)sa;
+#endif
+}
 
-  _sa_dump_node(msg, &sb);
-
-  unsigned long msg_length = 0;
-  const char* msg_str = _sa_sb_finish(&sb, &msg_length);
+int _sa_track_batch(
+        const SATrackRecord* records,
+        unsigned long count,
+        const char* __file__,
+        const char* __function__,
+        unsigned long __line__,
+        SensorsAnalytics* sa) {
+  if (NULL == sa || (NULL == records && count > 0)) {
+    return SA_INVALID_PARAMETER_ERROR;
+  }
+  if (0 == count) {
+    return SA_OK;
+  }
 
-  // 使用 sa 发送事件.
-  res = sa->consumer->op.send(sa->consumer->this_, msg_str, msg_length);
+  // 探针 batch__entry(事件个数) 与 batch__return(事件个数, 结果).
+  SA_PROBE1(batch__entry, count);
+
+  // 整批按 count 次调用计入采样间隔，采样时记录平均每个事件的耗时. 检查与合并属性在序列化任务中完成，
+  // 计入序列化阶段.
+  SAProfileSample sample_buf;
+  SAProfileSample* sample = _sa_profile_begin(sa, count, &sample_buf);
+
+  SASerializeBatch batch;
+  batch.records = records;
+  batch.file = __file__;
+  batch.function = __function__;
+  batch.line = __line__;
+  batch.sa = sa;
+  batch.scope = _sa_scope_find(sa);
+  unsigned long chunk_count = 0;
+  SASerializeChunk* chunks = _sa_batch_serialize(&batch, count, &chunk_count);
+  SA_PROFILE_STAMP(sample, SA_PROFILE_SERIALIZE);
+
+  // 按原顺序发送，返回第一个失败的事件的错误码.
+  int res = SA_OK;
+  unsigned long i;
+  for (i = 0; i < count; ++i) {
+    int ret = batch.results[i];
+    if (SA_OK == ret) {
+      const char* msg_str = chunks[i / SA_BATCH_CHUNK_SIZE].sb.start + batch.offsets[i];
+      ret = _sa_send(sa, msg_str, batch.lengths[i], 0);
+    }
+    if (SA_OK == res) {
+      res = ret;
+    }
+  }
 
-  _sa_sb_free(&sb);
+  if (NULL != sample) {
+    unsigned long long start = sample->stamps[SA_PROFILE_START];
+    unsigned long long serialized = sample->stamps[SA_PROFILE_SERIALIZE];
+    unsigned long long sent = _sa_cycles();
+    sample->stamps[SA_PROFILE_VALIDATE] = start;
+    sample->stamps[SA_PROFILE_MERGE] = start;
+    sample->stamps[SA_PROFILE_SERIALIZE] = start + (serialized - start) / count;
+    sample->stamps[SA_PROFILE_SEND] = sample->stamps[SA_PROFILE_SERIALIZE] + (sent - serialized) / count;
+    _sa_profile_commit(sa, sample);
+  }
 
-  _sa_free_node(msg);
+  _sa_batch_release(&batch, count, chunks, chunk_count);
 
+  SA_PROBE2(batch__return, count, res);
   return res;
 }
 
@@ -1411,15 +5993,28 @@ int _sa_track_signup(
         const char* __function__,
         unsigned long __line__,
         SensorsAnalytics* sa) {
-  return _sa_track_internal(distinct_id,
-                            origin_id,
-                            "track_signup",
-                            "$SignUp",
-                            properties,
-                            __file__,
-                            __function__,
-                            __line__,
-                            sa);
+  SASignupDedup* dedup = NULL != sa ? sa->signup_dedup : NULL;
+  unsigned long long hash = 0;
+  if (NULL != dedup && NULL != distinct_id && NULL != origin_id) {
+    hash = _sa_signup_hash(distinct_id, origin_id);
+    if (_sa_signup_dedup_begin(dedup, hash)) {
+      SA_ATOMIC_ADD64(&sa->stats.signups_suppressed, 1);
+      return SA_OK;
+    }
+  }
+  int res = _sa_track_internal(distinct_id,
+                               origin_id,
+                               "track_signup",
+                               "$SignUp",
+                               properties,
+                               __file__,
+                               __function__,
+                               __line__,
+                               sa);
+  if (NULL != dedup && NULL != distinct_id && NULL != origin_id) {
+    _sa_signup_dedup_end(dedup, hash, SA_OK == res);
+  }
+  return res;
 }
 
 int _sa_profile_set(
@@ -1443,6 +6038,122 @@ int _sa_profile_set(
                             sa);
 }
 
+// 去掉已经发送过的 set_once 属性后发送，全部去掉时不发送. $time 与 $project 是顶层字段，不参与去重.
+static int _sa_profile_set_once_cached(
+        const char* distinct_id,
+        const SAProperties* properties,
+        const char* __file__,
+        const char* __function__,
+        unsigned long __line__,
+        SensorsAnalytics* sa) {
+  // 先检查合法性，不合法的调用不查询缓存，也不计入命中与未命中的次数.
+  int res = _sa_check_legality(distinct_id, NULL, "profile_set_once", NULL, properties);
+  if (SA_OK != res) {
+    SA_PROBE3(validate__fail, "profile_set_once", NULL, res);
+    SA_ATOMIC_ADD64(&sa->stats.invalid, 1);
+    return res;
+  }
+
+  SASetOnceCache* cache = sa->set_once_cache;
+  const SANode* project = _sa_get_child("$project", properties);
+  unsigned long long user = _sa_set_once_user_hash(
+      distinct_id, NULL != project && SA_STRING == project->tag ? project->string_ : NULL);
+  SASetOnceShard* shard = _sa_set_once_shard(cache, user);
+
+  // 按属性列表的顺序记录每个属性是否命中. 未命中的属性在同一个临界区内预先插入，同时调用的其他线程
+  // 视为已发送; 发送失败时再移除.
+  const SANode* local[32];
+  const SANode** nodes = local;
+  unsigned char local_hits[32];
+  unsigned char* hits = local_hits;
+  unsigned long count = 0;
+  unsigned long capacity = sizeof(local) / sizeof(local[0]);
+  unsigned long hit_count = 0;
+  unsigned long miss_count = 0;
+  const SAListNode* curr;
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_LOCK(&shard->mutex);
+#endif
+  for (curr = properties->array_; NULL != curr; curr = curr->next) {
+    if (count == capacity) {
+      const SANode** grown_nodes = (const SANode**)SA_ALLOC(sizeof(SANode*) * capacity * 2);
+      unsigned char* grown_hits = (unsigned char*)SA_ALLOC(capacity * 2);
+      memcpy(grown_nodes, nodes, sizeof(SANode*) * count);
+      memcpy(grown_hits, hits, count);
+      if (nodes != local) {
+        SA_RELEASE(nodes, sizeof(SANode*) * capacity);
+        SA_RELEASE(hits, capacity);
+      }
+      nodes = grown_nodes;
+      hits = grown_hits;
+      capacity *= 2;
+    }
+    const SANode* node = curr->value;
+    nodes[count] = node;
+    hits[count] = 0;
+    if (0 != strncmp("$time", node->key, 256) && 0 != strncmp("$project", node->key, 256)) {
+      unsigned long long hash = _sa_set_once_key_hash(user, node->key);
+      if (_sa_set_once_touch(shard, hash)) {
+        hits[count] = 1;
+        ++hit_count;
+      } else {
+        _sa_set_once_insert(shard, hash, user);
+        ++miss_count;
+      }
+    }
+    ++count;
+  }
+#if defined(SA_HAS_THREADS)
+  SA_MUTEX_UNLOCK(&shard->mutex);
+#endif
+  SA_ATOMIC_ADD64(&sa->stats.set_once_hits, (long long)hit_count);
+  SA_ATOMIC_ADD64(&sa->stats.set_once_misses, (long long)miss_count);
+
+  unsigned long i;
+  if (hit_count > 0 && 0 == miss_count) {
+    SA_ATOMIC_ADD64(&sa->stats.set_once_dropped, 1);
+  } else if (0 == hit_count) {
+    res = _sa_track_internal(distinct_id, NULL, "profile_set_once", NULL, properties,
+                             __file__, __function__, __line__, sa);
+  } else {
+    // 未命中的属性与原来的节点共享，逆序加入以保持原来的顺序.
+    SAProperties* remaining = sa_init_properties();
+    for (i = count; i > 0; --i) {
+      if (!hits[i - 1]) {
+        _sa_add_child((SANode*)nodes[i - 1], remaining);
+      }
+    }
+    res = _sa_track_internal(distinct_id, NULL, "profile_set_once", NULL, remaining,
+                             __file__, __function__, __line__, sa);
+    sa_free_properties(remaining);
+  }
+
+  // 发送失败时移除预先插入的属性，下次调用重新发送.
+  if (SA_OK != res && miss_count > 0) {
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_LOCK(&shard->mutex);
+#endif
+    for (i = 0; i < count; ++i) {
+      if (!hits[i] && 0 != strncmp("$time", nodes[i]->key, 256)
+          && 0 != strncmp("$project", nodes[i]->key, 256)) {
+        unsigned int index = _sa_set_once_find(shard, _sa_set_once_key_hash(user, nodes[i]->key));
+        if (SA_SET_ONCE_NIL != index) {
+          _sa_set_once_erase(shard, index);
+        }
+      }
+    }
+#if defined(SA_HAS_THREADS)
+    SA_MUTEX_UNLOCK(&shard->mutex);
+#endif
+  }
+
+  if (nodes != local) {
+    SA_RELEASE(nodes, sizeof(SANode*) * capacity);
+    SA_RELEASE(hits, capacity);
+  }
+  return res;
+}
+
 int _sa_profile_set_once(
         const char* distinct_id,
         const SAProperties* properties,
@@ -1453,6 +6164,9 @@ int _sa_profile_set_once(
   if (NULL == properties) {
     return SA_INVALID_PARAMETER_ERROR;
   }
+  if (NULL != sa && NULL != sa->set_once_cache && NULL != distinct_id) {
+    return _sa_profile_set_once_cached(distinct_id, properties, __file__, __function__, __line__, sa);
+  }
   return _sa_track_internal(distinct_id,
                             NULL,
                             "profile_set_once",
@@ -1534,6 +6248,10 @@ int _sa_profile_unset(
 
   sa_free_properties(properties);
 
+  if (SA_OK == res && NULL != sa) {
+    _sa_set_once_forget(sa->set_once_cache, distinct_id, key);
+  }
+
   return res;
 }
 
@@ -1562,6 +6280,10 @@ int _sa_profile_delete(
 
   sa_free_properties(properties);
 
+  if (SA_OK == res && NULL != sa) {
+    _sa_set_once_forget(sa->set_once_cache, distinct_id, NULL);
+  }
+
   return res;
 }
 
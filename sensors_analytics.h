@@ -11,6 +11,10 @@
 #include <stdlib.h>
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define SA_ASSERT(condition) do { \
   bool cond = (condition); \
   if (!cond) { \
@@ -25,7 +29,8 @@ typedef enum {
   SA_OK,
   SA_MALLOC_ERROR,
   SA_INVALID_PARAMETER_ERROR,
-  SA_IO_ERROR
+  SA_IO_ERROR,
+  SA_QUEUE_FULL_ERROR
 } SAErrCode;
 
 typedef enum {
@@ -35,6 +40,74 @@ typedef enum {
 
 // ----------------------------------------------------------------------------
 
+// SDK 报告的错误信息的类别.
+typedef enum {
+  // 限速期间被抑制的信息的汇总，每个汇总间隔最多一条.
+  SA_ERROR_SUMMARY,
+  SA_ERROR_INVALID_PARAMETER,
+  SA_ERROR_INVALID_UTF8,
+  SA_ERROR_INVALID_DISTINCT_ID,
+  SA_ERROR_INVALID_ORIGINAL_ID,
+  SA_ERROR_INVALID_EVENT_NAME,
+  SA_ERROR_INVALID_PROPERTY_NAME,
+  SA_ERROR_IO,
+  // 内存不足、创建线程失败等.
+  SA_ERROR_SYSTEM,
+  SA_ERROR_KIND_COUNT
+} SAErrorKind;
+
+// 错误信息的回调，可能在任意线程中调用，message 只在回调期间有效.
+typedef void (*sa_error_callback)(SAErrorKind kind, const char* message, void* user_data);
+
+// 设置错误信息的回调，默认输出到 stderr. 须在使用 SDK 之前调用.
+//
+// @param callback<in>         回调函数，NULL 表示恢复默认
+// @param user_data<in>        传给回调函数的数据
+void sa_set_error_callback(sa_error_callback callback, void* user_data);
+
+// 设置错误信息的限速. 每类错误分别使用令牌桶限速，超出的信息只计数不输出，每个汇总间隔内以
+// SA_ERROR_SUMMARY 输出一次各类被抑制的条数. 默认为每秒 10 条、突发 20 条、汇总间隔 60 秒.
+// 各类错误的累计条数和被抑制条数可以通过 sa_write_stats 获得.
+//
+// @param messages_per_second<in>       每类错误每秒输出的条数
+// @param burst<in>                     每类错误允许连续输出的条数
+// @param summary_interval_seconds<in>  汇总信息的最小间隔（秒）
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_error_rate_limit(
+    unsigned int messages_per_second, unsigned int burst, unsigned int summary_interval_seconds);
+
+// ----------------------------------------------------------------------------
+
+// 自定义内存分配器. 释放和重新分配时会传入原分配的大小，便于对接按大小管理内存的
+// 分配器（例如 C++ 的 std::pmr::memory_resource 或内存池）.
+typedef struct {
+  void* (*allocate)(unsigned long size, void* ctx);
+  void* (*reallocate)(void* ptr, unsigned long old_size, unsigned long new_size, void* ctx);
+  void (*deallocate)(void* ptr, unsigned long size, void* ctx);
+  // 分配器私有数据，原样传给以上函数.
+  void* ctx;
+} SAAllocator;
+
+// 设置 SDK 内部对象（属性节点、SensorsAnalytics 实例、异步队列中的事件等）使用的分配器.
+// 必须在创建任何 SDK 对象之前调用，并且在释放所有 SDK 对象之前不能再修改.
+// Consumer 对象由 sa_free 调用 free 释放，不受影响.
+//
+// @param allocator<in>    分配器，SDK 会复制其内容; 为 NULL 时恢复为 malloc/free
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_allocator(const SAAllocator* allocator);
+
+// 设置当前线程序列化事件时临时缓冲区使用的分配器，例如线程私有的内存池.
+// 缓冲区只在一次 track 调用内存在，因此可以在调用前后随时切换.
+//
+// @param allocator<in>    分配器，调用方需保证其在使用期间有效; 为 NULL 时使用 sa_set_allocator 设置的分配器
+//
+// @return 之前设置的线程分配器.
+const SAAllocator* sa_set_thread_allocator(const SAAllocator* allocator);
+
+// ----------------------------------------------------------------------------
+
 // 定义 Consumer 的操作.
 typedef int (*sa_consumer_send)(void* this_, const char* event, unsigned long length);
 typedef int (*sa_consumer_flush)(void* this_);
@@ -52,6 +125,19 @@ struct SAConsumer {
   void* this_;
 };
 
+// 分段写入一条事件的操作. 开启 sa_set_streaming 后，序列化后超过分段大小的事件依次调用 begin、
+// 若干次 append 和 end 写入，不超过的事件仍然调用 send. this_ 为 Consumer 的私有数据.
+// 同一条事件的 begin 与 end 在同一个线程中调用，Consumer 需保证其间不写入其他事件.
+typedef int (*sa_consumer_begin)(void* this_);
+typedef int (*sa_consumer_append)(void* this_, const char* data, unsigned long length);
+typedef int (*sa_consumer_end)(void* this_);
+
+struct SAConsumerStreamOp {
+  sa_consumer_begin begin;
+  sa_consumer_append append;
+  sa_consumer_end end;
+};
+
 // LoggingConsumer 用于将事件以日志文件的形式记录在本地磁盘中.
 typedef struct SAConsumer SALoggingConsumer;
 
@@ -63,6 +149,20 @@ typedef struct SAConsumer SALoggingConsumer;
 // @return SA_OK 初始化成功，否则初始化失败.
 int sa_init_logging_consumer(const char* file_name, SALoggingConsumer** consumer);
 
+// BackfillConsumer 用于导入带有 $time 的历史事件，按事件时间所在的日期写入 <file_name>.log.<日期>，
+// 而不是当前日期. 可以在多个线程中同时使用.
+typedef struct SAConsumer SABackfillConsumer;
+
+// 初始化 Backfill Consumer
+//
+// @param file_name<in>        日志文件名，例如: /data/logs/http.log
+// @param max_open_files<in>   最多同时打开的日志文件数，超出时关闭最久未写入的文件
+// @param consumer<out>        SABackfillConsumer 实例
+//
+// @return SA_OK 初始化成功，否则初始化失败.
+int sa_init_backfill_consumer(
+    const char* file_name, unsigned int max_open_files, SABackfillConsumer** consumer);
+
 // DebugConsumer 用于在线调试 SDK 记录的数据.
 typedef struct SAConsumer SADebugConsumer;
 
@@ -88,6 +188,50 @@ typedef struct SAConsumer SABatchConsumer;
 // @return SA_OK 初始化成功，否则初始化失败.
 int sa_init_batch_consumer(const char* url, unsigned int batch_size, SABatchConsumer** consumer);
 
+// AsyncConsumer 将事件放入有界队列，由后台写线程交给下游 Consumer，调用方不必等待 I/O.
+typedef struct SAConsumer SAAsyncConsumer;
+
+// 队列已满时 AsyncConsumer 的处理方式.
+typedef enum {
+  // 阻塞调用方，直到队列出现空位.
+  SA_BACKPRESSURE_BLOCK,
+  // 丢弃事件，返回 SA_QUEUE_FULL_ERROR.
+  SA_BACKPRESSURE_DROP
+} SABackpressure;
+
+// 初始化 AsyncConsumer
+//
+// @param consumer<in>         下游 Consumer，由 AsyncConsumer 负责释放
+// @param queue_size<in>       队列中最多缓存的事件数
+// @param backpressure<in>     队列已满时的处理方式
+// @param async_consumer<out>  SAAsyncConsumer 实例
+//
+// @return SA_OK 初始化成功，否则初始化失败.
+int sa_init_async_consumer(
+    struct SAConsumer* consumer,
+    unsigned int queue_size,
+    SABackpressure backpressure,
+    SAAsyncConsumer** async_consumer);
+
+// RelayConsumer 通过 Unix 域数据报 socket 将事件交给本机的 sa_relay 进程，由 sa_relay 汇总多个进程的
+// 事件后写入日志文件，应用进程本身不打开日志文件. 事件以换行符分隔，积攒到 batch_bytes 字节或调用
+// sa_flush 时作为一个数据报发送. relay 的接收队列已满时发送方阻塞，不希望阻塞时可以再使用
+// AsyncConsumer 包装. 可以在多个线程中同时使用，仅支持 POSIX 平台. 积攒的事件已交给 RelayConsumer，
+// 之后作为一个数据报发送失败时丢弃，计入 sa_write_stats 的 sa_relay_events_dropped_total.
+typedef struct SAConsumer SARelayConsumer;
+
+// 一个数据报的最大字节数，单条事件（含换行符）不能超过该长度.
+#define SA_RELAY_MAX_DATAGRAM (64 * 1024)
+
+// 初始化 RelayConsumer
+//
+// @param socket_path<in>      sa_relay 监听的 socket 路径，例如: /var/run/sa_relay.sock
+// @param batch_bytes<in>      积攒的字节数，不超过 SA_RELAY_MAX_DATAGRAM，0 表示每条事件单独发送
+// @param consumer<out>        SARelayConsumer 实例
+//
+// @return SA_OK 初始化成功，否则初始化失败.
+int sa_init_relay_consumer(const char* socket_path, unsigned long batch_bytes, SARelayConsumer** consumer);
+
 // ----------------------------------------------------------------------------
 
 // SensorsAnalytics 对象.
@@ -111,6 +255,75 @@ void sa_free(struct SensorsAnalytics* sa);
 // @param sa<in/out>           同步的 Sensors Analytics 实例.
 void sa_flush(struct SensorsAnalytics* sa);
 
+// 异步操作完成时的回调
+//
+// @param result<in>           SA_OK 表示操作成功，否则为错误码
+// @param user_data<in>        调用方传入的参数
+typedef void (*sa_completion_callback)(int result, void* user_data);
+
+// 异步同步 Sensors Analytics 的状态，不阻塞调用方
+//
+// 使用 AsyncConsumer 时，callback 在写线程中调用，此时调用之前写入的事件均已交给下游 Consumer
+// 并已 flush；使用其他 Consumer 时，在返回前同步 flush 并调用 callback. callback 中请勿调用
+// 阻塞的 sa_flush.
+//
+// @param sa<in/out>           SensorsAnalytics 实例
+// @param callback<in>         完成时的回调，只会被调用一次
+// @param user_data<in>        传给 callback 的参数
+//
+// @return SA_OK 表示 callback 将被调用，否则失败且不会调用 callback.
+int sa_flush_async(struct SensorsAnalytics* sa, sa_completion_callback callback, void* user_data);
+
+// 等待 AsyncConsumer 的队列出现空位
+//
+// 队列未满或未使用 AsyncConsumer 时直接返回 SA_OK，不调用 callback；否则返回
+// SA_QUEUE_FULL_ERROR，callback 将在写线程取走一个事件后被调用.
+//
+// @param sa<in/out>           SensorsAnalytics 实例
+// @param callback<in>         出现空位时的回调
+// @param user_data<in>        传给 callback 的参数
+//
+// @return SA_OK 队列未满，SA_QUEUE_FULL_ERROR 已注册 callback.
+int sa_notify_writable(struct SensorsAnalytics* sa, sa_completion_callback callback, void* user_data);
+
+// 开启采样性能分析. 每个线程每 sample_interval 次跟踪事件的调用中采样一次，记录检查、合并属性、
+// 序列化和发送各阶段的耗时（x86 上使用 rdtsc）. 每个线程在每个实例上保留最近 1024 条样本.
+// sa_track_batch 的一批事件按事件个数计入采样间隔，样本为这一批平均每个事件的耗时.
+//
+// @param sample_interval<in>  采样间隔，例如 1000 表示每 1000 次调用采样一次; 0 表示关闭
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_profiling(unsigned long sample_interval, struct SensorsAnalytics* sa);
+
+// 输出各阶段耗时的统计报告（均值、P50、P99、最大值），可以在其他线程中随时调用.
+//
+// @param out<in>              报告输出的文件，例如 stderr
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 输出成功，否则输出失败.
+int sa_dump_profile(FILE* out, struct SensorsAnalytics* sa);
+
+// 以 Prometheus 文本格式输出统计数据，包括事件数、字节数、不合法及丢弃的事件数、发送失败次数、
+// AsyncConsumer 的队列长度以及 Consumer 写入事件的耗时分布.
+//
+// @param out<in>              输出的文件
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 输出成功，否则输出失败.
+int sa_write_stats(FILE* out, struct SensorsAnalytics* sa);
+
+// 启动统计数据导出线程，每 interval_seconds 秒将 sa_write_stats 的输出写入 path，供本机的采集程序
+// 读取（例如 node_exporter 的 textfile collector）. 先写入 path.tmp 再改名为 path，读取方不会读到
+// 不完整的文件. 重复调用时替换之前的导出线程，sa_free 时停止并写入最后一次的数据.
+//
+// @param path<in>             输出文件路径，例如 /var/lib/node_exporter/sa_sdk.prom
+// @param interval_seconds<in> 写入间隔（秒）
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 启动成功，否则启动失败.
+int sa_start_stats_exporter(const char* path, unsigned int interval_seconds, struct SensorsAnalytics* sa);
+
 // ----------------------------------------------------------------------------
 
 // 事件属性或用户属性.
@@ -199,6 +412,15 @@ int sa_unregister_super_properties(const char* key, struct SensorsAnalytics* sa)
 // 删除事件的所有公共属性.
 int sa_clear_super_properties(struct SensorsAnalytics* sa);
 
+// 在当前线程压入一组作用域属性，之后当前线程通过 sa 跟踪的 track 类事件都会带上这些属性，直到
+// 对应的 sa_scope_pop. 属性在压入时被复制，并与外层作用域合并、序列化一次，properties 之后可以
+// 修改或释放. 相同的 key 依次采用 track 的 properties、作用域（内层优先）、super properties 中的值.
+// 作用域中不能包含 $time、$project、$lib、$lib_version. sa_free 释放当前线程中 sa 的作用域，
+// 其他线程应在 sa_free 之前弹出各自的作用域; POSIX 平台上线程退出时释放该线程未弹出的作用域.
+int sa_scope_push(const SAProperties* properties, struct SensorsAnalytics* sa);
+// 弹出当前线程中 sa 最内层的作用域.
+int sa_scope_pop(struct SensorsAnalytics* sa);
+
 // 跟踪一个用户的行为
 //
 // @param distinct_id<in>      用户ID
@@ -218,6 +440,114 @@ int _sa_track(
         unsigned long __line__,
         struct SensorsAnalytics* sa);
 
+// sa_track_batch 中的一条事件.
+typedef struct {
+  const char* distinct_id;
+  const char* event;
+  // 事件属性，NULL 表示无事件属性.
+  const SAProperties* properties;
+} SATrackRecord;
+
+// 批量跟踪用户的行为，效果与依次调用 sa_track 相同. 设置了序列化线程池时，事件由多个线程并行
+// 序列化，之后仍按 records 中的顺序发送.
+//
+// @param records<in>          事件数组
+// @param count<in>            事件个数
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 全部追踪成功，否则为第一个失败的事件的错误码，其余事件不受影响.
+#define sa_track_batch(records, count, sa)      \
+  _sa_track_batch(records, count, __FILE__, __FUNCTION__, __LINE__, sa)
+int _sa_track_batch(
+        const SATrackRecord* records,
+        unsigned long count,
+        const char* __file__,
+        const char* __function__,
+        unsigned long __line__,
+        struct SensorsAnalytics* sa);
+
+// 设置 sa_track_batch 序列化事件使用的线程数. 默认为 0，即在调用线程中序列化;
+// 大于 0 时创建对应数量的工作线程，与调用线程一起以任务窃取的方式并行序列化.
+// 不能与 sa_track_batch 同时调用.
+//
+// @param threads<in>          工作线程数
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_serialize_threads(unsigned int threads, struct SensorsAnalytics* sa);
+
+// 设置是否按固定的顺序输出事件，使相邻的事件更相似，压缩率更高. 开启后顶层字段依次为 type、event、
+// project、lib、properties、time、distinct_id 和 original_id，每条事件都不同的字段放在最后;
+// properties 中依次为调用方的属性、作用域属性、公共属性以及 $lib 和 $lib_version，
+// 调用方的属性先按 keys 中的顺序，其余按加入的顺序; 公共属性按注册的顺序，重新注册的属性排在最后.
+// 须在跟踪事件之前调用.
+//
+// @param canonical<in>        是否按固定的顺序输出
+// @param keys<in>             调用方属性的优先顺序，可以为 NULL
+// @param count<in>            keys 中的属性名个数
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_canonical_order(
+    SABool canonical, const char* const* keys, unsigned long count, struct SensorsAnalytics* sa);
+
+// 开启 track_signup 去重: 记录已经发送的 (distinct_id, origin_id)，之后相同的 sa_track_signup 调用
+// 不再发送而直接返回 SA_OK，并计入 sa_write_stats 的 sa_signups_suppressed_total. 使用可扩展的分块
+// Bloom 过滤器，元素超过 expected 后按倍数增加容量; 误判时首次注册的事件也会被丢弃，其概率不超过 fp_rate.
+// 每 rotate_seconds 秒轮换一次，只在最近两个周期中都没有出现过的组合会重新发送; 轮换时同时查询两个周期，
+// 每个周期的误判率上限为 fp_rate / 2. 只比较两个 ID，不比较属性. 多个线程同时发送同一组合时只有一个
+// 线程发送，其他线程直接返回 SA_OK; 发送失败的组合不记录，之后的调用会重新发送. 须在跟踪事件之前调用.
+//
+// @param expected<in>         每个周期预计的不同组合个数，0 表示关闭去重
+// @param fp_rate<in>          误判率上限，取值范围 (0, 1)，例如 0.001
+// @param rotate_seconds<in>   轮换周期，0 表示不轮换
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_signup_dedup(
+    unsigned long expected, double fp_rate, unsigned int rotate_seconds, struct SensorsAnalytics* sa);
+
+// 开启 profile_set_once 去重: 在分片的 LRU 中记录已经发送的 (distinct_id, $project, 属性名)，之后的
+// sa_profile_set_once 调用在序列化之前去掉这些属性，属性全部被去掉时不发送并返回 SA_OK. 命中与
+// 未命中的次数和不再发送的事件数由 sa_write_stats 输出. 同一用户的属性在同一个分片中，各分片有独立的锁;
+// 超过容量时淘汰最久未使用的项，被淘汰的属性会再发送一次. 属性中带有 $project 时按项目分别记录.
+// 未命中的属性在发送前即记录，多个线程同时设置同一属性时只有一个线程发送，发送失败时清除记录.
+// sa_profile_unset 与 sa_profile_delete 成功后清除默认项目中对应的项. 须在跟踪事件之前调用.
+//
+// @param capacity<in>         最多记录的 (distinct_id, $project, 属性名) 个数，0 表示关闭去重
+// @param shards<in>           分片个数，0 表示使用默认值 16
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_profile_set_once_cache(unsigned long capacity, unsigned int shards, struct SensorsAnalytics* sa);
+
+// 预热 SDK，使进程启动后的第一个事件与稳定运行时的耗时相同: 之后按 expected_event_bytes 一次分配
+// 序列化缓冲区；已开启采样时为 expected_threads 个线程预先分配样本缓冲区；已设置序列化线程池时经
+// 线程池序列化一批事件但不发送，使各工作线程完成首次序列化；LoggingConsumer（包括 AsyncConsumer
+// 的下游）由 AsyncConsumer 的写线程打开当日的日志文件；并完成时区等的首次初始化.
+// AsyncConsumer 的队列为链表，事件入队时按大小分配，没有需要预先分配的容量.
+//
+// @param expected_threads<in>       预计调用 SDK 的线程数
+// @param expected_event_bytes<in>   预计单个事件序列化后的字节数，0 表示不修改
+// @param sa<in/out>                 SensorsAnalytics 实例
+//
+// @return SA_OK 预热成功，否则预热失败.
+int sa_reserve(
+    unsigned int expected_threads, unsigned long expected_event_bytes, struct SensorsAnalytics* sa);
+
+// 开启分段序列化. 序列化缓冲区固定为 chunk_size 字节，写满后即交给 Consumer 的 append，
+// 每个事件占用的内存不随事件大小增长，用于包含上千个元素的列表属性等很大的事件.
+// sa_track_batch 不分段. 不能与跟踪事件的函数同时调用.
+//
+// @param op<in>               分段写入的操作，SDK 会复制其内容; 为 NULL 时使用 LoggingConsumer 内置的操作，
+//                             其他 Consumer 须提供
+// @param chunk_size<in>       分段大小（字节），小于 64 时按 64; 0 表示关闭
+// @param sa<in/out>           SensorsAnalytics 实例
+//
+// @return SA_OK 设置成功，否则设置失败.
+int sa_set_streaming(
+    const struct SAConsumerStreamOp* op, unsigned long chunk_size, struct SensorsAnalytics* sa);
+
 
 // 关联匿名用户和注册用户，这个接口是一个较为复杂的功能，请在使用前先阅读相关说明:
 //
@@ -342,5 +672,134 @@ int _sa_profile_delete(
         unsigned long __line__,
         struct SensorsAnalytics* sa);
 
+// 检查属性名或事件名是否合法. 名称须为 [a-zA-Z_$][a-zA-Z0-9_$]{0,99}，且不能为 distinct_id、time 等
+// 保留字（不区分大小写）. 逐字节检查，并缓存当前线程最近通过检查的名称.
+//
+// @param key<in>               属性名或事件名
+// @param sa<in>                SensorsAnalytics 对象
+//
+// @return SA_OK 合法，否则不合法.
+int sa_check_key_name(const char* key, struct SensorsAnalytics* sa);
+
+// sa_track_serialized 的选项.
+// 事件名已由调用方检查（例如在编译期），SDK 不再检查.
+#define SA_TRACK_TRUSTED_EVENT 0x1u
+// 使用 AsyncConsumer 且队列已满时不阻塞，直接返回 SA_QUEUE_FULL_ERROR.
+#define SA_TRACK_NONBLOCKING 0x2u
+
+// 使用预序列化的事件属性跟踪一个用户的行为，不构造 SAProperties 对象
+//
+// properties 为若干个以 ',' 分隔的 "key":value JSON 片段（不含外层的 '{' 和 '}'），
+// 其中属性名须已通过 sa_check_key_name 检查，值须为合法的 JSON. SDK 不再检查片段内容，
+// 也不处理 $time 和 $project 属性. 与片段中同名的公共属性将被忽略. 开启 sa_set_canonical_order 后
+// 与 sa_track 的输出顺序相同，属性相同时输出的事件也相同.
+//
+// @param distinct_id<in>       用户 ID
+// @param event<in>             事件名称
+// @param properties<in>        预序列化的事件属性片段，可以为 NULL
+// @param length<in>            片段长度
+// @param flags<in>             SA_TRACK_* 选项的组合，0 表示无
+// @param sa<in/out>            SensorsAnalytics 对象
+//
+// @return SA_OK 追踪成功，否则追踪失败.
+#define sa_track_serialized(distinct_id, event, properties, length, flags, sa)   \
+  _sa_track_serialized(distinct_id, event, properties, length, flags, __FILE__, __FUNCTION__, __LINE__, sa)
+int _sa_track_serialized(
+        const char* distinct_id,
+        const char* event,
+        const char* properties,
+        unsigned long length,
+        unsigned int flags,
+        const char* __file__,
+        const char* __function__,
+        unsigned long __line__,
+        struct SensorsAnalytics* sa);
+
+// ----------------------------------------------------------------------------
+
+// 读取 LoggingConsumer 输出的日志文件，每条记录为一行. POSIX 平台上以只读方式映射文件，
+// 记录直接指向映射的内容，不复制.
+typedef struct SALogReader SALogReader;
+
+// 打开日志文件中的一个字节范围. 多个 reader 可以按互不重叠的范围并行读取同一个文件：
+// 每条记录只属于其开始位置所在的范围，跨越范围结尾的记录由该范围读完.
+//
+// @param path<in>         日志文件路径
+// @param offset<in>       范围的起始字节
+// @param length<in>       范围的字节数，0 表示到文件结尾
+// @param reader<out>      SALogReader 实例
+//
+// @return SA_OK 打开成功，否则打开失败.
+int sa_log_reader_open(
+    const char* path, unsigned long long offset, unsigned long long length, SALogReader** reader);
+
+// 读取下一条记录，不含行尾的换行符，跳过空行. 记录在 sa_log_reader_close 之前有效.
+//
+// @param reader<in/out>   SALogReader 实例
+// @param record<out>      记录的开始位置，读完范围内的所有记录后为 NULL
+// @param length<out>      记录的字节数
+//
+// @return SA_OK 读取成功，否则读取失败.
+int sa_log_reader_next(SALogReader* reader, const char** record, unsigned long* length);
+
+// 返回 sa_log_reader_next 读取的记录在文件中的字节偏移.
+unsigned long long sa_log_reader_offset(const SALogReader* reader, const char* record);
+
+// 关闭 reader，之前读取的记录不再有效.
+void sa_log_reader_close(SALogReader* reader);
+
+// sa_parse_event 解析出的事件. 字符串均指向传入的缓冲区，不存在的字段为 NULL.
+typedef struct {
+  // 事件类型，例如 track、profile_set.
+  const char* type;
+  const char* distinct_id;
+  // track_signup 事件的 original_id.
+  const char* original_id;
+  const char* event;
+  const char* project;
+  // 事件时间（毫秒）.
+  long long time;
+  // 埋点管理信息（$lib、$lib_version 等）与事件属性，可以直接传给 sa_track 等接口.
+  // 其中的属性名和字符串值同样指向传入的缓冲区，sa_register_super_properties 与 sa_scope_push
+  // 会复制这些属性; 不要以其他方式在 sa_free_parsed_event 之后继续引用其中的属性.
+  SAProperties* lib;
+  SAProperties* properties;
+} SAParsedEvent;
+
+// 将 SDK 输出的一条事件解析为 SAParsedEvent，只支持 SDK 输出的 JSON 子集. 字符串原地反转义并
+// 以 \0 结尾，因此会修改 line，解析结果直接引用 line，不复制字符串. 日期格式的字符串解析为日期属性.
+// 调用 sa_free_parsed_event 之前不能释放或修改 line.
+//
+// @param line<in/out>     一条事件，不含换行符，不要求以 \0 结尾
+// @param length<in>       事件的字节数
+// @param event<out>       解析结果，成功时需要调用 sa_free_parsed_event 释放
+//
+// @return SA_OK 解析成功，否则解析失败.
+int sa_parse_event(char* line, unsigned long length, SAParsedEvent* event);
+
+// 释放 sa_parse_event 的解析结果.
+void sa_free_parsed_event(SAParsedEvent* event);
+
+// sa_check_parsed_event 发现的错误.
+typedef struct {
+  // 错误类别，合法时为 SA_ERROR_SUMMARY.
+  SAErrorKind kind;
+  char message[256];
+} SACheckError;
+
+// 按 sa_track 等接口的规则检查解析出的事件: distinct_id 与 original_id 的长度、事件名与属性名，
+// 以及所有字符串是否为合法的 UTF-8. 不合法时与跟踪事件时一样报告错误信息，同时将错误类别和信息写入
+// error，不受错误信息限速的影响.
+//
+// @param event<in>        sa_parse_event 的解析结果
+// @param error<out>       不合法时的错误类别和信息，可以为 NULL
+// @param sa<in>           SensorsAnalytics 对象，使用其属性名检查规则
+//
+// @return SA_OK 合法，否则不合法.
+int sa_check_parsed_event(const SAParsedEvent* event, SACheckError* error, struct SensorsAnalytics* sa);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif  // SENSORS_ANALYTICS_CORE_H
@@ -0,0 +1,1083 @@
+/*
+ * Copyright (C) 2015 SensorsData
+ * All rights reserved.
+ */
+
+// Sensors Analytics C SDK 的 C++17 接口，仅包含头文件.
+//
+//   sa::Event(sa, "Buy").set("price", 9.9).set("sku", sku).track(distinct_id);
+//
+// Event 直接将属性序列化至自身的缓冲区，不超过 N 字节时缓冲区位于栈上，不产生任何堆内存分配，
+// 之后通过 sa_track_serialized 交由 SDK 发送.
+//
+// 使用 C++20 编译时，可以通过 sa::Key 和 sa::EventName 在编译期检查属性名和事件名.
+// 固定结构的核心事件可以使用 SA_EVENT 声明，通过 sa::Analytics::track 跟踪.
+// 支持协程时，sa::Analytics 提供 co_await 的 flush_async 和 track_async.
+//
+// 传入 std::pmr::memory_resource 时，Event 的缓冲区和 SDK 序列化事件时的临时内存都从该资源分配，
+// 例如每个请求一个 std::pmr::monotonic_buffer_resource，请求结束时一次性释放.
+
+#ifndef SENSORS_ANALYTICS_HPP
+#define SENSORS_ANALYTICS_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine)
+#include <atomic>
+#include <coroutine>
+#endif
+
+#include "sensors_analytics.h"
+
+// 记录调用 track 的位置，作为 $lib_detail 写入事件.
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1926)
+#define SA_CALLER_FILE __builtin_FILE()
+#define SA_CALLER_FUNCTION __builtin_FUNCTION()
+#define SA_CALLER_LINE __builtin_LINE()
+#else
+#define SA_CALLER_FILE __FILE__
+#define SA_CALLER_FUNCTION __FUNCTION__
+#define SA_CALLER_LINE __LINE__
+#endif
+
+namespace sa {
+
+// Date 类型的属性值，对应 sa_add_date.
+struct Date {
+  std::time_t seconds;
+  int milliseconds;
+};
+
+namespace detail {
+
+// 分配失败时返回 nullptr，而不是抛出异常.
+inline void* resource_allocate(std::pmr::memory_resource* resource, std::size_t size) noexcept {
+  try {
+    return resource->allocate(size, alignof(std::max_align_t));
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+// 将 memory_resource 适配为 SDK 的 SAAllocator.
+struct ResourceAllocator {
+  static void* allocate(unsigned long size, void* ctx) noexcept {
+    return resource_allocate(static_cast<std::pmr::memory_resource*>(ctx), size);
+  }
+
+  static void* reallocate(void* ptr, unsigned long old_size, unsigned long new_size, void* ctx) noexcept {
+    void* p = allocate(new_size, ctx);
+    if (nullptr != p) {
+      std::memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+      deallocate(ptr, old_size, ctx);
+    }
+    return p;
+  }
+
+  static void deallocate(void* ptr, unsigned long size, void* ctx) noexcept {
+    static_cast<std::pmr::memory_resource*>(ctx)->deallocate(ptr, size, alignof(std::max_align_t));
+  }
+
+  static SAAllocator make(std::pmr::memory_resource* resource) noexcept {
+    return SAAllocator{&allocate, &reallocate, &deallocate, resource};
+  }
+};
+
+}  // namespace detail
+
+// 在作用域内将当前线程中 SDK 序列化事件的临时内存交给 resource 分配，离开作用域时恢复.
+// resource 为 nullptr 时不做任何修改.
+//
+// SDK 内部长期存在的对象（属性节点、异步队列中的事件等）使用 sa_set_allocator 设置的分配器.
+class ScopedMemoryResource {
+ public:
+  explicit ScopedMemoryResource(std::pmr::memory_resource* resource) noexcept
+      : allocator_(detail::ResourceAllocator::make(resource)), previous_(nullptr),
+        installed_(nullptr != resource) {
+    if (installed_) {
+      previous_ = sa_set_thread_allocator(&allocator_);
+    }
+  }
+
+  ~ScopedMemoryResource() {
+    if (installed_) {
+      sa_set_thread_allocator(previous_);
+    }
+  }
+
+  ScopedMemoryResource(const ScopedMemoryResource&) = delete;
+  ScopedMemoryResource& operator=(const ScopedMemoryResource&) = delete;
+
+ private:
+  SAAllocator allocator_;
+  const SAAllocator* previous_;
+  bool installed_;
+};
+
+namespace detail {
+
+// 只追加写入的缓冲区，容量不超过 N 时使用内联存储，超过后从 resource 分配（nullptr 表示 malloc）.
+template <std::size_t N>
+class Buffer {
+ public:
+  explicit Buffer(std::pmr::memory_resource* resource = nullptr) noexcept
+      : data_(inline_), size_(0), capacity_(N), resource_(resource) {}
+
+  ~Buffer() { release(); }
+
+  Buffer(Buffer&& other) noexcept { take(other); }
+
+  Buffer& operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+      release();
+      take(other);
+    }
+    return *this;
+  }
+
+  Buffer(const Buffer&) = delete;
+  Buffer& operator=(const Buffer&) = delete;
+
+  // 保证至少有 n 字节的剩余空间，内存不足时返回 nullptr.
+  char* reserve(std::size_t n) noexcept {
+    if (size_ + n > capacity_) {
+      std::size_t capacity = capacity_ * 2;
+      while (capacity < size_ + n) {
+        capacity *= 2;
+      }
+      char* data = static_cast<char*>(nullptr != resource_
+          ? resource_allocate(resource_, capacity) : std::malloc(capacity));
+      if (nullptr == data) {
+        return nullptr;
+      }
+      std::memcpy(data, data_, size_);
+      std::size_t size = size_;
+      release();
+      data_ = data;
+      size_ = size;
+      capacity_ = capacity;
+    }
+    return data_ + size_;
+  }
+
+  void commit(std::size_t n) noexcept { size_ += n; }
+
+  bool put(const char* s, std::size_t n) noexcept {
+    char* p = reserve(n);
+    if (nullptr == p) {
+      return false;
+    }
+    std::memcpy(p, s, n);
+    size_ += n;
+    return true;
+  }
+
+  bool put(char c) noexcept { return put(&c, 1); }
+
+  // 删除 [begin, end) 范围内的内容.
+  void erase(std::size_t begin, std::size_t end) noexcept {
+    std::memmove(data_ + begin, data_ + end, size_ - end);
+    size_ -= end - begin;
+  }
+
+  const char* data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  std::pmr::memory_resource* resource() const noexcept { return resource_; }
+
+ private:
+  void release() noexcept {
+    if (data_ != inline_) {
+      if (nullptr != resource_) {
+        resource_->deallocate(data_, capacity_, alignof(std::max_align_t));
+      } else {
+        std::free(data_);
+      }
+    }
+    data_ = inline_;
+    size_ = 0;
+    capacity_ = N;
+  }
+
+  void take(Buffer& other) noexcept {
+    if (other.data_ == other.inline_) {
+      std::memcpy(inline_, other.inline_, other.size_);
+      data_ = inline_;
+    } else {
+      data_ = other.data_;
+    }
+    size_ = other.size_;
+    capacity_ = other.capacity_;
+    resource_ = other.resource_;
+    other.data_ = other.inline_;
+    other.size_ = 0;
+    other.capacity_ = N;
+  }
+
+  char* data_;
+  std::size_t size_;
+  std::size_t capacity_;
+  std::pmr::memory_resource* resource_;
+  char inline_[N];
+};
+
+// 校验 s 开头的一个 UTF-8 字符，规则与 SDK 中的 sa_utf8_validate_cz 相同.
+// 合法时返回字符长度（1 ~ 4），否则返回 0.
+inline int utf8_char_length(const unsigned char* s, std::size_t n) noexcept {
+  unsigned char c = s[0];
+  int len;
+  if (c <= 0x7F) {
+    return 1;
+  } else if (c <= 0xC1) {
+    return 0;
+  } else if (c <= 0xDF) {
+    len = 2;
+  } else if (c <= 0xEF) {
+    len = 3;
+  } else if (c <= 0xF4) {
+    len = 4;
+  } else {
+    return 0;
+  }
+  if (n < static_cast<std::size_t>(len)) {
+    return 0;
+  }
+  if ((c == 0xE0 && s[1] < 0xA0) || (c == 0xED && s[1] > 0x9F) ||
+      (c == 0xF0 && s[1] < 0x90) || (c == 0xF4 && s[1] > 0x8F)) {
+    return 0;
+  }
+  for (int i = 1; i < len; ++i) {
+    if ((s[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+  }
+  return len;
+}
+
+// 将 UTF-8 字符串序列化为 JSON 字符串，与 SDK 中 _sa_dump_string 的输出一致.
+template <std::size_t N>
+int put_string(Buffer<N>& buffer, std::string_view value) noexcept {
+  static const char kHex[] = "0123456789ABCDEF";
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(value.data());
+  std::size_t n = value.size();
+  std::size_t begin = buffer.size();
+
+  // 先按不需要转义预留 n + 2 字节. 始终保证剩余空间足够写入未处理的字节和结尾的引号，
+  // 遇到转义字符而空间不足时再扩容.
+  char* b = buffer.reserve(n + 2);
+  if (nullptr == b) {
+    return SA_MALLOC_ERROR;
+  }
+  char* end = b + n + 2;
+  std::size_t i = 0;
+  auto grow = [&]() noexcept {
+    buffer.commit(static_cast<std::size_t>(b - (buffer.data() + buffer.size())));
+    std::size_t need = (n - i) * 2 + 7;
+    b = buffer.reserve(need);
+    if (nullptr == b) {
+      buffer.erase(begin, buffer.size());
+      return false;
+    }
+    end = b + need;
+    return true;
+  };
+
+  *b++ = '"';
+  while (i < n) {
+    unsigned char c = s[i];
+    if (('"' == c || '\\' == c || c < 0x20) && static_cast<std::size_t>(end - b) < n - i + 6
+        && !grow()) {
+      return SA_MALLOC_ERROR;
+    }
+    switch (c) {
+    case '"':  *b++ = '\\'; *b++ = '"';  ++i; continue;
+    case '\\': *b++ = '\\'; *b++ = '\\'; ++i; continue;
+    case '\b': *b++ = '\\'; *b++ = 'b';  ++i; continue;
+    case '\f': *b++ = '\\'; *b++ = 'f';  ++i; continue;
+    case '\n': *b++ = '\\'; *b++ = 'n';  ++i; continue;
+    case '\r': *b++ = '\\'; *b++ = 'r';  ++i; continue;
+    case '\t': *b++ = '\\'; *b++ = 't';  ++i; continue;
+    default:
+      break;
+    }
+    if (c < 0x1F) {
+      *b++ = '\\';
+      *b++ = 'u';
+      *b++ = '0';
+      *b++ = '0';
+      *b++ = kHex[c >> 4];
+      *b++ = kHex[c & 0xF];
+      ++i;
+      continue;
+    }
+    int len = utf8_char_length(s + i, n - i);
+    if (0 == len) {
+      buffer.commit(static_cast<std::size_t>(b - (buffer.data() + buffer.size())));
+      buffer.erase(begin, buffer.size());
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+    while (len--) {
+      *b++ = static_cast<char>(s[i++]);
+    }
+  }
+  *b++ = '"';
+
+  buffer.commit(static_cast<std::size_t>(b - (buffer.data() + buffer.size())));
+  return SA_OK;
+}
+
+// 按 format 写入不超过 63 字节的内容.
+template <std::size_t N, typename... Args>
+int put_format(Buffer<N>& buffer, const char* format, Args... args) noexcept {
+  char* p = buffer.reserve(64);
+  if (nullptr == p) {
+    return SA_MALLOC_ERROR;
+  }
+  int n = std::snprintf(p, 64, format, args...);
+  buffer.commit(n < 64 ? static_cast<std::size_t>(n) : 63);
+  return SA_OK;
+}
+
+// 按类型序列化属性值，与 SDK 中 _sa_dump_node 的输出一致.
+template <std::size_t N>
+int write_value(Buffer<N>& buffer, bool value) noexcept {
+  return buffer.put(value ? "true" : "false", value ? 4 : 5) ? SA_OK : SA_MALLOC_ERROR;
+}
+
+template <std::size_t N, typename T,
+          typename std::enable_if<std::is_integral<T>::value
+                                  && !std::is_same<T, bool>::value, int>::type = 0>
+int write_value(Buffer<N>& buffer, T value) noexcept {
+  return put_format(buffer, "%lld", static_cast<long long>(value));
+}
+
+template <std::size_t N, typename T,
+          typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+int write_value(Buffer<N>& buffer, T value) noexcept {
+  return put_format(buffer, "%.3f", static_cast<double>(value));
+}
+
+template <std::size_t N>
+int write_value(Buffer<N>& buffer, std::string_view value) noexcept {
+  return put_string(buffer, value);
+}
+
+template <std::size_t N>
+int write_value(Buffer<N>& buffer, const char* value) noexcept {
+  return put_string(buffer, std::string_view(nullptr == value ? "" : value));
+}
+
+template <std::size_t N>
+int write_value(Buffer<N>& buffer, const Date& value) noexcept {
+  struct tm tm;
+#if defined(_WIN32)
+  localtime_s(&tm, &value.seconds);
+#else
+  localtime_r(&value.seconds, &tm);
+#endif
+  return put_format(buffer, "\"%04d-%02d-%02d %02d:%02d:%02d.%03d\"",
+                    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                    tm.tm_hour, tm.tm_min, tm.tm_sec, value.milliseconds);
+}
+
+// List 类型的属性值，元素必须是字符串.
+template <std::size_t N, typename R,
+          typename std::enable_if<!std::is_convertible<const R&, std::string_view>::value, int>::type = 0,
+          typename = decltype(std::begin(std::declval<const R&>()))>
+int write_value(Buffer<N>& buffer, const R& values) noexcept {
+  int res = SA_OK;
+  bool first = true;
+  if (!buffer.put('[')) {
+    return SA_MALLOC_ERROR;
+  }
+  for (const auto& value : values) {
+    if (!first && !buffer.put(',')) {
+      return SA_MALLOC_ERROR;
+    }
+    first = false;
+    if (SA_OK != (res = put_string(buffer, std::string_view(value)))) {
+      return res;
+    }
+  }
+  return buffer.put(']') ? SA_OK : SA_MALLOC_ERROR;
+}
+
+// 写入常量片段 key 和属性值.
+template <std::size_t N, std::size_t M, typename V>
+int write_field(Buffer<N>& buffer, const char (&key)[M], const V& value) noexcept {
+  if (!buffer.put(key, M - 1)) {
+    return SA_MALLOC_ERROR;
+  }
+  return write_value(buffer, value);
+}
+
+// 将 std::string_view 复制为以 \0 结尾的字符串，超过 255 字节时返回 false.
+inline bool copy_name(std::string_view name, char (&out)[256]) noexcept {
+  if (name.size() > 255) {
+    return false;
+  }
+  std::memcpy(out, name.data(), name.size());
+  out[name.size()] = '\0';
+  return true;
+}
+
+constexpr char to_lower(char c) noexcept {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// 不区分大小写地比较 name 与 keyword，用于检查保留字.
+constexpr bool equals_ignore_case(const char* name, std::size_t n, const char* keyword) noexcept {
+  std::size_t i = 0;
+  for (; i < n && keyword[i] != '\0'; ++i) {
+    if (to_lower(name[i]) != keyword[i]) {
+      return false;
+    }
+  }
+  return i == n && keyword[i] == '\0';
+}
+
+// 与 sa_check_key_name 的规则一致，可在编译期求值.
+constexpr bool is_valid_name(const char* name, std::size_t n) noexcept {
+  const char* const kKeywords[] = {
+    "distinct_id", "original_id", "time", "properties", "id", "first_id", "second_id",
+    "users", "events", "event", "user_id", "date", "datetime"
+  };
+  if (n < 1 || n > 100) {
+    return false;
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    char c = name[i];
+    bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$';
+    if (!alpha && (i == 0 || c < '0' || c > '9')) {
+      return false;
+    }
+  }
+  for (const char* keyword : kKeywords) {
+    if (equals_ignore_case(name, n, keyword)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__cpp_consteval)
+// 在编译期调用该函数会导致编译失败，用于报告不合法的名称.
+inline void invalid_name_see_sa_check_key_name() noexcept {}
+#endif
+
+}  // namespace detail
+
+#if defined(__cpp_consteval)
+// 编译期检查的属性名，例如 sa::Key{"price"}.
+//
+// 不合法的名称无法通过编译. 同时在编译期生成 JSON 中的 "price": 片段，运行时不再检查和转义.
+template <std::size_t N>
+class Key {
+ public:
+  consteval Key(const char (&name)[N]) : json_{} {
+    if (!detail::is_valid_name(name, N - 1) || detail::equals_ignore_case(name, N - 1, "$time")
+        || detail::equals_ignore_case(name, N - 1, "$project")) {
+      detail::invalid_name_see_sa_check_key_name();
+    }
+    // 合法的名称中不包含需要转义的字符.
+    json_[0] = '"';
+    for (std::size_t i = 0; i + 1 < N; ++i) {
+      json_[i + 1] = name[i];
+    }
+    json_[N] = '"';
+    json_[N + 1] = ':';
+  }
+
+  constexpr std::string_view name() const noexcept { return std::string_view(json_ + 1, N - 1); }
+  constexpr std::string_view json() const noexcept { return std::string_view(json_, N + 2); }
+
+ private:
+  char json_[N + 2];
+};
+
+// 编译期检查的事件名，例如 sa::EventName{"Buy"}.
+template <std::size_t N>
+class EventName {
+ public:
+  consteval EventName(const char (&name)[N]) : name_{} {
+    if (!detail::is_valid_name(name, N - 1)) {
+      detail::invalid_name_see_sa_check_key_name();
+    }
+    for (std::size_t i = 0; i < N; ++i) {
+      name_[i] = name[i];
+    }
+  }
+
+  constexpr std::string_view name() const noexcept { return std::string_view(name_, N - 1); }
+
+ private:
+  char name_[N];
+};
+#endif
+
+// 事件构造器，只能移动，不能复制.
+//
+// 属性按调用顺序写入缓冲区，同名属性以最后一次设置为准. 任一调用失败后，track 返回首个错误码.
+// 以 $time 和 $project 为名的属性请使用 SAProperties 接口设置.
+//
+// 属性名可以是 std::string_view（运行时检查），也可以是 sa::Key（C++20，编译期检查）.
+//
+// 指定 resource 时，超出 N 字节的缓冲区以及 track 时 SDK 序列化事件的临时内存都从 resource 分配.
+template <std::size_t N = 1024>
+class BasicEvent {
+ public:
+  BasicEvent(SensorsAnalytics* sa,
+             std::string_view event,
+             std::pmr::memory_resource* resource = nullptr) noexcept
+      : sa_(sa), status_(SA_OK), flags_(0), buffer_(resource) {
+    if (nullptr == sa_ || !detail::copy_name(event, event_)) {
+      status_ = SA_INVALID_PARAMETER_ERROR;
+      event_[0] = '\0';
+    }
+  }
+
+#if defined(__cpp_consteval)
+  // 事件名已在编译期检查，track 时 SDK 不再检查.
+  template <std::size_t M>
+  BasicEvent(SensorsAnalytics* sa,
+             const EventName<M>& event,
+             std::pmr::memory_resource* resource = nullptr) noexcept
+      : BasicEvent(sa, event.name(), resource) {
+    flags_ |= SA_TRACK_TRUSTED_EVENT;
+  }
+#endif
+
+  BasicEvent(BasicEvent&&) noexcept = default;
+  BasicEvent& operator=(BasicEvent&&) noexcept = default;
+  BasicEvent(const BasicEvent&) = delete;
+  BasicEvent& operator=(const BasicEvent&) = delete;
+
+  // 设置属性，值可以是 bool、整数、浮点数、字符串、sa::Date 或字符串的序列（List 类型）.
+  //
+  // 对临时对象调用时返回右值引用，便于直接传给 track_async.
+  template <typename K, typename V>
+  BasicEvent& set(const K& key, const V& value) & noexcept {
+    if (begin_property(key)) {
+      fail(detail::write_value(buffer_, value));
+    }
+    return *this;
+  }
+
+  template <typename K, typename V>
+  BasicEvent&& set(const K& key, const V& value) && noexcept {
+    return std::move(set(key, value));
+  }
+
+  // 设置 List 类型的属性，元素必须是 String 类型的.
+  template <typename K>
+  BasicEvent& set(const K& key, std::initializer_list<std::string_view> values) & noexcept {
+    if (begin_property(key)) {
+      fail(detail::write_value(buffer_, values));
+    }
+    return *this;
+  }
+
+  template <typename K>
+  BasicEvent&& set(const K& key, std::initializer_list<std::string_view> values) && noexcept {
+    return std::move(set(key, values));
+  }
+
+  // 设置 Date 类型的属性.
+  template <typename K>
+  BasicEvent& set_date(const K& key, std::time_t seconds, int milliseconds) & noexcept {
+    return set(key, Date{seconds, milliseconds});
+  }
+
+  template <typename K>
+  BasicEvent&& set_date(const K& key, std::time_t seconds, int milliseconds) && noexcept {
+    return std::move(set(key, Date{seconds, milliseconds}));
+  }
+
+  // 跟踪事件.
+  //
+  // @return SA_OK 追踪成功，否则追踪失败.
+  int track(std::string_view distinct_id,
+            const char* file = SA_CALLER_FILE,
+            const char* function = SA_CALLER_FUNCTION,
+            unsigned long line = SA_CALLER_LINE) noexcept {
+    return track_with(0, distinct_id, file, function, line);
+  }
+
+  // 使用额外的 SA_TRACK_* 选项跟踪事件.
+  int track_with(unsigned int flags,
+                 std::string_view distinct_id,
+                 const char* file = SA_CALLER_FILE,
+                 const char* function = SA_CALLER_FUNCTION,
+                 unsigned long line = SA_CALLER_LINE) noexcept {
+    char id[256];
+    if (SA_OK != status_) {
+      return status_;
+    }
+    if (!detail::copy_name(distinct_id, id)) {
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+    ScopedMemoryResource scope(buffer_.resource());
+    return _sa_track_serialized(
+        id, event_, buffer_.data(), buffer_.size(), flags_ | flags, file, function, line, sa_);
+  }
+
+  SensorsAnalytics* get() const noexcept { return sa_; }
+
+  int status() const noexcept { return status_; }
+
+  // 预序列化的属性片段.
+  std::string_view properties() const noexcept {
+    return std::string_view(buffer_.data(), buffer_.size());
+  }
+
+ private:
+  void fail(int res) noexcept {
+    if (SA_OK == status_ && SA_OK != res) {
+      status_ = res;
+    }
+  }
+
+  void put(const char* s, std::size_t n) noexcept {
+    if (!buffer_.put(s, n)) {
+      fail(SA_MALLOC_ERROR);
+    }
+  }
+
+  void put(char c) noexcept { put(&c, 1); }
+
+  // 删除已有的同名属性并写入 "key":，key 不合法时返回 false.
+  bool begin_property(std::string_view key) noexcept {
+    char name[256];
+    if (SA_OK != status_) {
+      return false;
+    }
+    if (!detail::copy_name(key, name) || SA_OK != sa_check_key_name(name, sa_)
+        || key == "$time" || key == "$project") {
+      fail(SA_INVALID_PARAMETER_ERROR);
+      return false;
+    }
+    erase_property(key);
+    if (buffer_.size() > 0) {
+      put(',');
+    }
+    put('"');
+    put(key.data(), key.size());
+    put("\":", 2);
+    return SA_OK == status_;
+  }
+
+  bool begin_property(const char* key) noexcept {
+    return begin_property(std::string_view(nullptr == key ? "" : key));
+  }
+
+#if defined(__cpp_consteval)
+  // 编译期检查过的属性名，直接写入预先生成的 "key":.
+  template <std::size_t M>
+  bool begin_property(const Key<M>& key) noexcept {
+    if (SA_OK != status_) {
+      return false;
+    }
+    erase_property(key.name());
+    if (buffer_.size() > 0) {
+      put(',');
+    }
+    put(key.json().data(), key.json().size());
+    return SA_OK == status_;
+  }
+#endif
+
+  // 找到片段中的 "key": 并删除整个属性. 片段中字符串值内的 '"' 均已转义.
+  void erase_property(std::string_view key) noexcept {
+    const char* data = buffer_.data();
+    std::size_t size = buffer_.size();
+    std::size_t pos = 0;
+    while (pos + key.size() + 3 <= size) {
+      if (data[pos] == '"' && (pos == 0 || data[pos - 1] == ',')
+          && 0 == std::memcmp(data + pos + 1, key.data(), key.size())
+          && data[pos + key.size() + 1] == '"' && data[pos + key.size() + 2] == ':') {
+        std::size_t end = skip_value(pos + key.size() + 3);
+        if (end < size) {
+          // 删除属性及其后的 ','.
+          buffer_.erase(pos, end + 1);
+        } else if (pos > 0) {
+          // 删除最后一个属性及其前的 ','.
+          buffer_.erase(pos - 1, end);
+        } else {
+          buffer_.erase(pos, end);
+        }
+        return;
+      }
+      const void* next = std::memchr(data + pos + 1, '"', size - pos - 1);
+      if (nullptr == next) {
+        return;
+      }
+      pos = static_cast<std::size_t>(static_cast<const char*>(next) - data);
+    }
+  }
+
+  // 返回从 pos 开始的值之后的位置.
+  std::size_t skip_value(std::size_t pos) const noexcept {
+    const char* data = buffer_.data();
+    std::size_t size = buffer_.size();
+    bool in_string = false;
+    for (; pos < size; ++pos) {
+      char c = data[pos];
+      if (in_string) {
+        if (c == '\\') {
+          ++pos;
+        } else if (c == '"') {
+          in_string = false;
+        }
+      } else if (c == '"') {
+        in_string = true;
+      } else if (c == ',') {
+        return pos;
+      } else if (c == '[') {
+        // List 中只包含字符串，跳到匹配的 ']'.
+        for (++pos; pos < size && data[pos] != ']'; ++pos) {
+          if (data[pos] == '"') {
+            for (++pos; pos < size && data[pos] != '"'; ++pos) {
+              if (data[pos] == '\\') {
+                ++pos;
+              }
+            }
+          }
+        }
+      }
+    }
+    return size;
+  }
+
+  SensorsAnalytics* sa_;
+  int status_;
+  unsigned int flags_;
+  char event_[256];
+  detail::Buffer<N> buffer_;
+};
+
+using Event = BasicEvent<>;
+
+#if defined(__cpp_impl_coroutine)
+// co_await analytics.flush_async()，在之前写入的事件全部交给下游 Consumer 并 flush 后恢复，
+// 结果为 SA_* 错误码. 使用 AsyncConsumer 时协程在 SDK 的写线程中恢复，请尽快切换回自己的执行器.
+class FlushAwaitable {
+ public:
+  explicit FlushAwaitable(SensorsAnalytics* sa) noexcept : sa_(sa), result_(SA_OK), state_(false) {}
+
+  FlushAwaitable(const FlushAwaitable&) = delete;
+  FlushAwaitable& operator=(const FlushAwaitable&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) noexcept {
+    handle_ = handle;
+    int res = sa_flush_async(sa_, &FlushAwaitable::on_complete, this);
+    if (SA_OK != res) {
+      result_ = res;
+      return false;
+    }
+    // 回调可能已在 sa_flush_async 返回前执行，此时不再挂起.
+    return !state_.exchange(true, std::memory_order_acq_rel);
+  }
+
+  int await_resume() const noexcept { return result_; }
+
+ private:
+  static void on_complete(int result, void* user_data) noexcept {
+    FlushAwaitable* self = static_cast<FlushAwaitable*>(user_data);
+    self->result_ = result;
+    if (self->state_.exchange(true, std::memory_order_acq_rel)) {
+      self->handle_.resume();
+    }
+  }
+
+  SensorsAnalytics* sa_;
+  int result_;
+  std::atomic<bool> state_;
+  std::coroutine_handle<> handle_;
+};
+
+// co_await analytics.track_async(distinct_id, std::move(event))，AsyncConsumer 的队列已满时
+// 挂起协程而不是阻塞线程，出现空位后在写线程中恢复并重试. 结果为 SA_* 错误码.
+template <std::size_t N>
+class TrackAwaitable {
+ public:
+  TrackAwaitable(std::string_view distinct_id,
+                 BasicEvent<N>&& event,
+                 const char* file,
+                 const char* function,
+                 unsigned long line) noexcept
+      : distinct_id_(distinct_id), event_(std::move(event)), file_(file), function_(function),
+        line_(line), result_(SA_OK), state_(false) {}
+
+  TrackAwaitable(const TrackAwaitable&) = delete;
+  TrackAwaitable& operator=(const TrackAwaitable&) = delete;
+
+  bool await_ready() noexcept {
+    result_ = try_track();
+    return SA_QUEUE_FULL_ERROR != result_;
+  }
+
+  bool await_suspend(std::coroutine_handle<> handle) noexcept {
+    handle_ = handle;
+    return arm();
+  }
+
+  int await_resume() const noexcept { return result_; }
+
+ private:
+  int try_track() noexcept {
+    return event_.track_with(SA_TRACK_NONBLOCKING, distinct_id_, file_, function_, line_);
+  }
+
+  // 重试直到成功或需要等待空位，返回 true 表示已注册回调并应挂起.
+  //
+  // 注册回调后，arm 与 on_writable 中后执行 state_.exchange 的一方负责继续处理.
+  bool arm() noexcept {
+    for (;;) {
+      result_ = try_track();
+      if (SA_QUEUE_FULL_ERROR != result_) {
+        return false;
+      }
+      state_.store(false, std::memory_order_relaxed);
+      if (SA_OK == sa_notify_writable(event_.get(), &TrackAwaitable::on_writable, this)) {
+        continue;
+      }
+      if (!state_.exchange(true, std::memory_order_acq_rel)) {
+        return true;
+      }
+    }
+  }
+
+  static void on_writable(int result, void* user_data) noexcept {
+    TrackAwaitable* self = static_cast<TrackAwaitable*>(user_data);
+    if (!self->state_.exchange(true, std::memory_order_acq_rel)) {
+      // arm 尚未返回，由 arm 重试.
+      return;
+    }
+    if (SA_OK != result) {
+      self->result_ = result;
+      self->handle_.resume();
+    } else if (!self->arm()) {
+      self->handle_.resume();
+    }
+  }
+
+  std::string_view distinct_id_;
+  BasicEvent<N> event_;
+  const char* file_;
+  const char* function_;
+  unsigned long line_;
+  int result_;
+  std::atomic<bool> state_;
+  std::coroutine_handle<> handle_;
+};
+#endif
+
+// 作用域属性，构造时在当前线程压入，析构时弹出，须在构造的线程中析构.
+class Scope {
+ public:
+  Scope(SensorsAnalytics* sa, const SAProperties* properties) noexcept
+      : sa_(sa), result_(sa_scope_push(properties, sa)) {}
+
+  ~Scope() {
+    if (SA_OK == result_) {
+      sa_scope_pop(sa_);
+    }
+  }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+  // 压入的结果，SA_OK 表示成功.
+  int result() const noexcept { return result_; }
+
+ private:
+  SensorsAnalytics* sa_;
+  int result_;
+};
+
+// 读取日志文件中一个字节范围内的记录，持有 SALogReader.
+class LogReader {
+ public:
+  explicit LogReader(const char* path, unsigned long long offset = 0, unsigned long long length = 0) noexcept
+      : reader_(nullptr), result_(sa_log_reader_open(path, offset, length, &reader_)) {}
+
+  ~LogReader() { sa_log_reader_close(reader_); }
+
+  LogReader(const LogReader&) = delete;
+  LogReader& operator=(const LogReader&) = delete;
+
+  // 打开的结果，SA_OK 表示成功.
+  int result() const noexcept { return result_; }
+
+  // 读取下一条记录，读完或打开失败时返回 false. record 在 LogReader 释放之前有效.
+  bool next(std::string_view& record) noexcept {
+    const char* data = nullptr;
+    unsigned long length = 0;
+    if (SA_OK != result_ || SA_OK != sa_log_reader_next(reader_, &data, &length) || nullptr == data) {
+      return false;
+    }
+    record = std::string_view(data, length);
+    return true;
+  }
+
+ private:
+  SALogReader* reader_;
+  int result_;
+};
+
+// SensorsAnalytics 对象的 C++ 接口，不持有 SensorsAnalytics 对象.
+//
+// 指定 resource 时，通过它创建和跟踪的事件所需的内存都从 resource 分配.
+class Analytics {
+ public:
+  explicit Analytics(SensorsAnalytics* sa, std::pmr::memory_resource* resource = nullptr) noexcept
+      : sa_(sa), resource_(resource) {}
+
+  SensorsAnalytics* get() const noexcept { return sa_; }
+
+  std::pmr::memory_resource* resource() const noexcept { return resource_; }
+
+  Event event(std::string_view name) const noexcept { return Event(sa_, name, resource_); }
+
+  // 跟踪 SA_EVENT 声明的事件.
+  //
+  // @return SA_OK 追踪成功，否则追踪失败.
+  template <typename E, std::size_t N = 1024>
+  int track(std::string_view distinct_id,
+            const E& event,
+            const char* file = SA_CALLER_FILE,
+            const char* function = SA_CALLER_FUNCTION,
+            unsigned long line = SA_CALLER_LINE) const noexcept {
+    char id[256];
+    detail::Buffer<N> buffer(resource_);
+    int res = SA_OK;
+
+    if (!detail::copy_name(distinct_id, id)) {
+      return SA_INVALID_PARAMETER_ERROR;
+    }
+    if (SA_OK != (res = event.sa_write_properties(buffer))) {
+      return res;
+    }
+
+    // 每个属性片段都以 ',' 开头.
+    const char* properties = buffer.size() > 0 ? buffer.data() + 1 : nullptr;
+    unsigned long length = buffer.size() > 0 ? static_cast<unsigned long>(buffer.size() - 1) : 0;
+    ScopedMemoryResource scope(resource_);
+    return _sa_track_serialized(id, E::sa_event_name(), properties, length,
+                                SA_TRACK_TRUSTED_EVENT, file, function, line, sa_);
+  }
+
+  void flush() const noexcept { sa_flush(sa_); }
+
+#if defined(__cpp_impl_coroutine)
+  FlushAwaitable flush_async() const noexcept { return FlushAwaitable(sa_); }
+
+  // distinct_id 引用的字符串须在 co_await 完成前保持有效.
+  template <std::size_t N>
+  TrackAwaitable<N> track_async(std::string_view distinct_id,
+                                BasicEvent<N>&& event,
+                                const char* file = SA_CALLER_FILE,
+                                const char* function = SA_CALLER_FUNCTION,
+                                unsigned long line = SA_CALLER_LINE) const noexcept {
+    return TrackAwaitable<N>(distinct_id, std::move(event), file, function, line);
+  }
+#endif
+
+ private:
+  SensorsAnalytics* sa_;
+  std::pmr::memory_resource* resource_;
+};
+
+}  // namespace sa
+
+// SA_EVENT ------------------------------------------------------------------
+
+#define SA_PP_EXPAND(x) x
+#define SA_PP_CAT(a, b) SA_PP_CAT_I(a, b)
+#define SA_PP_CAT_I(a, b) a##b
+#define SA_PP_NARG(...) \
+  SA_PP_EXPAND(SA_PP_NARG_I(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define SA_PP_NARG_I(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define SA_PP_FOR_EACH(m, ...) \
+  SA_PP_EXPAND(SA_PP_CAT(SA_PP_FOR_EACH_, SA_PP_NARG(__VA_ARGS__))(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_1(m, x) m(x)
+#define SA_PP_FOR_EACH_2(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_1(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_3(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_2(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_4(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_3(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_5(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_4(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_6(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_5(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_7(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_6(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_8(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_7(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_9(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_8(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_10(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_9(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_11(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_10(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_12(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_11(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_13(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_12(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_14(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_13(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_15(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_14(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_16(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_15(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_17(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_16(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_18(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_17(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_19(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_18(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_20(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_19(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_21(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_20(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_22(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_21(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_23(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_22(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_24(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_23(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_25(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_24(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_26(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_25(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_27(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_26(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_28(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_27(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_29(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_28(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_30(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_29(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_31(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_30(m, __VA_ARGS__))
+#define SA_PP_FOR_EACH_32(m, x, ...) m(x) SA_PP_EXPAND(SA_PP_FOR_EACH_31(m, __VA_ARGS__))
+
+#define SA_EVENT_FIELD_DECL(field) SA_EVENT_FIELD_DECL_I field
+#define SA_EVENT_FIELD_DECL_I(type, name)                                         \
+  type name;                                                                    \
+  static_assert(::sa::detail::is_valid_name(#name, sizeof(#name) - 1),          \
+                "invalid property name: " #name);
+
+#define SA_EVENT_FIELD_WRITE(field) SA_EVENT_FIELD_WRITE_I field
+#define SA_EVENT_FIELD_WRITE_I(type, name)                                        \
+  if (SA_OK == res) {                                                           \
+    res = ::sa::detail::write_field(buffer, ",\"" #name "\":", this->name);     \
+  }
+
+// 声明一个事件结构体，并在编译期生成它的序列化函数，最多支持 32 个属性:
+//
+//   SA_EVENT(OrderPaid, (double, amount), (std::string_view, sku));
+//   analytics.track(distinct_id, OrderPaid{9.9, sku});
+//
+// 事件名和属性名在编译期检查. 序列化时依次写入常量片段 ,"amount": 和按类型序列化的属性值，
+// 不构造 SAProperties，也不在运行时检查属性名.
+#define SA_EVENT(Name, ...)                                                       \
+  struct Name {                                                                 \
+    SA_PP_FOR_EACH(SA_EVENT_FIELD_DECL, __VA_ARGS__)                            \
+                                                                                \
+    static_assert(::sa::detail::is_valid_name(#Name, sizeof(#Name) - 1),        \
+                  "invalid event name: " #Name);                                \
+    static constexpr const char* sa_event_name() noexcept { return #Name; }     \
+                                                                                \
+    template <std::size_t N>                                                    \
+    int sa_write_properties(::sa::detail::Buffer<N>& buffer) const noexcept {   \
+      int res = SA_OK;                                                          \
+      SA_PP_FOR_EACH(SA_EVENT_FIELD_WRITE, __VA_ARGS__)                         \
+      return res;                                                               \
+    }                                                                           \
+  }
+
+#endif  // SENSORS_ANALYTICS_HPP